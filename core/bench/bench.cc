@@ -0,0 +1,386 @@
+// Benchmark suite
+// micro benchmarks of the display/input hot paths + a replayed drawing session
+// results are written as JSON, to compare commits and rM1/rM2/host runs
+//
+// usage: bench [--fb /dev/fb0 | --fb default] [--out results.json] [--filter name]
+//  --fb      benchmark against the real frame buffer (default: memory frame buffer)
+//            'default': rm2fb server when running, /dev/fb0 otherwise (rM2 / rM1)
+//  refresh submission is only measured on a real frame buffer
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../fb.cc"
+#include "../input.cc"
+#include "../cleanup.cc"
+#include "../raster.cc"
+#include "../dither.cc"
+#include "../render.cc"
+#include "../selection.cc"
+#include "../shapes.cc"
+#include "../tiles.cc"
+
+#ifndef STYLO_COMMIT
+#define STYLO_COMMIT "unknown"
+#endif
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Result {
+    string name;
+    long iterations;
+    double ns_per_op;
+    double bytes_per_op;
+};
+
+// run fn() until enough time is gathered, repeat and keep the median
+Result measure( const string& name, double bytes_per_op, const function<void()>& fn) {
+    fn();   // warm up
+
+    long iterations = 1;
+    for(;;) {
+        auto start = Clock::now();
+        for( long i = 0; i < iterations; ++i)
+            fn();
+        auto elapsed = chrono::duration<double>( Clock::now() - start).count();
+        if( elapsed > 0.05 || iterations >= (1L << 30))
+            break;
+        iterations *= 2;
+    }
+
+    vector<double> runs;
+    for( int r = 0; r < 5; ++r) {
+        auto start = Clock::now();
+        for( long i = 0; i < iterations; ++i)
+            fn();
+        runs.push_back( chrono::duration<double, nano>( Clock::now() - start).count() / iterations);
+    }
+    sort( runs.begin(), runs.end());
+
+    return Result{ name, iterations, runs[ runs.size() / 2], bytes_per_op };
+}
+
+// evdev stream, as read from /dev/input
+struct EventStream {
+    vector<input_event> events;
+
+    void push( int type, int code, int value) {
+        input_event ev{};
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+        events.push_back( ev);
+    }
+
+    // one pen sample at screen position (portrait rM1 wiring, see calibration.cc)
+    // tilt in 1/100 degree
+    void sample( int x, int y, bool touch, int pressure = 2000, int tilt_x = 0, int tilt_y = 0) {
+        push( EV_ABS, ABS_X, (SCREEN_HEIGHT - y) * 20967 / SCREEN_HEIGHT);
+        push( EV_ABS, ABS_Y, x * 15725 / SCREEN_WIDTH);
+        push( EV_ABS, ABS_PRESSURE, pressure);
+        push( EV_ABS, ABS_TILT_X, tilt_x);
+        push( EV_ABS, ABS_TILT_Y, tilt_y);
+        push( EV_KEY, BTN_TOUCH, touch);
+        push( EV_SYN, SYN_REPORT, 0);
+    }
+
+    // scribble session: strokes of spirals over the page
+    static EventStream session( int strokes, int samples) {
+        EventStream s;
+        s.push( EV_KEY, BTN_TOOL_PEN, 1);
+        for( int k = 0; k < strokes; ++k) {
+            double cx = 200 + (k * 277) % 1000, cy = 200 + (k * 431) % 1400;
+            for( int i = 0; i < samples; ++i) {
+                double a = i * 0.05, r = 20 + i * 0.3;
+                s.sample( cx + r * cos( a), cy + r * sin( a), i + 1 < samples,
+                          2048 + 1800 * sin( i * 0.1), 3000 * cos( a), 2000);
+            }
+        }
+        return s;
+    }
+};
+
+// pipe holding a whole event stream, read back through Input::readEvent
+struct EventPipe {
+    int fds[2];
+
+    EventPipe() {
+        if( pipe2( fds, O_NONBLOCK))
+            throw string( "bench: could not create pipe\n");
+        fcntl( fds[1], F_SETPIPE_SZ, 1 << 20);
+    }
+
+    ~EventPipe() {
+        ::close( fds[0]);
+        ::close( fds[1]);
+    }
+
+    void write( const EventStream& s) {
+        auto data = (const char*) s.events.data();
+        size_t size = s.events.size() * sizeof( input_event);
+        if( ::write( fds[1], data, size) != (ssize_t) size)
+            throw string( "bench: event stream does not fit in pipe\n");
+    }
+};
+
+// software disc, stands for Draw::draw_at (cairo is not available on host)
+Rect draw_disc( FrameBuffer& fb, int cx, int cy, int r, uint16_t color) {
+    Rect box{ Point{ max( cx - r, 0), max( cy - r, 0)},
+              Point{ min( cx + r + 1, fb.width()), min( cy + r + 1, fb.height())} };
+
+    for( int y = box.topLeft.y; y < box.bottomRight.y; ++y) {
+        int dy = y - cy;
+        int dx = (int) sqrt( max( r * r - dy * dy, 0));
+        int x0 = max( cx - dx, box.topLeft.x), x1 = min( cx + dx + 1, box.bottomRight.x);
+
+        auto row = (uint16_t*) (fb.mem_map + y * fb.finfo.line_length);
+        if( x0 < x1)
+            fill_row( row + x0, x1 - x0, color);
+    }
+    return box;
+}
+
+string target() {
+    ifstream machine( "/sys/devices/soc0/machine");
+    string name;
+    getline( machine, name);
+    if( name.find( "reMarkable") == string::npos)
+        return "host";
+    return detect_model() == Model::rM2 ? "rM2" : "rM1";
+}
+
+string arch() {
+#if defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#elif defined(__x86_64__)
+    return "x86_64";
+#else
+    return "unknown";
+#endif
+}
+
+void write_json( ostream& out, const vector<Result>& results, const string& fb) {
+    out << "{\n"
+        << "  \"suite\": \"stylo\",\n"
+        << "  \"commit\": \"" << STYLO_COMMIT << "\",\n"
+        << "  \"target\": \"" << target() << "\",\n"
+        << "  \"arch\": \"" << arch() << "\",\n"
+        << "  \"framebuffer\": \"" << fb << "\",\n"
+        << "  \"results\": [\n";
+
+    for( size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\""
+            << ", \"iterations\": " << r.iterations
+            << ", \"ns_per_op\": " << r.ns_per_op;
+        if( r.bytes_per_op > 0)
+            out << ", \"mb_per_s\": " << r.bytes_per_op / r.ns_per_op * 1e3;
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc,char** argv) {
+try {
+    string fb_path, out_path, filter;
+    for( int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if( arg == "--fb")          fb_path = argv[i+1];
+        else if( arg == "--out")    out_path = argv[i+1];
+        else if( arg == "--filter") filter = argv[i+1];
+        else
+            throw "bench: unknown option " + arg + "\n";
+    }
+
+    auto fb = fb_path.empty() ? FrameBuffer::memory()
+            : fb_path == "default" ? FrameBuffer::open_default() : FrameBuffer::open( fb_path.c_str());
+    bool memory = fb.device < 0 && fb.queue < 0;
+    fb.to_s();
+
+    Input input( {});       // no device: events are replayed from a pipe
+    vector<Result> results;
+
+    // ops => number of operations done by one call of fn
+    auto run = [&]( const string& name, double bytes, const function<void()>& fn, int ops = 1) {
+        if( !filter.empty() && name.find( filter) == string::npos)
+            return;
+
+        auto r = measure( name, bytes, fn);
+        r.ns_per_op /= ops;
+        r.bytes_per_op /= ops;
+        results.push_back( r);
+        cerr << name << ": " << r.ns_per_op << " ns/op" << endl;
+    };
+
+    // frame buffer
+    uint8_t color = 0;
+    run( "fb_fill_full", fb.frame_length, [&]{ fb.fill( color++); });
+
+    // memory frame buffer: refresh returns at once, nothing to compare
+    Rect small{ Point{ 100, 100}, Point{ 132, 132} };
+    if( !memory)
+        run( "fb_refresh_submit_du", 0, [&]{ fb.refresh( small); });
+    else
+        cerr << "fb_refresh_submit_du: skipped (memory frame buffer)" << endl;
+
+    CleanupScheduler cleaner( fb);
+    run( "cleanup_mark_rect", 0, [&]{ cleaner.mark( small); });
+
+    // rasterization
+    unsigned k = 0;
+    run( "raster_disc_r10", 0, [&]{ draw_disc( fb, 100 + (k++ % 1200), 500, 10, 0x0000); });
+    run( "raster_disc_r100", 0, [&]{ draw_disc( fb, 200 + (k++ % 1000), 500, 100, 0xffff); });
+
+    // raster ops
+    Surface screen( fb);
+    Bitmap page( fb.width(), fb.height());
+    Rect region{ Point{ 300, 400}, Point{ 700, 800} };
+
+    run( "raster_fill_full_rgb565", fb.frame_length, [&]{ fill( screen, screen.bounds(), (uint16_t) 0x8410); });
+    run( "raster_fill_rect_400", region.area() * 2, [&]{ fill( screen, region, (uint16_t) 0x8410); });
+    run( "raster_blit_rect_400", region.area() * 2, [&]{ blit( screen, region.topLeft, page, region); });
+    run( "raster_pattern_grid_400", region.area() * 2, [&]{ pattern( screen, region, PatternSpec{ Pattern::Grid}); });
+    run( "raster_pattern_dotted_full", fb.frame_length, [&]{ pattern( page, page.bounds(), PatternSpec{ Pattern::Dotted}); });
+    run( "raster_blit_scaled_full", fb.frame_length, [&]{ blit_scaled( screen, screen.bounds(), page, 100, 200, 0.6f); });
+
+    // brushes: one segment of wet ink (pen samples ~2 px apart), nominal width 6
+    auto brush_segment = [&]( Brush b) {
+        return [&, b]{
+            BrushStroke stroke( b, 0x00, 6);
+            for( int i = 0; i < 64; ++i)
+                stroke.add( screen, screen.bounds(), StrokePoint{ (int16_t) (300 + 2 * i), (int16_t) (500 + i), (uint16_t) (1024 + 32 * i), 30, 10});
+        };
+    };
+    run( "brush_segment_pen", 0, brush_segment( Brush::Pen), 64);
+    run( "brush_segment_pencil", 0, brush_segment( Brush::Pencil), 64);
+    run( "brush_segment_marker", 0, brush_segment( Brush::Marker), 64);
+    run( "brush_segment_highlighter", 0, brush_segment( Brush::Highlighter), 64);
+
+    // selection drag: outline preview of a transformed selection (independent of its size)
+    {
+        Page doc;
+        auto s = make_shared<Stroke>();
+        s->points = { StrokePoint{ 400, 500, 2000, 0, 0}, StrokePoint{ 900, 1100, 2000, 0, 0} };
+        doc.strokes.push_back( s);
+        Selection selection( doc, { 0});
+        SelectionPreview preview( fb);
+        float angle = 0;
+        run( "selection_preview_outline", 0, [&]{
+            selection.transform = Affine::rotate( angle += 0.01f, selection.cx(), selection.cy());
+            preview.show( selection);
+        });
+        preview.hide();
+    }
+
+    // full page redraw (page turn, zoom settle): single pass, then tiles over 1 thread / all cores
+    {
+        Page doc;
+        for( int k = 0; k < 2000; ++k) {
+            auto s = make_shared<Stroke>();
+            s->brush = (Brush) (k % 4);
+            s->width = 2 + k % 6;
+            int cx = 150 + (k * 277) % 1100, cy = 200 + (k * 431) % 1500;
+            for( int n = 0; n < 100; ++n)
+                s->points.push_back( StrokePoint{ (int16_t) (cx + (5 + n * 0.4) * cos( n * 0.08)), (int16_t) (cy + (5 + n * 0.4) * sin( n * 0.08)),
+                                                  (uint16_t) (n * 40), 0, 0});
+            doc.strokes.push_back( s);
+        }
+        run( "render_page_full", fb.frame_length, [&]{ render( doc, page, page.bounds()); });
+
+        TilePool serial( 1), parallel;
+        run( "render_page_tiles_1thread", fb.frame_length, [&]{ render( doc, page, { page.bounds()}, serial); });
+        run( "render_page_tiles_allcores", fb.frame_length, [&]{ render( doc, page, { page.bounds()}, parallel); });
+    }
+
+    // shape fit on pen up, hand drawn circle of 400 samples
+    {
+        Stroke circle;
+        for( int i = 0; i <= 400; ++i) {
+            float t = 2 * M_PI * i / 400;
+            circle.points.push_back( StrokePoint{ (int16_t) (700 + 200 * cos( t) + i % 3), (int16_t) (900 + 190 * sin( t) - i % 2), 2000, 0, 0});
+        }
+        ShapeRecognizer recognizer;
+        for( auto& p: circle.points)
+            recognizer.add( p);
+        run( "shape_recognize_circle", 0, [&]{ recognizer.recognize( circle); });
+    }
+
+    // pixel format conversion (one frame)
+    const int pixels = fb.width() * fb.height();
+    vector<uint8_t> gray( pixels);
+    for( int i = 0; i < pixels; ++i)
+        gray[i] = i * 7;
+    run( "convert_gray_to_rgb565", pixels, [&]{ gray_to_rgb565( gray.data(), (uint16_t*) fb.mem_map, pixels); });
+    run( "convert_rgb565_to_gray", pixels * 2, [&]{ rgb565_to_gray( (const uint16_t*) fb.mem_map, gray.data(), pixels); });
+
+    // dithering of a full page import
+    GrayImage image{ gray.data(), fb.width(), fb.height(), fb.width() };
+    run( "dither_bluenoise_16_page", pixels, [&]{ dither( image, screen, Point{ 0, 0}, DitherSpec{ Dither::BlueNoise, 16}); });
+    run( "dither_bayer_2_page", pixels, [&]{ dither( image, screen, Point{ 0, 0}, DitherSpec{ Dither::Bayer, 2}); });
+    run( "dither_floyd_16_page", pixels, [&]{ dither( image, screen, Point{ 0, 0}, DitherSpec{ Dither::FloydSteinberg, 16}); });
+    run( "dither_bluenoise_16_page_1thread", pixels, [&]{ dither( image, screen, Point{ 0, 0}, DitherSpec{ Dither::BlueNoise, 16, 1}); });
+
+    // evdev decoding, per pen sample
+    const int strokes = 8, samples = 256;
+    auto stream = EventStream::session( strokes, samples);
+    EventPipe pipe;
+    long sum = 0;
+
+    run( "input_decode_sample", stream.events.size() * sizeof( input_event), [&]{
+        pipe.write( stream);
+        input.readEvent( pipe.fds[0], [&]( auto& event){ sum += event.pos.x; });
+    }, strokes * samples);
+
+    // end to end: replayed session => decode, draw, refresh (per pen sample)
+    run( "session_replay_sample", 0, [&]{
+        pipe.write( stream);
+        input.readEvent( pipe.fds[0], [&]( auto& event){
+            if( event.touch)
+                cleaner.refresh( draw_disc( fb, event.pos.x, event.pos.y, 10, 0x0000));
+            cleaner.activity();
+        });
+    }, strokes * samples);
+
+    // same, inked by the pen brush from pressure and tilt
+    run( "session_replay_brush_sample", 0, [&]{
+        pipe.write( stream);
+        BrushStroke stroke( Brush::Pen, 0x00, 6);
+        input.readEvent( pipe.fds[0], [&]( auto& event){
+            if( event.touch)
+                cleaner.refresh( stroke.add( screen, screen.bounds(),
+                    StrokePoint{ (int16_t) event.pos.x, (int16_t) event.pos.y, (uint16_t) event.pressure,
+                                 (int8_t) event.tilt.x, (int8_t) event.tilt.y}));
+            else
+                stroke = BrushStroke( Brush::Pen, 0x00, 6);
+            cleaner.activity();
+        });
+    }, strokes * samples);
+
+    if( out_path.empty())
+        write_json( cout, results, fb.path);
+    else {
+        ofstream out( out_path);
+        write_json( out, results, fb.path);
+    }
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
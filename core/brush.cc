@@ -0,0 +1,106 @@
+// Brush engine
+// pen samples (pressure, tilt) to ink: width and opacity are read from per brush tables
+// built once from the brush models (document.cc), so a sample costs a few table reads.
+// ink is laid by spans with idempotent ops only (solid fill, darken, blue noise grain):
+// overlapping segments look the same as a single pass, and segments can be drawn
+// one at a time while the pen moves (see BrushStroke in render.cc)
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "dither.cc"
+#include "document.cc"
+
+constexpr int BRUSH_STEPS = 256;        // pressure steps (StrokePoint pressure >> 4)
+constexpr int TILT_STEPS  = 64;         // tilt steps, degrees
+constexpr int TILT_FULL   = 60;         // tilt reaching the full tilt width
+
+// lookup tables of a brush
+struct BrushTable {
+    float width[ BRUSH_STEPS];          // x nominal width, by pressure
+    uint8_t alpha[ BRUSH_STEPS];        // opacity 0..255, by pressure
+    float tilt[ TILT_STEPS];            // x width, by tilt
+    Blend blend;
+
+    static const BrushTable& get( Brush b) {
+        static const BrushTable tables[] = {
+            make( brush_model( Brush::Pen)),
+            make( brush_model( Brush::Pencil)),
+            make( brush_model( Brush::Marker)),
+            make( brush_model( Brush::Highlighter)),
+        };
+        return tables[ std::min( (int) b, 3)];
+    }
+
+    static BrushTable make( const BrushModel& m) {
+        BrushTable t;
+        for( int i = 0; i < BRUSH_STEPS; ++i) {
+            float p = i / float( BRUSH_STEPS - 1);
+            t.width[i] = m.min_width + (m.max_width - m.min_width) * std::pow( p, m.width_gamma);
+            t.alpha[i] = (uint8_t) std::lround( 255 * (m.min_alpha + (m.max_alpha - m.min_alpha) * std::pow( p, m.alpha_gamma)));
+        }
+        for( int i = 0; i < TILT_STEPS; ++i) {
+            float k = std::min( 1.f, i / float( TILT_FULL));
+            t.tilt[i] = 1 + m.tilt_width * k * k * (3 - 2 * k);       // smoothstep
+        }
+        t.blend = m.blend;
+        return t;
+    }
+
+    static int step( const StrokePoint& p) {
+        return std::min<int>( p.pressure, 4095) >> 4;
+    }
+
+    // ink radius of a sample, for a nominal width
+    float radius( float nominal, const StrokePoint& p) const {
+        int t = std::min( TILT_STEPS - 1, std::max<int>( std::abs( p.tilt_x), std::abs( p.tilt_y)));
+        return nominal / 2 * width[ step( p)] * tilt[t];
+    }
+
+    uint8_t opacity( const StrokePoint& p) const {
+        return alpha[ step( p)];
+    }
+};
+
+// how one span of ink is laid
+struct Ink {
+    Blend blend;
+    uint8_t alpha;          // Grain: share of inked pixels
+    uint16_t color;         // RGB565
+
+    // gray color at opacity alpha over white paper
+    Ink( Blend blend, uint8_t gray, uint8_t alpha)
+        : blend( blend), alpha( alpha)
+    {
+        if( blend == Blend::Grain)
+            color = gray_to_rgb565( gray);
+        else
+            color = gray_to_rgb565( 255 - (255 - gray) * alpha / 255);
+    }
+
+    // pixels [x0, x1) of row y
+    void operator()( const Surface& s, int y, int x0, int x1) const {
+        auto p = s.row( y);
+        switch( blend) {
+            case Blend::Solid:
+                fill_row( p + x0, x1 - x0, color);
+                break;
+            case Blend::Darken:
+                darken_row( p + x0, x1 - x0, color);
+                break;
+            case Blend::Grain: {
+                // fixed screen texture: a pixel is inked when opacity beats its threshold
+                auto& t = ThresholdMatrix::blue_noise().t[ y & 15];
+                for( int x = x0; x < x1; ++x)
+                    if( alpha > t[ x & 15])
+                        p[x] = std::min( p[x], color);
+                break;
+            }
+        }
+    }
+};
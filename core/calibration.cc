@@ -0,0 +1,219 @@
+// Digitizer to screen coordinates calibration
+// each digitizer axis feeds a single screen coordinate (rotations are multiple of 90°),
+// so the per-sample transform is a fixed point (16.16) multiply-add.
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "fb.cc"
+
+enum class Model {
+    rM1,
+    rM2
+};
+
+// screen orientation, relative to the portrait framebuffer (1404x1872)
+enum class Orientation {
+    Portrait,           // x' = x,      y' = y
+    Landscape,          // x' = H - y,  y' = x      (portrait rotated 90° clockwise)
+    PortraitFlipped,    // x' = W - x,  y' = H - y
+    LandscapeFlipped    // x' = y,      y' = W - x
+};
+
+constexpr int SCREEN_WIDTH  = 1404;
+constexpr int SCREEN_HEIGHT = 1872;
+constexpr int PRESSURE_MAX  = 4095;     // pen pressure, whatever the digitizer range
+
+// fixed point mapping of a digitizer axis onto one screen coordinate
+struct AxisMap {
+    int Point::* coord = &Point::x;    // screen coordinate fed by this axis
+    int32_t scale  = 0;                // 16.16
+    int32_t offset = 0;                // 16.16
+
+    // value * scale stays below (screen size << 16) => no overflow
+    int operator()( int value) const {
+        return (value * scale + offset) >> 16;
+    }
+};
+
+// native wiring of a digitizer axis (portrait orientation)
+struct AxisSpec {
+    int code;           // ABS_X, ABS_MT_POSITION_X, ...
+    int min, max;       // default range (overridden by EVIOCGABS)
+    bool to_y;          // feeds screen y instead of x
+    bool inverted;      // value grows opposite to screen coordinate
+};
+
+// portrait mapping of value range [min,max] onto [0,size]
+constexpr AxisMap make_axis( const AxisSpec& spec, int min, int max) {
+    int size  = spec.to_y ? SCREEN_HEIGHT : SCREEN_WIDTH;
+    int range = max > min ? max - min : 1;
+    int32_t scale = (int32_t) (((int64_t) size << 16) / range);
+
+    AxisMap m{};
+    m.coord  = spec.to_y ? &Point::y : &Point::x;
+    m.scale  = spec.inverted ? -scale : scale;
+    m.offset = spec.inverted ? (int32_t) (((int64_t) size << 16) + (int64_t) min * scale)
+                             : (int32_t) (-(int64_t) min * scale);
+    return m;
+}
+
+// pen pressure range [min,max] onto [0,PRESSURE_MAX]
+constexpr AxisMap make_pressure( int min, int max) {
+    int range = max > min ? max - min : 1;
+    AxisMap m{};
+    m.scale  = (int32_t) (((int64_t) PRESSURE_MAX << 16) / range);
+    m.offset = (int32_t) (-(int64_t) min * m.scale);
+    return m;
+}
+
+// pen tilt (1/100 degree) onto degrees, along the screen coordinate of the matching position axis
+// (ABS_TILT_X leans the same way as ABS_X moves)
+constexpr AxisMap make_tilt( const AxisMap& position) {
+    AxisMap m{};
+    m.coord = position.coord;
+    m.scale = position.scale < 0 ? -(65536 / 100) : 65536 / 100;
+    return m;
+}
+
+// compose a portrait mapping with screen rotation
+constexpr AxisMap rotate( AxisMap m, Orientation o) {
+    const bool is_y = m.coord == &Point::y;
+    bool swap = false, negate = false;
+    int size = 0;
+
+    switch( o) {
+        case Orientation::Portrait:
+            break;
+        case Orientation::Landscape:            // x' = H - y, y' = x
+            swap = true;
+            negate = is_y;
+            size = is_y ? SCREEN_HEIGHT : 0;
+            break;
+        case Orientation::PortraitFlipped:      // x' = W - x, y' = H - y
+            negate = true;
+            size = is_y ? SCREEN_HEIGHT : SCREEN_WIDTH;
+            break;
+        case Orientation::LandscapeFlipped:     // x' = y, y' = W - x
+            swap = true;
+            negate = !is_y;
+            size = is_y ? 0 : SCREEN_WIDTH;
+            break;
+    }
+
+    if( swap)
+        m.coord = is_y ? &Point::x : &Point::y;
+    if( negate) {
+        m.scale  = -m.scale;
+        m.offset = -m.offset;
+    }
+    m.offset += size << 16;
+    return m;
+}
+
+// per model wiring of the digitizers
+// from rmkit / libremarkable
+template<Model M>
+struct DeviceProfile;
+
+template<>
+struct DeviceProfile<Model::rM1> {
+    static constexpr AxisSpec pen_x   { ABS_X, 0, 20967, true,  true  };
+    static constexpr AxisSpec pen_y   { ABS_Y, 0, 15725, false, false };
+    static constexpr AxisSpec pressure{ ABS_PRESSURE, 0, 4095, false, false };
+    static constexpr AxisSpec touch_x { ABS_MT_POSITION_X, 0, 767,  false, true };
+    static constexpr AxisSpec touch_y { ABS_MT_POSITION_Y, 0, 1023, true,  true };
+};
+
+template<>
+struct DeviceProfile<Model::rM2> {
+    static constexpr AxisSpec pen_x   { ABS_X, 0, 20967, true,  true  };
+    static constexpr AxisSpec pen_y   { ABS_Y, 0, 15725, false, false };
+    static constexpr AxisSpec pressure{ ABS_PRESSURE, 0, 4095, false, false };
+    static constexpr AxisSpec touch_x { ABS_MT_POSITION_X, 0, 1403, false, false };
+    static constexpr AxisSpec touch_y { ABS_MT_POSITION_Y, 0, 1871, true,  true  };
+};
+
+// mapping of the pen and touch axes for one device and orientation
+struct Calibration {
+    AxisSpec pen_spec[2];
+    AxisSpec touch_spec[2];
+    Orientation orientation;
+
+    AxisMap pen_x, pen_y;           // fed by ABS_X / ABS_Y
+    AxisMap pressure;               // fed by ABS_PRESSURE, coord unused
+    AxisMap tilt_x, tilt_y;         // fed by ABS_TILT_X / ABS_TILT_Y
+    AxisMap touch_x, touch_y;       // fed by ABS_MT_POSITION_X / ABS_MT_POSITION_Y
+
+    // compile time mapping from the default ranges of the model
+    template<Model M, Orientation O>
+    static constexpr Calibration make() {
+        using P = DeviceProfile<M>;
+        Calibration c{ { P::pen_x, P::pen_y}, { P::touch_x, P::touch_y}, O };
+        c.pen_x   = rotate( make_axis( P::pen_x,   P::pen_x.min,   P::pen_x.max),   O);
+        c.pen_y   = rotate( make_axis( P::pen_y,   P::pen_y.min,   P::pen_y.max),   O);
+        c.pressure = make_pressure( P::pressure.min, P::pressure.max);
+        c.tilt_x  = make_tilt( c.pen_x);
+        c.tilt_y  = make_tilt( c.pen_y);
+        c.touch_x = rotate( make_axis( P::touch_x, P::touch_x.min, P::touch_x.max), O);
+        c.touch_y = rotate( make_axis( P::touch_y, P::touch_y.min, P::touch_y.max), O);
+        return c;
+    }
+
+    // dispatch to the specialized mapping
+    template<Model M>
+    static Calibration make( Orientation o) {
+        switch( o) {
+            default:
+            case Orientation::Portrait:         return make<M, Orientation::Portrait>();
+            case Orientation::Landscape:        return make<M, Orientation::Landscape>();
+            case Orientation::PortraitFlipped:  return make<M, Orientation::PortraitFlipped>();
+            case Orientation::LandscapeFlipped: return make<M, Orientation::LandscapeFlipped>();
+        }
+    }
+
+    static Calibration make( Model m, Orientation o) {
+        return m == Model::rM2 ? make<Model::rM2>( o) : make<Model::rM1>( o);
+    }
+
+    // refine pen mapping with the real ranges of the device
+    void pen( int fd) {
+        pen_x = calibrate( fd, pen_spec[0], pen_x);
+        pen_y = calibrate( fd, pen_spec[1], pen_y);
+        tilt_x = make_tilt( pen_x);
+        tilt_y = make_tilt( pen_y);
+
+        input_absinfo info;
+        if( !ioctl( fd, EVIOCGABS( ABS_PRESSURE), &info) && info.maximum > info.minimum)
+            pressure = make_pressure( info.minimum, info.maximum);
+    }
+
+    // refine touch mapping with the real ranges of the device
+    void touch( int fd) {
+        touch_x = calibrate( fd, touch_spec[0], touch_x);
+        touch_y = calibrate( fd, touch_spec[1], touch_y);
+    }
+
+private:
+    AxisMap calibrate( int fd, const AxisSpec& spec, const AxisMap& fallback) const {
+        input_absinfo info;
+        if( ioctl( fd, EVIOCGABS( spec.code), &info) || info.maximum <= info.minimum)
+            return fallback;
+
+        return rotate( make_axis( spec, info.minimum, info.maximum), orientation);
+    }
+};
+
+// identify device model
+inline Model detect_model() {
+    std::ifstream machine( "/sys/devices/soc0/machine");
+    std::string name;
+    std::getline( machine, name);
+
+    return name.find( "reMarkable 2") != std::string::npos ? Model::rM2 : Model::rM1;
+}
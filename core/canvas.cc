@@ -0,0 +1,117 @@
+// Off-screen cairo canvas
+// cairo draws in a cached memory copy of the screen, never in the frame buffer itself:
+//  - the panel can't pick up half drawn content (no tearing)
+//  - cairo ops run on cached memory, not on the uncached MAP_SHARED mapping
+// each drawing is clipped to its area, areas are collected as damage,
+// and only those rects are blitted to the frame buffer right before the refresh (present)
+// needs cairo: only include from programs linked with -lcairo
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include "cairo.h"
+
+#include "fb.cc"
+#include "raster.cc"
+
+class Canvas {
+    FrameBuffer& fb;
+    Bitmap bitmap;                  // rows padded to cairo stride
+    Surface view;                   // bitmap, screen size
+    cairo_surface_t* surface;
+    cairo_t* cr;
+    std::vector<Rect> damage;       // drawn since last present, screen coordinates
+
+public:
+    // canvas starts as a copy of the screen
+    Canvas( FrameBuffer& fb)
+        : fb( fb),
+          bitmap( cairo_format_stride_for_width( CAIRO_FORMAT_RGB16_565, fb.width()) / 2, fb.height()),
+          view( bitmap.data, fb.width(), fb.height(), bitmap.stride)
+    {
+        blit( view, Point{ 0, 0}, Surface( fb), fb);
+        surface = cairo_image_surface_create_for_data( bitmap.data, CAIRO_FORMAT_RGB16_565, view.width, view.height, view.stride);
+        cr = cairo_create( surface);
+        if( !cr)
+            throw "Canvas: could not create cairo context\n";
+    }
+
+    Canvas( const Canvas&) = delete;
+    Canvas& operator=( const Canvas&) = delete;
+
+    ~Canvas() {
+        cairo_destroy( cr);
+        cairo_surface_destroy( surface);
+    }
+
+    // draw( area, []( cairo_t* cr){ ... }): cairo ops are clipped to area,
+    // which is blitted to the screen on next present()
+    template<class F>
+    Rect draw( const Rect& area, F paint) {
+        Rect r = area.intersected( view.bounds());
+        if( r.empty())
+            return r;
+
+        cairo_save( cr);
+        cairo_new_path( cr);
+        cairo_rectangle( cr, r.topLeft.x, r.topLeft.y, r.width(), r.height());
+        cairo_clip( cr);
+        cairo_new_path( cr);
+        paint( cr);
+        cairo_restore( cr);
+
+        add( r);
+        return r;
+    }
+
+    // direct access to pixels (raster.cc ops): call touched() for each area written
+    const Surface& pixels() {
+        cairo_surface_flush( surface);
+        return view;
+    }
+
+    void touched( const Rect& area) {
+        Rect r = area.intersected( view.bounds());
+        if( r.empty())
+            return;
+
+        cairo_surface_mark_dirty_rectangle( surface, r.topLeft.x, r.topLeft.y, r.width(), r.height());
+        add( r);
+    }
+
+    // finished areas to the frame buffer, and their refresh
+    // return the screen areas updated
+    std::vector<Rect> present( waveform_mode waveform = WAVEFORM_MODE_DU) {
+        auto done = flush();
+        fb.refresh( done, waveform);
+        return done;
+    }
+
+    // areas drawn since last flush
+    const std::vector<Rect>& pending() const {
+        return damage;
+    }
+
+    // finished areas to the frame buffer, without refresh (eg: FramePacer::send)
+    std::vector<Rect> flush() {
+        cairo_surface_flush( surface);
+        Surface screen( fb);
+        for( auto& d: damage)
+            blit( screen, d.topLeft, view, d);
+
+        std::vector<Rect> done;
+        done.swap( damage);
+        return done;
+    }
+
+private:
+    void add( const Rect& r) {
+        for( auto& d: damage)
+            if( !d.intersected( r).empty()) {
+                d = d.united( r);
+                return;
+            }
+        damage.push_back( r);
+    }
+};
@@ -0,0 +1,143 @@
+// Deferred ghosting cleanup
+// fast updates (WAVEFORM_MODE_DU) leave ghosting behind,
+// so count them per tile, and once the user is idle refresh only the ghosted tiles
+// with a high fidelity waveform - never in front of active writing.
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "fb.cc"
+
+struct CleanupConfig {
+    int tile      = 117;                            // tile size in pixels (1404x1872 => 12x16 tiles)
+    int threshold = 4;                              // fast updates before a tile needs cleanup
+    int idle_ms   = 1500;                           // no pen/touch for that long before cleaning
+    int batch_ms  = 300;                            // delay between cleanup batches (lets input cancel them)
+    waveform_mode waveform = WAVEFORM_MODE_GC16;    // or WAVEFORM_MODE_REAGL when supported
+};
+
+class CleanupScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = CleanupConfig;
+
+private:
+    FrameBuffer& fb;
+    Config config;
+
+    int cols, rows;
+    std::vector<uint16_t> count;    // fast updates since last high fidelity pass, per tile
+    int dirty = 0;                  // number of tiles above threshold
+
+    Clock::time_point last_input;
+    Clock::time_point next_batch;
+
+public:
+    CleanupScheduler( FrameBuffer& fb, Config config = Config{})
+        : fb( fb), config( config)
+    {
+        cols = (fb.width()  + config.tile - 1) / config.tile;
+        rows = (fb.height() + config.tile - 1) / config.tile;
+        count.assign( cols * rows, 0);
+
+        last_input = next_batch = Clock::now();
+    }
+
+    // fast refresh of selected area, accounted for cleanup
+    void refresh( const Rect& r) {
+        fb.refresh( r);
+        mark( r);
+    }
+
+    // record a fast update on area
+    void mark( const Rect& r) {
+        int x0 = std::max( r.topLeft.x, 0) / config.tile;
+        int y0 = std::max( r.topLeft.y, 0) / config.tile;
+        int x1 = std::min( r.bottomRight.x - 1, fb.width()  - 1) / config.tile;
+        int y1 = std::min( r.bottomRight.y - 1, fb.height() - 1) / config.tile;
+
+        for( int y = y0; y <= y1; ++y)
+            for( int x = x0; x <= x1; ++x) {
+                auto& c = count[ y * cols + x];
+                if( c < 0xffff && ++c == config.threshold)
+                    ++dirty;
+            }
+    }
+
+    // a high fidelity refresh happened on area (eg: full refresh)
+    void clear( const Rect& r) {
+        int x0 = std::max( r.topLeft.x, 0) / config.tile;
+        int y0 = std::max( r.topLeft.y, 0) / config.tile;
+        int x1 = std::min( r.bottomRight.x - 1, fb.width()  - 1) / config.tile;
+        int y1 = std::min( r.bottomRight.y - 1, fb.height() - 1) / config.tile;
+
+        // only fully covered tiles are clean
+        if( r.topLeft.x % config.tile) ++x0;
+        if( r.topLeft.y % config.tile) ++y0;
+        if( r.bottomRight.x < fb.width()  && r.bottomRight.x % config.tile) --x1;
+        if( r.bottomRight.y < fb.height() && r.bottomRight.y % config.tile) --y1;
+
+        for( int y = y0; y <= y1; ++y)
+            for( int x = x0; x <= x1; ++x)
+                reset( y * cols + x);
+    }
+
+    // pen/touch activity: postpone (and cancel remaining) cleanup
+    void activity() {
+        last_input = Clock::now();
+    }
+
+    // to be called from the event loop (see Input::loop( callback, idle))
+    // issue the next cleanup batch if user is idle
+    // return ms before next call is needed, -1 if nothing to clean
+    int idle() {
+        if( dirty == 0)
+            return -1;
+
+        auto now = Clock::now();
+        auto wake = std::max( last_input + std::chrono::milliseconds( config.idle_ms), next_batch);
+        if( now < wake)
+            return std::chrono::duration_cast<std::chrono::milliseconds>( wake - now).count() + 1;
+
+        cleanup_next();
+        next_batch = now + std::chrono::milliseconds( config.batch_ms);
+
+        return dirty ? config.batch_ms : -1;
+    }
+
+    int pending() const {
+        return dirty;
+    }
+
+private:
+    void reset( int i) {
+        if( count[i] >= config.threshold)
+            --dirty;
+        count[i] = 0;
+    }
+
+    // clean the first run of ghosted tiles (one tile row at most)
+    // all tiles of the run get the same waveform, so it is a single update
+    void cleanup_next() {
+        for( int y = 0; y < rows; ++y) {
+            int x = 0;
+            while( x < cols && count[ y * cols + x] < config.threshold)
+                ++x;
+            if( x == cols)
+                continue;
+
+            int end = x;
+            while( end < cols && count[ y * cols + end] >= config.threshold)
+                reset( y * cols + end++);
+
+            Rect r{ Point{ x * config.tile, y * config.tile},
+                    Point{ std::min( end * config.tile, fb.width()),
+                           std::min( (y + 1) * config.tile, fb.height()) } };
+
+            fb.refresh( r, config.waveform);
+            return;
+        }
+    }
+};
@@ -0,0 +1,218 @@
+// Input device registry
+// classify /dev/input nodes once, keep open only the subscribed ones,
+// optionally grab them (EVIOCGRAB), and follow hotplug through inotify
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+
+// from https://github.com/rmkit-dev/rmkit/blob/master/src/rmkit/input/device_id.cpy
+// glommed from evtest.c
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NBITS(x) ((((x)-1)/BITS_PER_LONG)+1)
+#define OFF(x)  ((x)%BITS_PER_LONG)
+#define BIT(x)  (1UL<<OFF(x))
+#define LONG(x) ((x)/BITS_PER_LONG)
+#define test_bit(bit, array)    ((array[LONG(bit)] >> OFF(bit)) & 1)
+
+enum class DeviceType {
+    Invalid,
+    Stylus,
+    Buttons,
+    Touch,
+    Unknown
+};
+
+inline const char* to_s( DeviceType type) {
+    switch( type) {
+        case DeviceType::Invalid: return "INVALID";
+        case DeviceType::Stylus:  return "STYLUS";
+        case DeviceType::Buttons: return "BUTTONS";
+        case DeviceType::Touch:   return "TOUCH";
+        default:                  return "UNKNOWN";
+    }
+}
+
+inline bool check_bit_set(int fd, int type, int i) {
+    unsigned long bit[NBITS(KEY_MAX)] = {};
+    ioctl(fd, EVIOCGBIT(type, KEY_MAX), bit);
+    return test_bit(i, bit);
+}
+
+inline DeviceType id_by_capabilities(int fd) {
+    int version;
+    // if we can't get version of the fd, its invalid
+    if( ioctl(fd, EVIOCGVERSION, &version))
+        return DeviceType::Invalid;
+
+    unsigned long bit[NBITS(EV_MAX)] = {};
+    ioctl(fd, EVIOCGBIT(0, EV_MAX), bit);
+    if( test_bit(EV_KEY, bit)) {
+        if( check_bit_set(fd, EV_KEY, BTN_STYLUS)
+            && test_bit(EV_ABS, bit))
+            return DeviceType::Stylus;
+
+        if( check_bit_set(fd, EV_KEY, KEY_POWER))
+            return DeviceType::Buttons;
+
+        if( test_bit(EV_REL, bit)
+            && check_bit_set(fd, EV_ABS, ABS_MT_SLOT))
+            return DeviceType::Touch;
+    }
+
+    return DeviceType::Unknown;
+}
+// end from https://github.com/rmkit-dev/rmkit/blob/master/src/rmkit/input/device_id.cpy
+
+struct InputDevice {
+    std::string path;
+    DeviceType type;
+    int fd;             // -1 when not subscribed
+};
+
+class DeviceRegistry {
+    std::string dir;
+    std::vector<InputDevice> devices;
+    unsigned subscribed;        // mask of DeviceType
+    bool grab;
+    int notify = -1;            // inotify on dir, for hotplug
+
+public:
+    DeviceRegistry( std::initializer_list<DeviceType> types, bool grab = false, const char* dir = "/dev/input")
+        : dir( dir), subscribed( 0), grab( grab)
+    {
+        for( auto t: types)
+            subscribed |= mask( t);
+
+        if( subscribed) {
+            notify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC);
+            if( notify >= 0 && inotify_add_watch( notify, dir, IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+                ::close( notify);
+                notify = -1;
+            }
+        }
+
+        scan();
+    }
+
+    DeviceRegistry( const DeviceRegistry&) = delete;
+    DeviceRegistry& operator=( const DeviceRegistry&) = delete;
+
+    // closing also releases the grab
+    ~DeviceRegistry() {
+        for( auto& d: devices)
+            if( d.fd >= 0)
+                ::close( d.fd);
+        if( notify >= 0)
+            ::close( notify);
+    }
+
+    const std::vector<InputDevice>& list() const {
+        return devices;
+    }
+
+    // inotify fd to poll for hotplug, -1 if unavailable
+    int hotplug_fd() const {
+        return notify;
+    }
+
+    // classify every node of dir
+    void scan() {
+        if( !subscribed)
+            return;
+
+        std::error_code ec;
+        for( auto& p: std::filesystem::directory_iterator( dir, ec))
+            if( !p.is_symlink() && p.is_character_file())
+                add( p.path());
+    }
+
+    // process pending inotify events
+    // return true if the set of opened devices changed
+    bool hotplug() {
+        alignas( inotify_event) char buffer[4096];
+        bool changed = false;
+
+        for(;;) {
+            int len = ::read( notify, buffer, sizeof( buffer));
+            if( len <= 0)
+                return changed;
+
+            for( int i = 0; i < len; ) {
+                auto* ev = (inotify_event*) (buffer + i);
+                i += sizeof( inotify_event) + ev->len;
+
+                if( !ev->len)
+                    continue;
+
+                auto path = dir + "/" + ev->name;
+                if( ev->mask & IN_DELETE)
+                    changed |= remove( path);
+                else
+                    changed |= add( path);     // IN_ATTRIB: node may not be readable on IN_CREATE
+            }
+        }
+    }
+
+    // drop a device that went away (read() failed with ENODEV)
+    bool remove_fd( int fd) {
+        auto it = std::find_if( devices.begin(), devices.end(), [&]( auto& d){ return d.fd == fd; });
+        return it != devices.end() && remove( it->path);
+    }
+
+private:
+    static unsigned mask( DeviceType t) {
+        return 1u << (int) t;
+    }
+
+    bool known( const std::string& path) const {
+        return std::any_of( devices.begin(), devices.end(), [&]( auto& d){ return d.path == path; });
+    }
+
+    bool add( const std::string& path) {
+        if( known( path) || path.find( "/event") == std::string::npos)
+            return false;
+
+        int fd = ::open( path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if( fd < 0)
+            return false;           // not ready yet, wait for IN_ATTRIB
+
+        auto type = id_by_capabilities( fd);
+        std::cerr << path << " " << to_s( type) << std::endl;
+
+        if( !(subscribed & mask( type))) {
+            ::close( fd);
+            devices.push_back( InputDevice{ path, type, -1});
+            return false;
+        }
+
+        if( grab && ioctl( fd, EVIOCGRAB, 1))
+            std::cerr << path << " could not be grabbed" << std::endl;
+
+        devices.push_back( InputDevice{ path, type, fd});
+        return true;
+    }
+
+    bool remove( const std::string& path) {
+        auto it = std::find_if( devices.begin(), devices.end(), [&]( auto& d){ return d.path == path; });
+        if( it == devices.end())
+            return false;
+
+        bool opened = it->fd >= 0;
+        if( opened)
+            ::close( it->fd);
+        devices.erase( it);
+        return opened;
+    }
+};
@@ -0,0 +1,300 @@
+// Dithering of imported images
+// reduce 8 bits gray images to the levels the panel shows (16, or 2 for fast waveforms)
+// ordered modes (Bayer, blue noise) are vectorized, every mode is split in row bands over cores
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fb.cc"
+#include "raster.cc"
+
+// 8 bits gray image view
+struct GrayImage {
+    uint8_t* data;
+    int width, height;
+    int stride;                 // bytes per row
+
+    uint8_t* row( int y) const {
+        return data + y * stride;
+    }
+};
+
+enum class Dither {
+    Bayer,              // ordered, 16x16 Bayer matrix: fast, regular pattern
+    BlueNoise,          // ordered, 16x16 void-and-cluster matrix: fast, no visible pattern
+    FloydSteinberg,     // error diffusion: best gradients, serial per band
+    Atkinson            // error diffusion, loses 1/4 of the error: crisper, good for 2 levels
+};
+
+struct DitherSpec {
+    Dither mode = Dither::BlueNoise;
+    int levels = 16;            // 2..256 gray levels
+    int threads = 0;            // 0 => all cores
+};
+
+// 16x16 threshold matrices, values in [0,254]
+struct ThresholdMatrix {
+    uint16_t t[16][16];
+
+    static const ThresholdMatrix& bayer() {
+        static const ThresholdMatrix m = make_bayer();
+        return m;
+    }
+
+    static const ThresholdMatrix& blue_noise() {
+        static const ThresholdMatrix m = make_blue_noise();
+        return m;
+    }
+
+private:
+    static ThresholdMatrix make_bayer() {
+        ThresholdMatrix m;
+        for( int y = 0; y < 16; ++y)
+            for( int x = 0; x < 16; ++x) {
+                // interleave bits of x^y and y, reversed
+                int v = 0, xy = x ^ y;
+                for( int bit = 0; bit < 4; ++bit)
+                    v |= (((xy >> bit) & 1) << (7 - 2 * bit)) | (((y >> bit) & 1) << (6 - 2 * bit));
+                m.t[y][x] = v * 255 / 256;
+            }
+        return m;
+    }
+
+    // void-and-cluster (Ulichney), toroidal gaussian energy, sigma = 1.5
+    static ThresholdMatrix make_blue_noise() {
+        const int N = 16, n = N * N;
+        float gauss[N][N];
+        for( int y = 0; y < N; ++y)
+            for( int x = 0; x < N; ++x) {
+                int dx = std::min( x, N - x), dy = std::min( y, N - y);
+                gauss[y][x] = std::exp( -(dx * dx + dy * dy) / (2 * 1.5f * 1.5f));
+            }
+
+        std::vector<uint8_t> ones( n, 0);
+        std::vector<float> energy( n, 0);
+        auto toggle = [&]( int p, int sign) {
+            ones[p] = sign > 0;
+            for( int q = 0; q < n; ++q)
+                energy[q] += sign * gauss[ (q / N - p / N + N) % N][ (q % N - p % N + N) % N];
+        };
+        // tightest cluster: highest energy 1, largest void: lowest energy 0
+        auto extreme = [&]( bool one) {
+            int best = -1;
+            for( int q = 0; q < n; ++q)
+                if( ones[q] == one && (best < 0 || (one ? energy[q] > energy[best] : energy[q] < energy[best])))
+                    best = q;
+            return best;
+        };
+
+        // initial pattern: ~10% ones, spread until stable
+        uint32_t seed = 0x2545f491;
+        int initial = 0;
+        while( initial < n / 10) {
+            seed = seed * 1664525 + 1013904223;
+            int p = (seed >> 8) % n;
+            if( !ones[p]) {
+                toggle( p, 1);
+                ++initial;
+            }
+        }
+        for( int i = 0; i < n; ++i) {
+            int cluster = extreme( true);
+            toggle( cluster, -1);
+            int hole = extreme( false);
+            toggle( hole, 1);
+            if( hole == cluster)
+                break;
+        }
+
+        std::vector<int> rank( n);
+        auto saved_ones = ones;
+        auto saved_energy = energy;
+
+        // phase 1: remove tightest clusters
+        for( int r = initial - 1; r >= 0; --r) {
+            int p = extreme( true);
+            toggle( p, -1);
+            rank[p] = r;
+        }
+
+        // phase 2: fill largest voids
+        ones = saved_ones;
+        energy = saved_energy;
+        for( int r = initial; r < n; ++r) {
+            int p = extreme( false);
+            toggle( p, 1);
+            rank[p] = r;
+        }
+
+        ThresholdMatrix m;
+        for( int p = 0; p < n; ++p)
+            m.t[ p / N][ p % N] = rank[p] * 255 / n;
+        return m;
+    }
+};
+
+// levels of one row, as gray values
+// v in [0,255], threshold t in [0,254]: q = (v * (levels-1) + t) / 255
+// division by 255 is exact as ((x + 1) * 257) >> 16 for x < 65535
+inline void dither_row_ordered( const uint8_t* src, uint8_t* dst, int width, const uint16_t* thresholds, int levels) {
+    const int l = levels - 1;
+    const int step = 255 / l;
+    int x = 0;
+
+    if( step * l == 255) {      // exact gray steps (2, 4, 16 levels, ...) => vectorized
+#if defined(__ARM_NEON)
+        for( ; x + 8 <= width; x += 8) {
+            uint16x8_t v = vmovl_u8( vld1_u8( src + x));
+            uint16x8_t t = vld1q_u16( thresholds + (x & 15));
+            uint16x8_t a = vaddq_u16( vmlaq_n_u16( t, v, l), vdupq_n_u16( 1));
+            uint32x4_t lo = vmull_n_u16( vget_low_u16( a), 257);
+            uint32x4_t hi = vmull_n_u16( vget_high_u16( a), 257);
+            uint16x8_t q = vcombine_u16( vshrn_n_u32( lo, 16), vshrn_n_u32( hi, 16));
+            vst1_u8( dst + x, vmovn_u16( vmulq_n_u16( q, step)));
+        }
+#elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ml = _mm_set1_epi16( l), one = _mm_set1_epi16( 1);
+        const __m128i m257 = _mm_set1_epi16( 257), mstep = _mm_set1_epi16( step);
+        for( ; x + 8 <= width; x += 8) {
+            __m128i v = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (src + x)), zero);
+            __m128i t = _mm_loadu_si128( (const __m128i*) (thresholds + (x & 15)));
+            __m128i a = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( v, ml), t), one);
+            __m128i q = _mm_mulhi_epu16( a, m257);
+            __m128i g = _mm_mullo_epi16( q, mstep);
+            _mm_storel_epi64( (__m128i*) (dst + x), _mm_packus_epi16( g, zero));
+        }
+#endif
+    }
+
+    for( ; x < width; ++x) {
+        int q = (src[x] * l + thresholds[ x & 15]) / 255;
+        dst[x] = q * 255 / l;
+    }
+}
+
+// error diffusion of rows [y0,y1), serpentine scan
+// err holds 3 rows of errors (x 16 to keep integer precision), with 2 pixels of margin
+inline void dither_band_diffusion( const GrayImage& src, int y0, int y1, uint8_t* out, int levels, Dither mode,
+                                   const std::function<void( int y, const uint8_t* row)>& write)
+{
+    const int w = src.width, l = levels - 1;
+    std::vector<int> err( 3 * (w + 4), 0);
+    auto e = [&]( int row, int x) -> int& { return err[ (row % 3) * (w + 4) + x + 2]; };
+
+    // quantized gray of v = pixel x 16 + error, error stays within one pixel range
+    const int lo = -16 * 256, hi = 32 * 256;
+    std::vector<uint8_t> quant( hi - lo);
+    for( int v = lo; v < hi; ++v)
+        quant[ v - lo] = std::clamp( (v * l + 8 * 255) / (16 * 255), 0, l) * 255 / l;
+
+    for( int y = y0; y < y1; ++y) {
+        const uint8_t* s = src.row( y);
+        bool forward = (y - y0) % 2 == 0;
+        int dir = forward ? 1 : -1;
+
+        for( int i = 0; i < w; ++i) {
+            int x = forward ? i : w - 1 - i;
+            int v = std::clamp( s[x] * 16 + e( y, x), lo, hi - 1);
+            int g = quant[ v - lo];
+            out[x] = g;
+
+            int d = v - g * 16;
+            if( mode == Dither::FloydSteinberg) {
+                e( y,     x + dir) += d * 7 / 16;
+                e( y + 1, x - dir) += d * 3 / 16;
+                e( y + 1, x)       += d * 5 / 16;
+                e( y + 1, x + dir) += d * 1 / 16;
+            }
+            else {  // Atkinson: 6 neighbours, 1/8 each
+                d /= 8;
+                e( y,     x + dir)     += d;
+                e( y,     x + 2 * dir) += d;
+                e( y + 1, x - dir)     += d;
+                e( y + 1, x)           += d;
+                e( y + 1, x + dir)     += d;
+                e( y + 2, x)           += d;
+            }
+        }
+
+        // current row is consumed, it becomes row y + 3
+        std::fill_n( &e( y, -2), w + 4, 0);
+        write( y, out);
+    }
+}
+
+// dither src, rows split in bands over threads
+// write( y, row) receives the gray levels of each row
+inline void dither( const GrayImage& src, const DitherSpec& spec, const std::function<void( int y, const uint8_t* row)>& write) {
+    int levels = std::clamp( spec.levels, 2, 256);
+    int threads = spec.threads > 0 ? spec.threads : std::max( 1u, std::thread::hardware_concurrency());
+    threads = std::max( 1, std::min( threads, src.height / 32));
+
+    auto band = [&]( int y0, int y1) {
+        std::vector<uint8_t> out( src.width + 16);
+
+        if( spec.mode == Dither::Bayer || spec.mode == Dither::BlueNoise) {
+            auto& m = spec.mode == Dither::Bayer ? ThresholdMatrix::bayer() : ThresholdMatrix::blue_noise();
+
+            // thresholds of a matrix row, repeated to allow unaligned 8 wide loads
+            uint16_t t[32];
+            for( int y = y0; y < y1; ++y) {
+                std::memcpy( t,      m.t[ y & 15], sizeof( m.t[0]));
+                std::memcpy( t + 16, m.t[ y & 15], sizeof( m.t[0]));
+                dither_row_ordered( src.row( y), out.data(), src.width, t, levels);
+                write( y, out.data());
+            }
+        }
+        else
+            dither_band_diffusion( src, y0, y1, out.data(), levels, spec.mode, write);
+    };
+
+    if( threads == 1) {
+        band( 0, src.height);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for( int i = 0; i < threads; ++i)
+        workers.emplace_back( band, src.height * i / threads, src.height * (i + 1) / threads);
+    for( auto& w: workers)
+        w.join();
+}
+
+// dither into a gray canvas, at position
+inline void dither( const GrayImage& src, const GrayImage& dst, Point at, const DitherSpec& spec = DitherSpec{}) {
+    auto c = Rect{ at, Point{ at.x + src.width, at.y + src.height} }.intersected( Rect{ Point{ 0, 0}, Point{ dst.width, dst.height} });
+    if( c.empty())
+        return;
+
+    dither( src, spec, [&]( int y, const uint8_t* row) {
+        int ty = y + at.y;
+        if( ty >= c.topLeft.y && ty < c.bottomRight.y)
+            std::memcpy( dst.row( ty) + c.topLeft.x, row + c.topLeft.x - at.x, c.width());
+    });
+}
+
+// dither straight into a RGB565 surface (frame buffer), at position
+inline void dither( const GrayImage& src, const Surface& dst, Point at, const DitherSpec& spec = DitherSpec{}) {
+    auto c = Rect{ at, Point{ at.x + src.width, at.y + src.height} }.intersected( dst.bounds());
+    if( c.empty())
+        return;
+
+    dither( src, spec, [&]( int y, const uint8_t* row) {
+        int ty = y + at.y;
+        if( ty >= c.topLeft.y && ty < c.bottomRight.y)
+            gray_to_rgb565( row + c.topLeft.x - at.x, dst.row( ty) + c.topLeft.x, c.width());
+    });
+}
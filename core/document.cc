@@ -0,0 +1,349 @@
+// Document representation
+// a notebook is a list of pages, a page holds strokes and texts
+// notebook file: header, pages, then a page table => any page can be loaded alone
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fb.cc"
+
+enum class Brush : uint8_t {
+    Pen,
+    Pencil,
+    Marker,
+    Highlighter
+};
+
+// how ink is laid by a brush
+enum class Blend : uint8_t {
+    Solid,              // ink replaces paper
+    Darken,             // translucent: never lightens what is below
+    Grain               // paper texture: ink on part of the pixels only
+};
+
+// response of a brush to pen pressure and tilt (brush.cc turns it into lookup tables)
+struct BrushModel {
+    float min_width, max_width;     // x nominal width, at no / full pressure
+    float width_gamma;              // pressure curve of width
+    float min_alpha, max_alpha;     // opacity at no / full pressure
+    float alpha_gamma;              // pressure curve of opacity
+    float tilt_width;               // extra width (x) when fully tilted
+    Blend blend;
+
+    // widest ink, x nominal width
+    float reach() const {
+        return max_width * (1 + tilt_width);
+    }
+};
+
+inline const BrushModel& brush_model( Brush b) {
+    static const BrushModel models[] = {
+        //  width              alpha              tilt
+        { 0.5f, 1.3f, 0.8f,  1.f,   1.f,   1.f,   0.f,  Blend::Solid },     // Pen: width follows pressure
+        { 0.7f, 1.f,  1.f,   0.15f, 0.9f,  1.5f,  2.5f, Blend::Grain },     // Pencil: shade with pressure and tilt
+        { 1.f,  1.f,  1.f,   1.f,   1.f,   1.f,   0.6f, Blend::Solid },     // Marker: constant, wider on its side
+        { 1.f,  1.f,  1.f,   0.35f, 0.35f, 1.f,   0.f,  Blend::Darken },    // Highlighter
+    };
+    return models[ std::min( (int) b, 3)];
+}
+
+// one pen sample, 8 bytes
+struct StrokePoint {
+    int16_t x, y;               // page coordinates (pixels)
+    uint16_t pressure;          // 0..4095
+    int8_t tilt_x, tilt_y;      // degrees
+};
+
+struct Stroke {
+    Brush brush = Brush::Pen;
+    uint8_t color = 0;          // gray level
+    uint16_t width = 4;         // nominal width (pixels)
+    std::vector<StrokePoint> points;
+
+    // area covered by stroke, including its width
+    Rect bounds() const {
+        if( points.empty())
+            return Rect{ Point{ 0, 0}, Point{ 0, 0} };
+
+        int x0 = points[0].x, y0 = points[0].y, x1 = x0, y1 = y0;
+        for( auto& p: points) {
+            x0 = std::min<int>( x0, p.x); x1 = std::max<int>( x1, p.x);
+            y0 = std::min<int>( y0, p.y); y1 = std::max<int>( y1, p.y);
+        }
+        int r = (int) std::ceil( width / 2.f * brush_model( brush).reach()) + 2;
+        return Rect{ Point{ x0 - r, y0 - r}, Point{ x1 + r + 1, y1 + r + 1} };
+    }
+};
+
+// strokes are immutable once done, and shared (pages, history, renderers)
+using StrokeRef = std::shared_ptr<const Stroke>;
+
+struct Text {
+    Point pos;                  // baseline start (first line)
+    uint16_t size = 32;         // pixels
+    std::string text;           // UTF-8, lines split on '\n'
+
+    int line_height() const { return size * 5 / 4; }
+};
+
+// code point of UTF-8 s at i, i moved past it (malformed byte => U+FFFD)
+inline uint32_t utf8_next( const std::string& s, size_t& i) {
+    uint8_t c = s[ i++];
+    int more = c < 0x80 ? 0 : (c & 0xe0) == 0xc0 ? 1 : (c & 0xf0) == 0xe0 ? 2 : (c & 0xf8) == 0xf0 ? 3 : -1;
+    if( more < 0)
+        return 0xfffd;
+    uint32_t code = more ? c & (0x3f >> more) : c;
+    for( ; more; --more) {
+        if( i >= s.size() || (s[i] & 0xc0) != 0x80)
+            return 0xfffd;
+        code = code << 6 | (s[ i++] & 0x3f);
+    }
+    return code;
+}
+
+// approximate area of a text: 0.6 size per character, descent size / 3
+inline Rect bounds( const Text& t) {
+    int lines = 1, chars = 0, longest = 0;
+    for( size_t i = 0; i < t.text.size(); ) {
+        if( utf8_next( t.text, i) == '\n') {
+            ++lines;
+            chars = 0;
+        }
+        else
+            longest = std::max( longest, ++chars);
+    }
+    int w = t.size * 6 / 10 * longest;
+    return Rect{ Point{ t.pos.x, t.pos.y - t.size},
+                 Point{ t.pos.x + w + 1, t.pos.y + (lines - 1) * t.line_height() + t.size / 3 + 1} };
+}
+
+struct Page {
+    std::vector<StrokeRef> strokes;
+    std::vector<Text> texts;
+};
+
+// binary (de)serialization of a page, native little endian
+struct PageCodec {
+    static void put( std::string& out, const void* data, size_t size) {
+        out.append( (const char*) data, size);
+    }
+
+    template<class T>
+    static void put( std::string& out, T value) {
+        put( out, &value, sizeof( value));
+    }
+
+    static std::string encode( const Page& page) {
+        std::string out;
+        put<uint32_t>( out, page.strokes.size());
+        for( auto& s: page.strokes) {
+            put<uint8_t>( out, (uint8_t) s->brush);
+            put<uint8_t>( out, s->color);
+            put<uint16_t>( out, s->width);
+            put<uint32_t>( out, s->points.size());
+            put( out, s->points.data(), s->points.size() * sizeof( StrokePoint));
+        }
+
+        put<uint32_t>( out, page.texts.size());
+        for( auto& t: page.texts) {
+            put<int32_t>( out, t.pos.x);
+            put<int32_t>( out, t.pos.y);
+            put<uint16_t>( out, t.size);
+            put<uint32_t>( out, t.text.size());
+            put( out, t.text.data(), t.text.size());
+        }
+        return out;
+    }
+
+    static Page decode( const std::string& in) {
+        size_t at = 0;
+        auto get = [&]( void* data, size_t size) {
+            if( at + size > in.size())
+                throw std::string( "Document: truncated page\n");
+            std::memcpy( data, in.data() + at, size);
+            at += size;
+        };
+        auto get32 = [&]{ uint32_t v; get( &v, 4); return v; };
+
+        Page page;
+        uint32_t strokes = get32();
+        page.strokes.reserve( strokes);
+        for( uint32_t i = 0; i < strokes; ++i) {
+            auto s = std::make_shared<Stroke>();
+            uint8_t brush;
+            get( &brush, 1);
+            s->brush = (Brush) brush;
+            get( &s->color, 1);
+            get( &s->width, 2);
+            uint32_t n = get32();
+            if( n > (in.size() - at) / sizeof( StrokePoint))
+                throw std::string( "Document: truncated stroke\n");
+            s->points.resize( n);
+            get( s->points.data(), n * sizeof( StrokePoint));
+            page.strokes.push_back( std::move( s));
+        }
+
+        uint32_t texts = get32();
+        for( uint32_t i = 0; i < texts; ++i) {
+            Text t;
+            int32_t x, y;
+            get( &x, 4);
+            get( &y, 4);
+            t.pos = Point{ x, y};
+            get( &t.size, 2);
+            uint32_t n = get32();
+            if( n > in.size() - at)
+                throw std::string( "Document: truncated text\n");
+            t.text.assign( in.data() + at, n);
+            at += n;
+            page.texts.push_back( std::move( t));
+        }
+        return page;
+    }
+};
+
+// notebook file layout
+//  header | page 0 | page 1 | ... | page table (offset, size per page)
+struct NotebookHeader {
+    char magic[4] = { 'S', 'T', 'Y', 'L' };
+    uint32_t format = 1;
+    uint32_t pages = 0;
+    uint32_t version = 0;       // bumped on every save
+    uint64_t table = 0;         // offset of page table
+};
+
+struct PageEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+// read pages one at a time (thread safe: pread only)
+class NotebookReader {
+    int fd = -1;
+    std::string path;
+    NotebookHeader header;
+    std::vector<PageEntry> table;
+
+public:
+    NotebookReader( const std::string& path)
+        : path( path)
+    {
+        fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0)
+            throw "Document: could not open '" + path + "'\n";
+
+        read( &header, sizeof( header), 0);
+        if( std::memcmp( header.magic, "STYL", 4) || header.format != 1)
+            throw "Document: '" + path + "' is not a notebook\n";
+
+        table.resize( header.pages);
+        read( table.data(), table.size() * sizeof( PageEntry), header.table);
+    }
+
+    NotebookReader( const NotebookReader&) = delete;
+    NotebookReader& operator=( const NotebookReader&) = delete;
+
+    ~NotebookReader() {
+        if( fd >= 0)
+            ::close( fd);
+    }
+
+    int pages() const {
+        return header.pages;
+    }
+
+    uint32_t version() const {
+        return header.version;
+    }
+
+    Page page( int i) const {
+        return PageCodec::decode( page_data( i));
+    }
+
+    // encoded page (PageCodec), as stored
+    std::string page_data( int i) const {
+        if( i < 0 || i >= (int) table.size())
+            throw "Document: no page " + std::to_string( i) + " in '" + path + "'\n";
+
+        std::string data( table[i].size, '\0');
+        read( data.data(), data.size(), table[i].offset);
+        return data;
+    }
+
+private:
+    void read( void* data, size_t size, uint64_t offset) const {
+        if( pread( fd, data, size, offset) != (ssize_t) size)
+            throw "Document: could not read '" + path + "'\n";
+    }
+};
+
+// write pages one at a time, file replaced atomically on finish()
+class NotebookWriter {
+    std::string path, tmp;
+    FILE* file;
+    NotebookHeader header;
+    std::vector<PageEntry> table;
+    uint64_t offset = sizeof( NotebookHeader);
+
+public:
+    NotebookWriter( const std::string& path, uint32_t version = 1)
+        : path( path), tmp( path + ".tmp")
+    {
+        file = std::fopen( tmp.c_str(), "wb");
+        if( !file)
+            throw "Document: could not create '" + tmp + "'\n";
+
+        header.version = version;
+        write( &header, sizeof( header));
+    }
+
+    NotebookWriter( const NotebookWriter&) = delete;
+    NotebookWriter& operator=( const NotebookWriter&) = delete;
+
+    ~NotebookWriter() {
+        if( file) {            // not finished: drop partial file
+            std::fclose( file);
+            ::unlink( tmp.c_str());
+        }
+    }
+
+    void add( const Page& page) {
+        auto data = PageCodec::encode( page);
+        table.push_back( PageEntry{ offset, (uint32_t) data.size(), 0});
+        write( data.data(), data.size());
+        offset += data.size();
+    }
+
+    void finish() {
+        header.pages = table.size();
+        header.table = offset;
+        write( table.data(), table.size() * sizeof( PageEntry));
+
+        std::fseek( file, 0, SEEK_SET);
+        write( &header, sizeof( header));
+
+        bool ok = std::fflush( file) == 0 && fsync( fileno( file)) == 0;
+        std::fclose( file);
+        file = nullptr;
+
+        if( !ok || std::rename( tmp.c_str(), path.c_str()))
+            throw "Document: could not save '" + path + "'\n";
+    }
+
+private:
+    void write( const void* data, size_t size) {
+        if( std::fwrite( data, 1, size, file) != size)
+            throw "Document: could not write '" + tmp + "'\n";
+    }
+};
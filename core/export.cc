@@ -0,0 +1,336 @@
+// Notebook export
+// pages are loaded, rendered and written one at a time by each worker,
+// so memory stays bounded by the number of workers whatever the notebook size
+//  - PNG: one 4 bits gray image per page, rendered with the device code (render.cc)
+//  - PDF: single vector document, strokes as paths and texts as Helvetica (WinAnsi encoded)
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <functional>
+
+#include <zlib.h>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "document.cc"
+#include "render.cc"
+
+// streaming PNG writer: rows are deflated as they come
+class PngWriter {
+    FILE* file;
+    std::string path;
+    z_stream z{};
+    std::vector<uint8_t> out;
+    int width, height, bits;
+
+public:
+    // bits: 1, 2, 4 or 8 bits gray
+    PngWriter( const std::string& path, int width, int height, int bits = 4)
+        : path( path), out( 1 << 16), width( width), height( height), bits( bits)
+    {
+        file = std::fopen( path.c_str(), "wb");
+        if( !file)
+            throw "PngWriter: could not create '" + path + "'\n";
+
+        static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        write( signature, sizeof( signature));
+
+        uint8_t ihdr[13];
+        be32( ihdr, width);
+        be32( ihdr + 4, height);
+        ihdr[8] = bits;
+        ihdr[9] = 0;            // gray
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        chunk( "IHDR", ihdr, sizeof( ihdr));
+
+        if( deflateInit( &z, 6) != Z_OK)
+            throw std::string( "PngWriter: deflateInit failed\n");
+    }
+
+    PngWriter( const PngWriter&) = delete;
+    PngWriter& operator=( const PngWriter&) = delete;
+
+    ~PngWriter() {
+        deflateEnd( &z);
+        if( file)
+            std::fclose( file);
+    }
+
+    // one row of 8 bits gray, packed to the output depth
+    void row( const uint8_t* gray) {
+        std::vector<uint8_t> packed( 1 + (width * bits + 7) / 8, 0);     // filter type 0
+        for( int x = 0; x < width; ++x) {
+            int v = gray[x] >> (8 - bits);
+            int bit = x * bits;
+            packed[ 1 + bit / 8] |= v << (8 - bits - bit % 8);
+        }
+        deflate_data( packed.data(), packed.size(), Z_NO_FLUSH);
+    }
+
+    void finish() {
+        deflate_data( nullptr, 0, Z_FINISH);
+        chunk( "IEND", nullptr, 0);
+        if( std::fclose( file))
+            throw "PngWriter: could not write '" + path + "'\n";
+        file = nullptr;
+    }
+
+private:
+    static void be32( uint8_t* p, uint32_t v) {
+        p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+    }
+
+    void write( const void* data, size_t size) {
+        if( size && std::fwrite( data, 1, size, file) != size)
+            throw "PngWriter: could not write '" + path + "'\n";
+    }
+
+    void chunk( const char* type, const uint8_t* data, uint32_t size) {
+        uint8_t head[8];
+        be32( head, size);
+        std::memcpy( head + 4, type, 4);
+        write( head, 8);
+        write( data, size);
+
+        // crc32( crc, NULL, 0) is the initial value (0), not crc
+        uint32_t crc = crc32( 0, head + 4, 4);
+        if( size)
+            crc = crc32( crc, data, size);
+        uint8_t tail[4];
+        be32( tail, crc);
+        write( tail, 4);
+    }
+
+    void deflate_data( const uint8_t* data, size_t size, int flush) {
+        z.next_in = (Bytef*) data;
+        z.avail_in = size;
+        do {
+            z.next_out = out.data();
+            z.avail_out = out.size();
+            deflate( &z, flush);
+            size_t produced = out.size() - z.avail_out;
+            if( produced)
+                chunk( "IDAT", out.data(), produced);
+        } while( z.avail_out == 0);
+    }
+};
+
+// PDF document written page by page, pages may arrive in any order
+// objects: 1 catalog, 2 page tree (written last), 3 font, 4+2i page i, 5+2i its content
+class PdfWriter {
+    FILE* file;
+    std::string path;
+    int pages;
+    std::vector<long> offsets;      // per object
+    long position = 0;
+    std::mutex lock;
+
+public:
+    // page size in pixels, shown at the panel resolution (226 dpi)
+    static constexpr float DPI = 226;
+    int width, height;
+
+    PdfWriter( const std::string& path, int pages, int width = 1404, int height = 1872)
+        : path( path), pages( pages), offsets( 4 + 2 * pages, 0), width( width), height( height)
+    {
+        file = std::fopen( path.c_str(), "wb");
+        if( !file)
+            throw "PdfWriter: could not create '" + path + "'\n";
+
+        text( "%PDF-1.4\n%\xe2\xe3\xcf\xd3\n");
+        object( 1, "<< /Type /Catalog /Pages 2 0 R >>");
+        object( 3, "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica /Encoding /WinAnsiEncoding >>");
+    }
+
+    PdfWriter( const PdfWriter&) = delete;
+    PdfWriter& operator=( const PdfWriter&) = delete;
+
+    ~PdfWriter() {
+        if( file)
+            std::fclose( file);
+    }
+
+    // content stream of a page, pixels with origin at top left
+    static std::string content( const Page& page, int height) {
+        std::ostringstream s;
+        s.imbue( std::locale::classic());
+        float k = 72 / DPI;
+        s << k << " 0 0 " << -k << " 0 " << height * k << " cm\n1 J 1 j\n";
+
+        for( auto& stroke: page.strokes) {
+            auto& p = stroke->points;
+            if( p.empty())
+                continue;
+
+            s << stroke->color / 255.f << " G " << (int) stroke->width << " w\n";
+            s << p[0].x << " " << p[0].y << " m\n";
+            for( size_t i = 1; i < p.size(); ++i)
+                s << p[i].x << " " << p[i].y << " l\n";
+            if( p.size() == 1)
+                s << p[0].x << " " << p[0].y << " l\n";
+            s << "S\n";
+        }
+
+        // hex strings, each line placed on its own
+        for( auto& t: page.texts) {
+            int y = t.pos.y;
+            s << "BT /F1 " << t.size << " Tf 0 g 1 0 0 -1 " << t.pos.x << " " << y << " Tm <";
+            for( size_t i = 0; i < t.text.size(); ) {
+                uint32_t c = utf8_next( t.text, i);
+                if( c == '\n') {
+                    y += t.line_height();
+                    s << "> Tj 1 0 0 -1 " << t.pos.x << " " << y << " Tm <";
+                    continue;
+                }
+                char hex[3];
+                std::snprintf( hex, sizeof( hex), "%02x", win_ansi( c));
+                s << hex;
+            }
+            s << "> Tj ET\n";
+        }
+        return s.str();
+    }
+
+    // WinAnsiEncoding byte of code point c, '?' if none
+    static uint8_t win_ansi( uint32_t c) {
+        static const uint16_t high[32] = {          // 0x80 ... 0x9f
+            0x20ac, 0, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021, 0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0, 0x017d, 0,
+            0, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014, 0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0, 0x017e, 0x0178 };
+        if( (c >= 0x20 && c < 0x7f) || (c >= 0xa0 && c <= 0xff))
+            return c;
+        for( int i = 0; i < 32; ++i)
+            if( high[i] && high[i] == c)
+                return 0x80 + i;
+        return '?';
+    }
+
+    // thread safe
+    void page( int i, const std::string& content) {
+        uLongf size = compressBound( content.size());
+        std::string packed( size, '\0');
+        if( compress2( (Bytef*) packed.data(), &size, (const Bytef*) content.data(), content.size(), 6) != Z_OK)
+            throw std::string( "PdfWriter: compress failed\n");
+        packed.resize( size);
+
+        float k = 72 / DPI;
+        std::ostringstream page;
+        page.imbue( std::locale::classic());
+        page << "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << width * k << " " << height * k << "]"
+             << " /Resources << /Font << /F1 3 0 R >> >> /Contents " << 5 + 2 * i << " 0 R >>";
+
+        std::lock_guard<std::mutex> guard( lock);
+        object( 4 + 2 * i, page.str());
+        object( 5 + 2 * i, "<< /Length " + std::to_string( packed.size()) + " /Filter /FlateDecode >>\nstream\n"
+                           + packed + "\nendstream");
+    }
+
+    void finish() {
+        std::string kids;
+        for( int i = 0; i < pages; ++i)
+            kids += std::to_string( 4 + 2 * i) + " 0 R ";
+        object( 2, "<< /Type /Pages /Kids [ " + kids + "] /Count " + std::to_string( pages) + " >>");
+
+        long xref = position;
+        text( "xref\n0 " + std::to_string( offsets.size()) + "\n0000000000 65535 f \n");
+        for( size_t i = 1; i < offsets.size(); ++i) {
+            char entry[32];
+            std::snprintf( entry, sizeof( entry), "%010ld 00000 n \n", offsets[i]);
+            text( entry);
+        }
+        text( "trailer\n<< /Size " + std::to_string( offsets.size()) + " /Root 1 0 R >>\nstartxref\n"
+              + std::to_string( xref) + "\n%%EOF\n");
+
+        if( std::fclose( file))
+            throw "PdfWriter: could not write '" + path + "'\n";
+        file = nullptr;
+    }
+
+private:
+    void text( const std::string& s) {
+        if( std::fwrite( s.data(), 1, s.size(), file) != s.size())
+            throw "PdfWriter: could not write '" + path + "'\n";
+        position += s.size();
+    }
+
+    void object( int id, const std::string& body) {
+        offsets[id] = position;
+        text( std::to_string( id) + " 0 obj\n" + body + "\nendobj\n");
+    }
+};
+
+// run fn( page) for every page, on threads workers pulling pages in order
+// first error stops the remaining pages and is rethrown
+inline void for_each_page( int pages, int threads, const std::function<void( int)>& fn) {
+    if( threads <= 0)
+        threads = std::max( 1u, std::thread::hardware_concurrency());
+    threads = std::max( 1, std::min( threads, pages));
+
+    std::atomic<int> next{ 0};
+    std::mutex lock;
+    std::string error;
+
+    auto worker = [&]{
+        for( int i; (i = next++) < pages; ) {
+            try {
+                fn( i);
+            }
+            catch( const std::string& e) {
+                std::lock_guard<std::mutex> guard( lock);
+                error = e;
+                next = pages;
+            }
+            catch( const char* e) {
+                std::lock_guard<std::mutex> guard( lock);
+                error = e;
+                next = pages;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for( int i = 1; i < threads; ++i)
+        workers.emplace_back( worker);
+    worker();
+    for( auto& w: workers)
+        w.join();
+
+    if( !error.empty())
+        throw error;
+}
+
+// pages of notebook as dir/page-0001.png ...
+inline void export_png( const NotebookReader& notebook, const std::string& dir, int threads = 0, int width = 1404, int height = 1872) {
+    for_each_page( notebook.pages(), threads, [&]( int i) {
+        Page page = notebook.page( i);
+
+        Bitmap canvas( width, height);
+        render( page, canvas, canvas.bounds());
+
+        char name[32];
+        std::snprintf( name, sizeof( name), "/page-%04d.png", i + 1);
+        PngWriter png( dir + name, width, height, 4);
+
+        std::vector<uint8_t> gray( width);
+        for( int y = 0; y < height; ++y) {
+            rgb565_to_gray( canvas.row( y), gray.data(), width);
+            png.row( gray.data());
+        }
+        png.finish();
+    });
+}
+
+// notebook as a single vector PDF
+inline void export_pdf( const NotebookReader& notebook, const std::string& path, int threads = 0) {
+    PdfWriter pdf( path, notebook.pages());
+    for_each_page( notebook.pages(), threads, [&]( int i) {
+        pdf.page( i, PdfWriter::content( notebook.page( i), pdf.height));
+    });
+    pdf.finish();
+}
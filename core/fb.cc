@@ -1,4 +1,6 @@
 // FrameBuffer implementation
+#pragma once
+
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
@@ -8,9 +10,22 @@
 #include <linux/fb.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <semaphore.h>
+#include <time.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <string>
+#include <vector>
+#include <chrono>
 #include <iostream>
+#include <algorithm>
 
 // #include "mxcfb.h" // use libremarkable/legacy-c-impl/libremarkable/lib.h which is cleaner&complete
 
@@ -30,6 +45,32 @@ struct Rect {
     int width() const {
         return bottomRight.x - topLeft.x;
     }
+
+    bool empty() const {
+        return width() <= 0 || height() <= 0;
+    }
+
+    int area() const {
+        return empty() ? 0 : width() * height();
+    }
+
+    // common part of both rects (empty if none)
+    Rect intersected( const Rect& r) const {
+        return Rect{ Point{ std::max( topLeft.x, r.topLeft.x), std::max( topLeft.y, r.topLeft.y)},
+                     Point{ std::min( bottomRight.x, r.bottomRight.x), std::min( bottomRight.y, r.bottomRight.y)} };
+    }
+
+    bool contains( const Point& p) const {
+        return p.x >= topLeft.x && p.x < bottomRight.x && p.y >= topLeft.y && p.y < bottomRight.y;
+    }
+
+    // bounding box of both rects
+    Rect united( const Rect& r) const {
+        if( empty()) return r;
+        if( r.empty()) return *this;
+        return Rect{ Point{ std::min( topLeft.x, r.topLeft.x), std::min( topLeft.y, r.topLeft.y)},
+                     Point{ std::max( bottomRight.x, r.bottomRight.x), std::max( bottomRight.y, r.bottomRight.y)} };
+    }
 };
 
 // from libremarkable/legacy-c-impl/libremarkable/lib.h
@@ -147,14 +188,44 @@ typedef struct {
 
 // end from libremarkable/legacy-c-impl/libremarkable/lib.h
 
+// from https://github.com/ddvk/remarkable2-framebuffer (src/shared/ipc.cpp)
+// on rM2 the EPDC is driven by the rm2fb server:
+// frame is shared memory, updates are sent through a SysV message queue
+#define SWTFB_SHM        "/dev/shm/swtfb.01"
+#define SWTFB_MSGQ_KEY   0x2257c
+
+typedef enum _swtfb_msg_type {
+  SWTFB_INIT_t = 1,
+  SWTFB_UPDATE_t,
+  SWTFB_XO_t,
+  SWTFB_WAIT_t
+} swtfb_msg_type;
+
+typedef struct {
+  long mtype;
+  struct {
+    union {
+      struct { int x1, y1, x2, y2, waveform, flags; } xochitl_update;
+      mxcfb_update_data update;
+      struct { char sem_name[512]; } wait_update;
+    };
+    uint64_t ms;                    // send time, used by server for latency stats
+  } mdata;
+} swtfb_update;
+// end from remarkable2-framebuffer
+
 class FrameBuffer: public Rect {
 public:
     int device;
+    int queue = -1;         // rm2fb message queue, updates bypass ioctl when set
     std::string path;
 
     int frame_length;
     uint8_t* mem_map;
 
+    mutable uint32_t updates = 0;   // updates sent so far (power accounting)
+    mutable uint32_t marker = 0;    // marker of the last update sent (see wait)
+
     fb_var_screeninfo vinfo;
     fb_fix_screeninfo finfo;
 
@@ -169,6 +240,7 @@ public:
             throw "FrameBuffer: could not open '" + fb.path + "'\n";
 
         fb.vinfo = fb.get_vinfo();
+        fb.topLeft = Point{ 0, 0};
         fb.bottomRight = Point{ (int) fb.vinfo.xres, (int) fb.vinfo.yres};
 
         if( fb.vinfo.bits_per_pixel != 16)
@@ -188,6 +260,75 @@ public:
         return fb;
     }
 
+    // off-screen frame buffer (no panel behind, refresh does nothing)
+    // same layout as the device, for host builds and benchmarks
+    static
+    FrameBuffer memory( int width = 1404, int height = 1872) {
+        FrameBuffer fb;
+        fb.path = "memory";
+        fb.device = -1;
+
+        fb.vinfo = fb_var_screeninfo{};
+        fb.vinfo.xres = width;
+        fb.vinfo.yres = height;
+        fb.vinfo.bits_per_pixel = 16;
+        fb.topLeft = Point{ 0, 0};
+        fb.bottomRight = Point{ width, height};
+
+        fb.finfo = fb_fix_screeninfo{};
+        fb.finfo.line_length = width * 2;
+
+        fb.frame_length = fb.finfo.line_length * fb.vinfo.yres;
+        fb.mem_map = (uint8_t*) mmap( 0, fb.frame_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( fb.mem_map == MAP_FAILED)
+            throw "FrameBuffer: unable to allocate " + std::to_string( fb.frame_length) + " bytes\n";
+
+        return fb;
+    }
+
+    // rM2: talk directly to the rm2fb server (no rm2fb-client LD_PRELOAD shim)
+    // map its shared frame and send updates through its message queue
+    static
+    FrameBuffer rm2fb( const char* path = SWTFB_SHM, key_t key = SWTFB_MSGQ_KEY) {
+        FrameBuffer fb;
+        fb.path = path;
+        fb.device = -1;
+
+        fb.queue = msgget( key, 0);
+        if( fb.queue < 0)
+            throw "FrameBuffer: no rm2fb server (msgget failed, errno= " + std::to_string(errno) + ")\n";
+
+        fb.vinfo = fb_var_screeninfo{};
+        fb.vinfo.xres = 1404;
+        fb.vinfo.yres = 1872;
+        fb.vinfo.bits_per_pixel = 16;
+        fb.topLeft = Point{ 0, 0};
+        fb.bottomRight = Point{ (int) fb.vinfo.xres, (int) fb.vinfo.yres};
+
+        fb.finfo = fb_fix_screeninfo{};
+        fb.finfo.line_length = fb.vinfo.xres * 2;
+        fb.frame_length = fb.finfo.line_length * fb.vinfo.yres;
+
+        int shm = ::open( path, O_RDWR);
+        if( shm < 0)
+            throw "FrameBuffer: could not open '" + fb.path + "'\n";
+
+        fb.mem_map = (uint8_t*) mmap( 0, fb.frame_length, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+        ::close( shm);
+        if( fb.mem_map == MAP_FAILED)
+            throw "FrameBuffer: unable to mmap frame '" + fb.path + "'\n";
+
+        return fb;
+    }
+
+    // rm2fb server when running, /dev/fb0 otherwise
+    static
+    FrameBuffer open_default() {
+        if( ::access( SWTFB_SHM, R_OK | W_OK) == 0 && msgget( SWTFB_MSGQ_KEY, 0) >= 0)
+            return rm2fb();
+        return open();
+    }
+
     void to_s() const {
         std::cerr << "opened '" << path << "' - " << vinfo.xres << "x" << vinfo.yres 
              << ", depth: " << vinfo.bits_per_pixel << " bits"
@@ -266,7 +407,7 @@ public:
             mxcfb_rect{0,0,vinfo.xres,vinfo.yres},
             WAVEFORM_MODE_GL16_FAST,                    //waveform,
             UPDATE_MODE_PARTIAL, // UPDATE_MODE_FULL,       // mode,
-            0x2a, // marker,
+            0, // marker, set by submit
             0x0018, //TEMP_USE_AMBIENT, // temp,
             0,  // flags
             0, //dither_mode,
@@ -274,19 +415,23 @@ public:
             mxcfb_alt_buffer_data{}
         };
 
-        int status;
-        if( status = ioctl( device, REMARKABLE_PREFIX(MXCFB_SEND_UPDATE), &whole))
-            throw "FrameBuffer: failed to MXCFB_SEND_UPDATE: " + std::to_string(status) 
-                    + " (errno= " + std::to_string(errno) + ") \n";
+        submit( whole);
     }
 
     // fast refresh of selected area
     void refresh( const Rect& r) const {
+        refresh( r, WAVEFORM_MODE_DU);
+    }
+
+    // refresh of selected area with a given waveform
+    // eg: WAVEFORM_MODE_GC16 / WAVEFORM_MODE_REAGL to clean ghosting left by fast updates
+    // return the update marker (see wait)
+    uint32_t refresh( const Rect& r, waveform_mode waveform, update_mode mode = UPDATE_MODE_PARTIAL) const {
         mxcfb_update_data whole{
-            mxcfb_rect{ r.topLeft.y, r.topLeft.x, r.width(), r.height()},
-            WAVEFORM_MODE_DU,                    //waveform,
-            UPDATE_MODE_PARTIAL, // UPDATE_MODE_FULL,       // mode,
-            0x2a, // marker,
+            mxcfb_rect{ (uint32_t) r.topLeft.y, (uint32_t) r.topLeft.x, (uint32_t) r.width(), (uint32_t) r.height()},
+            (uint32_t) waveform,                 //waveform,
+            (uint32_t) mode,                     // mode,
+            0, // marker, set by submit
             0x0018, //TEMP_USE_AMBIENT, // temp,
             0,  // flags
             0, //dither_mode,
@@ -294,15 +439,152 @@ public:
             mxcfb_alt_buffer_data{}
         };
 
+        return submit( whole);
+    }
+
+    // animation: fast refresh of selected areas
+    void refresh( const Rect& r1, const Rect& r2) const {
+        refresh( std::vector<Rect>{ r1, r2}, WAVEFORM_MODE_DU);
+    }
+
+    // refresh several areas with the same waveform
+    // rects whose bounding box costs little more than the rects themselves
+    // are merged, so they go out as a single update
+    void refresh( std::vector<Rect> rects, waveform_mode waveform) const {
+        for( size_t i = 0; i < rects.size(); ++i) {
+            for( size_t j = i + 1; j < rects.size(); ) {
+                auto u = rects[i].united( rects[j]);
+                if( u.area() * 4 <= (rects[i].area() + rects[j].area()) * 5) {
+                    rects[i] = u;
+                    rects.erase( rects.begin() + j);
+                    j = i + 1;              // merged rect may now reach previous ones
+                }
+                else
+                    ++j;
+            }
+        }
+
+        for( auto& r: rects)
+            if( !r.empty())
+                refresh( r, waveform);
+    }
+
+    // time the EPDC stays powered after the last update (ms), 0 => power down at once
+    // a longer delay saves the power up cost between close updates (eg: while writing)
+    // return false when not available (rm2fb server, memory frame buffer, old kernel)
+    bool set_powerdown_delay( int32_t ms) const {
+        if( queue >= 0 || device < 0)
+            return false;
+
+        // takes an int32_t, not an update: REMARKABLE_PREFIX would encode the wrong size
+        return ioctl( device, _IOW( 'F', MXCFB_SET_PWRDOWN_DELAY, int32_t), &ms) == 0;
+    }
+
+    // block until update marker (and the ones sent before it on rm2fb) is on the panel
+    // return false when not available (memory frame buffer) or failed (timeout on rm2fb)
+    // thread safe: may run on a helper thread while the main one keeps sending updates
+    bool wait( uint32_t update_marker) const {
+        if( queue >= 0) {   // rm2fb server: posts a named semaphore once its updates are done
+            std::string name = "/stylo_wait." + std::to_string( getpid()) + "." + std::to_string( update_marker);
+            sem_t* done = sem_open( name.c_str(), O_CREAT | O_EXCL, 0600, 0);
+            if( done == SEM_FAILED)
+                return false;
+
+            swtfb_update msg{};
+            msg.mtype = SWTFB_WAIT_t;
+            std::strncpy( msg.mdata.wait_update.sem_name, name.c_str(), sizeof( msg.mdata.wait_update.sem_name) - 1);
+            bool ok = msgsnd( queue, &msg, sizeof( msg.mdata), 0) == 0;
+            if( ok) {
+                timespec limit;
+                clock_gettime( CLOCK_REALTIME, &limit);
+                limit.tv_sec += 2;
+                while( (ok = sem_timedwait( done, &limit) == 0) == false && errno == EINTR)
+                    ;
+            }
+            sem_close( done);
+            sem_unlink( name.c_str());
+            return ok;
+        }
+
+        if( device < 0)
+            return false;
+
+        // takes a marker, not an update: REMARKABLE_PREFIX would encode the wrong size
+        mxcfb_update_marker_data data{ update_marker, 0};
+        int status;
+        while( (status = ioctl( device, _IOWR( 'F', MXCFB_WAIT_FOR_UPDATE_COMPLETE, mxcfb_update_marker_data), &data)) < 0 && errno == EINTR)
+            ;
+        return status >= 0;
+    }
+
+    bool can_wait() const {
+        return queue >= 0 || device >= 0;
+    }
+
+    // send update to the EPDC, with a new marker
+    uint32_t submit( mxcfb_update_data& update) const {
+        ++updates;
+        if( ++marker == 0)      // 0: no marker
+            ++marker;
+        update.update_marker = marker;
+
+        if( queue >= 0) {   // rm2fb server
+            swtfb_update msg{};
+            msg.mtype = SWTFB_UPDATE_t;
+            msg.mdata.update = update;
+            msg.mdata.ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch()).count();
+
+            if( msgsnd( queue, &msg, sizeof( msg.mdata), 0))
+                throw "FrameBuffer: failed to send rm2fb update (errno= " + std::to_string(errno) + ") \n";
+            return marker;
+        }
+
+        if( device < 0)     // memory frame buffer
+            return marker;
+
         int status;
-        if( status = ioctl( device, REMARKABLE_PREFIX(MXCFB_SEND_UPDATE), &whole))
+        if( status = ioctl( device, REMARKABLE_PREFIX(MXCFB_SEND_UPDATE), &update))
             throw "FrameBuffer: failed to MXCFB_SEND_UPDATE: " + std::to_string(status) 
                     + " (errno= " + std::to_string(errno) + ") \n";
+        return marker;
     }
+};
 
-    // animation: fast refresh of selected areas
-    void refresh( const Rect& r1, const Rect& r2) {
-        refresh( r1);
-        refresh( r2);
+// pixel format conversion
+// the panel is gray, the frame buffer RGB565
+inline uint16_t gray_to_rgb565( uint8_t g) {
+    return ((g >> 3) << 11) | ((g >> 2) << 5) | (g >> 3);
+}
+
+// luminance ~ (2R + 5G + B) / 8, on 8 bits
+inline uint8_t rgb565_to_gray( uint16_t c) {
+    int r = (c >> 11) & 0x1f, g = (c >> 5) & 0x3f, b = c & 0x1f;
+    return (uint8_t) ((r * 2 * 255 / 31 + g * 5 * 255 / 63 + b * 255 / 31) >> 3);
+}
+
+inline void gray_to_rgb565( const uint8_t* src, uint16_t* dst, int count) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for( ; i + 8 <= count; i += 8) {
+        uint16x8_t g = vmovl_u8( vld1_u8( src + i));
+        uint16x8_t r = vshrq_n_u16( g, 3);
+        vst1q_u16( dst + i, vorrq_u16( vorrq_u16( vshlq_n_u16( r, 11), vshlq_n_u16( vshrq_n_u16( g, 2), 5)), r));
     }
-};
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for( ; i + 8 <= count; i += 8) {
+        __m128i g = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (src + i)), zero);
+        __m128i r = _mm_srli_epi16( g, 3);
+        _mm_storeu_si128( (__m128i*) (dst + i),
+            _mm_or_si128( _mm_or_si128( _mm_slli_epi16( r, 11), _mm_slli_epi16( _mm_srli_epi16( g, 2), 5)), r));
+    }
+#endif
+    for( ; i < count; ++i)
+        dst[i] = gray_to_rgb565( src[i]);
+}
+
+inline void rgb565_to_gray( const uint16_t* src, uint8_t* dst, int count) {
+    for( int i = 0; i < count; ++i)
+        dst[i] = rgb565_to_gray( src[i]);
+}
@@ -0,0 +1,283 @@
+// Undo / redo history
+// edits are recorded as commands on page content, not pixels:
+// strokes are shared with the pages (StrokeRef), so a command costs a few pointers,
+// and only strokes no longer on a page (erased, replaced) weight on the memory budget.
+// undo/redo return the damaged page area, to re-render only that region.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "fb.cc"
+#include "document.cc"
+
+// change of one stroke slot
+//  before && after   => replaced in place (index in page before edit)
+//  before && !after  => removed (index in page before edit)
+//  !before && after  => inserted (index in page after edit)
+struct StrokeChange {
+    uint32_t index;
+    StrokeRef before;
+    StrokeRef after;
+};
+
+// change of one text: splice of its content, or whole text added/removed
+struct TextChange {
+    enum Kind { Splice, Insert, Remove } kind = Splice;
+    uint32_t index;             // text in page
+    uint32_t at = 0;            // splice position (bytes)
+    std::string removed, inserted;
+    Text text;                  // Insert / Remove only
+};
+
+// one undoable edit of a page
+struct Edit {
+    int page = 0;
+    std::vector<StrokeChange> strokes;
+    std::vector<TextChange> texts;
+    Rect damage{ Point{ 0, 0}, Point{ 0, 0} };    // page area to re-render
+    size_t bytes = 0;                               // cost when recorded
+
+    // bytes kept alive by this edit
+    size_t cost() const {
+        size_t bytes = sizeof( Edit) + strokes.size() * sizeof( StrokeChange);
+        for( auto& c: strokes)
+            if( c.before && c.before.use_count() <= 1)      // held by history only
+                bytes += sizeof( Stroke) + c.before->points.size() * sizeof( StrokePoint);
+        for( auto& t: texts)
+            bytes += sizeof( TextChange) + t.removed.size() + t.inserted.size() + t.text.text.size();
+        return bytes;
+    }
+
+    void apply( Page& p) const {
+        // replacements, then removals from the end, then insertions from the start
+        for( auto& c: strokes)
+            if( c.before && c.after)
+                p.strokes[ c.index] = c.after;
+        for( auto it = strokes.rbegin(); it != strokes.rend(); ++it)
+            if( it->before && !it->after)
+                p.strokes.erase( p.strokes.begin() + it->index);
+        for( auto& c: strokes)
+            if( !c.before && c.after)
+                p.strokes.insert( p.strokes.begin() + c.index, c.after);
+
+        for( auto& t: texts)
+            apply( p, t, false);
+    }
+
+    void revert( Page& p) const {
+        for( auto it = texts.rbegin(); it != texts.rend(); ++it)
+            apply( p, *it, true);
+
+        for( auto it = strokes.rbegin(); it != strokes.rend(); ++it)
+            if( !it->before && it->after)
+                p.strokes.erase( p.strokes.begin() + it->index);
+        for( auto& c: strokes)
+            if( c.before && !c.after)
+                p.strokes.insert( p.strokes.begin() + c.index, c.before);
+        for( auto& c: strokes)
+            if( c.before && c.after)
+                p.strokes[ c.index] = c.before;
+    }
+
+private:
+    static void apply( Page& p, const TextChange& t, bool reverse) {
+        auto kind = t.kind;
+        if( reverse && kind != TextChange::Splice)
+            kind = kind == TextChange::Insert ? TextChange::Remove : TextChange::Insert;
+
+        switch( kind) {
+            case TextChange::Insert:
+                p.texts.insert( p.texts.begin() + t.index, t.text);
+                break;
+            case TextChange::Remove:
+                p.texts.erase( p.texts.begin() + t.index);
+                break;
+            case TextChange::Splice: {
+                auto& s = p.texts[ t.index].text;
+                auto& from = reverse ? t.inserted : t.removed;
+                auto& to   = reverse ? t.removed  : t.inserted;
+                s.replace( t.at, from.size(), to);
+                break;
+            }
+        }
+    }
+};
+
+// Pages: any container where pages[i] is a Page& (eg: std::vector<Page>)
+class History {
+    std::deque<Edit> done;
+    std::vector<Edit> undone;
+    size_t budget;
+    size_t used = 0;
+
+public:
+    // budget: bytes of history kept alive, oldest edits are dropped beyond
+    History( size_t budget = 4 << 20)
+        : budget( budget) {}
+
+    bool can_undo() const { return !done.empty(); }
+    bool can_redo() const { return !undone.empty(); }
+    size_t memory() const { return used; }
+    size_t size() const { return done.size(); }
+
+    // apply edit and record it, return damaged page area
+    template<class Pages>
+    Rect apply( Pages& pages, Edit edit) {
+        edit.damage = damage( edit);
+        edit.apply( pages[ edit.page]);
+        auto r = edit.damage;
+
+        undone.clear();
+        push( std::move( edit));
+        return r;
+    }
+
+    // revert last edit, return damaged page area (empty if nothing to undo)
+    template<class Pages>
+    Rect undo( Pages& pages, int* page = nullptr) {
+        if( done.empty())
+            return Rect{ Point{ 0, 0}, Point{ 0, 0} };
+
+        Edit edit = std::move( done.back());
+        done.pop_back();
+        used -= edit.bytes;
+
+        edit.revert( pages[ edit.page]);
+        if( page)
+            *page = edit.page;
+
+        auto r = edit.damage;
+        undone.push_back( std::move( edit));
+        return r;
+    }
+
+    // apply last undone edit again
+    template<class Pages>
+    Rect redo( Pages& pages, int* page = nullptr) {
+        if( undone.empty())
+            return Rect{ Point{ 0, 0}, Point{ 0, 0} };
+
+        Edit edit = std::move( undone.back());
+        undone.pop_back();
+
+        edit.apply( pages[ edit.page]);
+        if( page)
+            *page = edit.page;
+
+        auto r = edit.damage;
+        push( std::move( edit));
+        return r;
+    }
+
+    // common edits
+
+    template<class Pages>
+    Rect add_stroke( Pages& pages, int page, StrokeRef stroke) {
+        Edit e;
+        e.page = page;
+        e.strokes.push_back( StrokeChange{ (uint32_t) pages[ page].strokes.size(), nullptr, std::move( stroke)});
+        return apply( pages, std::move( e));
+    }
+
+    template<class Pages>
+    Rect erase_strokes( Pages& pages, int page, std::vector<uint32_t> indices) {
+        std::sort( indices.begin(), indices.end());
+        indices.erase( std::unique( indices.begin(), indices.end()), indices.end());
+
+        Edit e;
+        e.page = page;
+        for( auto i: indices)
+            e.strokes.push_back( StrokeChange{ i, pages[ page].strokes[i], nullptr});
+        return apply( pages, std::move( e));
+    }
+
+    // replace strokes in place (move, transform, recognized shape, ...)
+    template<class Pages>
+    Rect replace_strokes( Pages& pages, int page, const std::vector<std::pair<uint32_t, StrokeRef>>& strokes) {
+        Edit e;
+        e.page = page;
+        for( auto& s: strokes)
+            e.strokes.push_back( StrokeChange{ s.first, pages[ page].strokes[ s.first], s.second});
+        return apply( pages, std::move( e));
+    }
+
+    // replace count bytes at position at of a text
+    // typing is merged into the previous splice when it continues it
+    template<class Pages>
+    Rect edit_text( Pages& pages, int page, uint32_t index, uint32_t at, uint32_t count, const std::string& inserted) {
+        auto& text = pages[ page].texts[ index];
+        std::string removed = text.text.substr( at, count);
+
+        if( !done.empty() && undone.empty()) {
+            auto& last = done.back();
+            if( last.page == page && last.strokes.empty() && last.texts.size() == 1) {
+                auto& t = last.texts[0];
+                if( t.kind == TextChange::Splice && t.index == index && removed.empty()
+                    && at == t.at + t.inserted.size()) {
+                    text.text.insert( at, inserted);
+                    t.inserted += inserted;
+                    last.damage = last.damage.united( bounds( text));
+                    used -= last.bytes;
+                    last.bytes = last.cost();
+                    used += last.bytes;
+                    return last.damage;
+                }
+            }
+        }
+
+        Edit e;
+        e.page = page;
+        TextChange t;
+        t.index = index;
+        t.at = at;
+        t.removed = removed;
+        t.inserted = inserted;
+        e.texts.push_back( t);
+
+        // text before and after: undo / redo re-render the larger of both
+        Text after = text;
+        after.text.replace( at, count, inserted);
+        e.damage = bounds( text).united( bounds( after));
+        return apply( pages, std::move( e));
+    }
+
+    template<class Pages>
+    Rect add_text( Pages& pages, int page, Text text) {
+        Edit e;
+        e.page = page;
+        TextChange t;
+        t.kind = TextChange::Insert;
+        t.index = pages[ page].texts.size();
+        t.text = std::move( text);
+        e.texts.push_back( std::move( t));
+        return apply( pages, std::move( e));
+    }
+
+private:
+    static Rect damage( const Edit& e) {
+        Rect r = e.damage;
+        for( auto& c: e.strokes) {
+            if( c.before) r = r.united( c.before->bounds());
+            if( c.after)  r = r.united( c.after->bounds());
+        }
+        for( auto& t: e.texts)
+            if( t.kind != TextChange::Splice)
+                r = r.united( bounds( t.text));
+        return r;
+    }
+
+    void push( Edit edit) {
+        edit.bytes = edit.cost();
+        used += edit.bytes;
+        done.push_back( std::move( edit));
+
+        while( used > budget && done.size() > 1) {
+            used -= done.front().bytes;
+            done.pop_front();
+        }
+    }
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -7,68 +9,27 @@
 #include <iostream>
 #include <array>
 #include <vector>
+#include <functional>
+#include <algorithm>
 
 using namespace std;
 
-#include <filesystem>
-namespace fs = std::filesystem;
-
-
-// from https://github.com/rmkit-dev/rmkit/blob/master/src/rmkit/input/device_id.cpy
-// glommed from evtest.c
-#define BITS_PER_LONG (sizeof(long) * 8)
-#define NBITS(x) ((((x)-1)/BITS_PER_LONG)+1)
-#define OFF(x)  ((x)%BITS_PER_LONG)
-#define BIT(x)  (1UL<<OFF(x))
-#define LONG(x) ((x)/BITS_PER_LONG)
-#define test_bit(bit, array)    ((array[LONG(bit)] >> OFF(bit)) & 1)
-
-
-auto check_bit_set(int fd, int type, int i) {
-    unsigned long bit[NBITS(KEY_MAX)];
-    ioctl(fd, EVIOCGBIT(type, KEY_MAX), bit);
-    return test_bit(i, bit);
-}
-
-std::string id_by_capabilities(int fd) {
-    int version;
-    // if we can't get version of the fd, its invalid
-    if( ioctl(fd, EVIOCGVERSION, &version))
-        return "INVALID";
-
-    unsigned long bit[EV_MAX];
-    ioctl(fd, EVIOCGBIT(0, EV_MAX), bit);
-    if( test_bit(EV_KEY, bit)) {
-        if( check_bit_set(fd, EV_KEY, BTN_STYLUS) 
-            && test_bit(EV_ABS, bit))
-            return "STYLUS";
-
-        if( check_bit_set(fd, EV_KEY, KEY_POWER))
-            return "BUTTONS";
-
-        if( test_bit(EV_REL, bit)
-            && check_bit_set(fd, EV_ABS, ABS_MT_SLOT))
-            return "TOUCH";
-    }
-
-    return "UNKNOWN";
-}
-// end from https://github.com/rmkit-dev/rmkit/blob/master/src/rmkit/input/device_id.cpy
-
-// from rmkit
+#include "fb.cc"
+#include "calibration.cc"
+#include "devices.cc"
 
-#define WACOMWIDTH 15725.0
-#define WACOMHEIGHT 20967.0
-#define DISPLAYWIDTH 1404
-#define DISPLAYHEIGHT 1872.0
-#define WACOM_X_SCALAR (float(DISPLAYWIDTH) / float(WACOMWIDTH))
-#define WACOM_Y_SCALAR (float(DISPLAYHEIGHT) / float(WACOMHEIGHT))
+constexpr int MAX_FINGERS = 10;
 
-// end
+// touch screen contact
+struct Finger {
+    int id = -1;        // tracking id, -1 => slot unused
+    Point pos;
+};
 
 struct Event {
     timeval time;       // time of events
     int device;         // device from which the event is coming
+    DeviceType source;  // Touch => fingers, otherwise pen / buttons
     union {             // tool detected / or button
         int tool;           
         int key;
@@ -82,103 +43,216 @@ struct Event {
         };
     };
 
+    int pressure;       // pen pressure, 0..PRESSURE_MAX
+    Point tilt;         // pen tilt along screen axes (degrees)
+
+    Finger fingers[ MAX_FINGERS];   // touch contacts by multitouch slot
+    int slot;                       // slot being updated
+
+    int fingers_down() const {
+        int n = 0;
+        for( auto& f: fingers)
+            n += f.id >= 0;
+        return n;
+    }
 };
 
+// user at work: pen samples (down, moving, hovering), tool changes, fingers, buttons
+// pen down sets key to BTN_TOUCH for the whole stroke: test anything but the power key
+inline bool user_activity( const Event& ev) {
+    return ev.key != KEY_POWER;
+}
+
 // event + loop support
 class Input {
-    vector<pollfd> devices;
+    DeviceRegistry registry;
+    vector<pollfd> devices;         // subscribed devices, hotplug notification, then watched fds
+    Calibration calibration;
 
-public:
-    Input() {
-        cerr << "scanning input devices" << endl;
-        for(auto& p: fs::directory_iterator("/dev/input")) {
-            if( !p.is_symlink() && p.is_character_file() ) {
-                int dev = ::open( p.path().c_str(), O_RDONLY | O_NONBLOCK );
+    Event pen_state{}, touch_state{};  // decoder state, events are updated in place
 
-                std::cerr << p.path() << " " << id_by_capabilities(dev) << endl;
+    struct Watch {
+        int fd;
+        function<void( short revents)> handler;
+    };
+    vector<Watch> watched;          // other fds served by the loop (eg: plugins)
+    bool rewatch = false;           // watched changed during dispatch
 
-                pollfd pol = { dev, POLLIN };
-                devices.push_back( pol);
-            }
-        }
-        cerr << "end" << endl;        
+public:
+    // open only subscribed devices,
+    // grab => prevent other processes (eg: xochitl) from consuming the same events
+    Input( initializer_list<DeviceType> subscribe = { DeviceType::Stylus, DeviceType::Buttons, DeviceType::Touch },
+           bool grab = false,
+           Orientation orientation = Orientation::Portrait)
+        : registry( subscribe, grab),
+          calibration( Calibration::make( detect_model(), orientation))
+    {
+        update();
     };
 
+    // serve fd from the event loop: handler( revents) is called when fd is ready
+    // (POLLIN, or POLLERR / POLLHUP), it may unwatch fd
+    void watch( int fd, function<void( short revents)> handler) {
+        unwatch( fd);
+        watched.push_back( Watch{ fd, move( handler)});
+        rewatch = true;
+        update();
+    }
+
+    void unwatch( int fd) {
+        auto it = find_if( watched.begin(), watched.end(), [&]( auto& w){ return w.fd == fd; });
+        if( it == watched.end())
+            return;
+        watched.erase( it);
+        rewatch = true;
+    }
+
     // Event loop
     // call lambda on every event gathered
+    // sleeps until an event comes: no periodic wake up
     template<class Fn>
     void loop(Fn callback) {
         for(;;) {
-            int ret = poll( &devices[0], devices.size(), 10000 );
+            int ret = poll( devices.data(), devices.size(), -1 );
             // Check if poll actually succeed
             if ( ret == -1 ) {
+                if( errno == EINTR)
+                    continue;
                 // report error and abort
                 cerr << "poll failed" << endl;
                 break;
             }
-            else if ( ret == 0 ) {
-                // timeout; no event detected
-                cerr << "poll timeout" << endl;
+            else if ( ret > 0 )
+                dispatch( callback);
+        }
+    }
+
+    // Event loop with idle hook
+    // idle() is called after each wake up (event or timeout)
+    // and returns the next poll timeout in ms (-1 => wait for events only)
+    template<class Fn, class Idle>
+    void loop(Fn callback, Idle idle) {
+        int timeout = idle();
+        for(;;) {
+            int ret = poll( devices.data(), devices.size(), timeout );
+            if ( ret == -1 && errno != EINTR ) {
+                cerr << "poll failed" << endl;
+                break;
+            }
+            else if ( ret > 0 )
+                dispatch( callback);
+
+            timeout = idle();
+        }
+    }
+
+    // read every device with pending events
+    template<class Fn>
+    void dispatch(Fn callback) {
+        bool changed = false;
+        rewatch = false;
+
+        // If we detect the event, zero it out so we can reuse the structure
+        for( size_t i = 0; i < devices.size() && !rewatch; ++i) {
+            auto& pfd = devices[i];
+            if( !pfd.revents)
+                continue;
+
+            auto w = find_if( watched.begin(), watched.end(), [&]( auto& w){ return w.fd == pfd.fd; });
+            if( w != watched.end()) {
+                short revents = pfd.revents;
+                pfd.revents = 0;
+                auto handler = w->handler;      // may unwatch itself
+                handler( revents);
                 continue;
             }
-            else {
-                // If we detect the event, zero it out so we can reuse the structure
-                for( int i = 0; i < devices.size(); ++i) {
-                    auto& pfd = devices[i];
 
-                    if( pfd.revents & POLLIN ) {  // input event on device
-                        pfd.revents = 0;
-                        cerr << "event on device " << i << endl;
+            if( pfd.revents & POLLIN ) {  // input event on device
+                pfd.revents = 0;
 
-                        readEvent( pfd.fd, callback);
-                    }
-                }
+                if( pfd.fd == registry.hotplug_fd())
+                    changed |= registry.hotplug();
+                else if( !readEvent( pfd.fd, callback))
+                    changed |= registry.remove_fd( pfd.fd);
+            }
+            else if( pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                pfd.revents = 0;
+                changed |= registry.remove_fd( pfd.fd);
             }
         }
+
+        if( changed || rewatch)
+            update();
     }
 
     // convert linux input_event to Event
     // and call calback when Event is completly defined
     // see https://www.kernel.org/doc/html/latest/input/event-codes.html
+    // return false if device is gone
     template<class Fn>
-    void readEvent( int fd, Fn callback) {
-        static Event res = {};
+    bool readEvent( int fd, Fn callback) {
+        auto& list = registry.list();
+        auto d = find_if( list.begin(), list.end(), [&]( auto& d){ return d.fd == fd; });
+        auto type = d != list.end() ? d->type : DeviceType::Unknown;
 
-        // let's assume we get a complete set of linux event in buffer each time
+        Event& res = type == DeviceType::Touch ? touch_state : pen_state;
+        res.device = fd;
+        res.source = type;
+
+        // read events in batches: a pen sample is 7 events (position, pressure, tilt, touch, sync)
+        input_event events[64];
         for(;;) {
-            input_event event;
-            int nbytes = ::read( fd, &event, sizeof( event));
-            if( nbytes == sizeof(event)) {
-                // ok
+            int nbytes = ::read( fd, events, sizeof( events));
+            if( nbytes > 0) {
+                // evdev returns whole events, a pipe (replayed stream) may split one
+                while( nbytes % sizeof( input_event)) {
+                    int n = ::read( fd, (char*) events + nbytes, sizeof( input_event) - nbytes % sizeof( input_event));
+                    if( n > 0)
+                        nbytes += n;
+                    else if( n < 0 && errno != EINTR && errno != EWOULDBLOCK)
+                        return false;
+                }
             }
             else {
-                if (errno != EWOULDBLOCK) {
-                    /* real version needs to handle EINTR correctly */
-                        perror("read");
-                        exit(EXIT_FAILURE);
+                if( nbytes < 0 && errno == EINTR)
+                    continue;
+
+                if( nbytes < 0 && errno == EWOULDBLOCK)
+                    return true;     // end of buffer
+
+                if( nbytes < 0 && errno != ENODEV) {
+                    perror("read");
+                    exit(EXIT_FAILURE);
                 }
 
-                return;     // enf of buffer
+                return false;       // unplugged
             }
 
-            switch( event.type) {
-                default:
-                    cerr << "Unknown event type=" << event.type;
-                    break;
+            for( int i = 0; i < nbytes / (int) sizeof( input_event); ++i)
+                decode( res, events[i], callback);
+        }
+    }
+
+    // one linux event
+    template<class Fn>
+    void decode( Event& res, const input_event& event, Fn callback) {
+        switch( event.type) {
+            default:
+                cerr << "Unknown event type=" << event.type;
+                break;
 
-                case EV_SYN:
-                    // cerr << " " << ::to_s( event.code, syn_code, "code");
-                    callback( res);
-                    break;                
+            case EV_SYN:
+                // cerr << " " << ::to_s( event.code, syn_code, "code");
+                callback( res);
+                break;                
 
-                case EV_KEY:       // hardware button + pen type
-                    BTN_event( res, event);
-                    break;
+            case EV_KEY:       // hardware button + pen type
+                BTN_event( res, event);
+                break;
 
-                case EV_ABS:        // pen + multitouch
-                    ABS_event( res, event);
-                    break;
-            }
+            case EV_ABS:        // pen + multitouch
+                ABS_event( res, event);
+                break;
         }
     }
 
@@ -210,13 +284,63 @@ public:
                 break;
 
             // align wacom device with screen buffer coordinates
-            case ABS_X: res.pos.y = DISPLAYHEIGHT - event.value * WACOM_Y_SCALAR;    break;
-            case ABS_Y: res.pos.x =                 event.value * WACOM_X_SCALAR;    break;
+            case ABS_X: res.pos.*calibration.pen_x.coord = calibration.pen_x( event.value);    break;
+            case ABS_Y: res.pos.*calibration.pen_y.coord = calibration.pen_y( event.value);    break;
+            case ABS_PRESSURE: res.pressure = calibration.pressure( event.value);               break;
+            case ABS_TILT_X: res.tilt.*calibration.tilt_x.coord = calibration.tilt_x( event.value);  break;
+            case ABS_TILT_Y: res.tilt.*calibration.tilt_y.coord = calibration.tilt_y( event.value);  break;
             case ABS_DISTANCE:
                 cerr << "hovering ";
                 //res.tool = 0;
                 break;
 
+            // multitouch (protocol B): slots are updated one at a time, frame is complete at EV_SYN
+            case ABS_MT_SLOT: res.slot = event.value; break;
+            case ABS_MT_TRACKING_ID:
+                if( res.slot >= 0 && res.slot < MAX_FINGERS)
+                    res.fingers[ res.slot].id = event.value;
+                break;
+            case ABS_MT_POSITION_X:
+                if( res.slot >= 0 && res.slot < MAX_FINGERS)
+                    res.fingers[ res.slot].pos.*calibration.touch_x.coord = calibration.touch_x( event.value);
+                break;
+            case ABS_MT_POSITION_Y:
+                if( res.slot >= 0 && res.slot < MAX_FINGERS)
+                    res.fingers[ res.slot].pos.*calibration.touch_y.coord = calibration.touch_y( event.value);
+                break;
+            case ABS_MT_TOUCH_MAJOR:
+            case ABS_MT_TOUCH_MINOR:
+            case ABS_MT_WIDTH_MAJOR:
+            case ABS_MT_WIDTH_MINOR:
+            case ABS_MT_ORIENTATION:
+            case ABS_MT_PRESSURE:
+            case ABS_MT_DISTANCE:
+            case ABS_MT_TOOL_TYPE:
+                break;
+
         } 
     }
+
+private:
+    // rebuild poll set from registry
+    void update() {
+        devices.clear();
+        for( auto& d: registry.list()) {
+            if( d.fd < 0)
+                continue;
+
+            if( d.type == DeviceType::Stylus)
+                calibration.pen( d.fd);
+            else if( d.type == DeviceType::Touch)
+                calibration.touch( d.fd);
+
+            devices.push_back( pollfd{ d.fd, POLLIN });
+        }
+
+        if( registry.hotplug_fd() >= 0)
+            devices.push_back( pollfd{ registry.hotplug_fd(), POLLIN });
+
+        for( auto& w: watched)
+            devices.push_back( pollfd{ w.fd, POLLIN });
+    }
 };
\ No newline at end of file
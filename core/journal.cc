@@ -0,0 +1,166 @@
+// Index files: snapshot + journal (link index, search index)
+//  - snapshot: read through mmap, written whole to path.tmp then renamed over path (atomic replace)
+//  - journal: changes since the snapshot, as records size (uint32) | bytes, each synced when appended;
+//    replayed on open, a torn last record (crash while saving) is dropped
+// a crash between a new snapshot and its journal replacement replays the old journal over the new
+// snapshot: records must be idempotent (eg: a save replaces the whole document)
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// read only mapping of a snapshot file
+class Snapshot {
+    void* map = MAP_FAILED;
+    size_t bytes = 0;
+
+public:
+    Snapshot() = default;
+    Snapshot( const Snapshot&) = delete;
+    Snapshot& operator=( const Snapshot&) = delete;
+
+    ~Snapshot() {
+        unload();
+    }
+
+    // map path, at least min bytes, false if missing (empty index)
+    // who: error messages prefix
+    bool load( const std::string& path, size_t min, const char* who) {
+        unload();
+        int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0)
+            return false;
+
+        struct stat st;
+        if( fstat( fd, &st) == 0 && st.st_size >= (off_t) min)
+            map = mmap( nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close( fd);
+        if( map == MAP_FAILED)
+            throw std::string( who) + ": could not map '" + path + "'\n";
+        bytes = st.st_size;
+        return true;
+    }
+
+    void unload() {
+        if( map != MAP_FAILED)
+            munmap( map, bytes);
+        map = MAP_FAILED;
+        bytes = 0;
+    }
+
+    const uint8_t* data() const { return (const uint8_t*) map; }
+    size_t size() const { return bytes; }
+
+    // write parts (data, size) as the new snapshot path (atomic replace), mapping unchanged
+    static void save( const std::string& path, const std::vector<std::pair<const void*, size_t>>& parts, const char* who) {
+        std::string tmp = path + ".tmp";
+        FILE* f = std::fopen( tmp.c_str(), "wb");
+        if( !f)
+            throw std::string( who) + ": could not create '" + tmp + "'\n";
+        bool ok = true;
+        for( auto& p: parts)
+            ok = ok && (!p.second || std::fwrite( p.first, 1, p.second, f) == p.second);
+        ok = ok && std::fflush( f) == 0 && fsync( fileno( f)) == 0;
+        std::fclose( f);
+        if( !ok || std::rename( tmp.c_str(), path.c_str())) {
+            ::unlink( tmp.c_str());
+            throw std::string( who) + ": could not save '" + path + "'\n";
+        }
+    }
+};
+
+// append only journal of records
+// not thread safe: callers serialize appends and drops
+class Journal {
+    std::string path;
+    const char* who;
+    FILE* file = nullptr;
+    size_t bytes = 0;
+
+public:
+    Journal( const std::string& path, const char* who)
+        : path( path), who( who) {}
+
+    Journal( const Journal&) = delete;
+    Journal& operator=( const Journal&) = delete;
+
+    ~Journal() {
+        if( file)
+            std::fclose( file);
+    }
+
+    // replay records (created if missing): apply( record) returns false for a malformed one,
+    // dropped with what follows as a torn tail; then open for appends
+    template<class Apply>
+    void open( Apply apply) {
+        if( FILE* f = std::fopen( path.c_str(), "rb")) {
+            std::string record;
+            size_t valid = 0;
+            for( uint32_t size; std::fread( &size, 4, 1, f) == 1; ) {
+                record.resize( size);
+                if( std::fread( record.data(), 1, size, f) != size || !apply( record))
+                    break;
+                valid += 4 + size;
+            }
+            std::fclose( f);
+
+            bytes = valid;
+            if( truncate( path.c_str(), valid))
+                throw std::string( who) + ": could not repair '" + path + "'\n";
+        }
+        file = std::fopen( path.c_str(), "ab");
+        if( !file)
+            throw std::string( who) + ": could not open '" + path + "'\n";
+    }
+
+    // bytes of records
+    size_t size() const {
+        return bytes;
+    }
+
+    // record synced to storage when it returns
+    void append( const std::string& record) {
+        uint32_t size = record.size();
+        if( !file || std::fwrite( &size, 4, 1, file) != 1 || std::fwrite( record.data(), 1, size, file) != size
+            || std::fflush( file) || fdatasync( fileno( file)))
+            throw std::string( who) + ": could not write '" + path + "'\n";
+        bytes += 4 + size;
+    }
+
+    // the first covered bytes are in a new snapshot: keep only the records past them (atomic replace)
+    // on failure the journal is unchanged
+    void drop( size_t covered) {
+        std::string rest( bytes - covered, '\0');
+        FILE* f = std::fopen( path.c_str(), "rb");
+        bool ok = f && std::fseek( f, covered, SEEK_SET) == 0 && std::fread( rest.data(), 1, rest.size(), f) == rest.size();
+        if( f)
+            std::fclose( f);
+
+        std::string tmp = path + ".tmp";
+        f = std::fopen( tmp.c_str(), "wb");
+        ok = ok && f && std::fwrite( rest.data(), 1, rest.size(), f) == rest.size() && std::fflush( f) == 0
+             && fdatasync( fileno( f)) == 0;
+        if( f)
+            std::fclose( f);
+        if( !ok || std::rename( tmp.c_str(), path.c_str())) {
+            ::unlink( tmp.c_str());
+            throw std::string( who) + ": could not write '" + path + "'\n";
+        }
+
+        if( file)
+            std::fclose( file);
+        file = std::fopen( path.c_str(), "ab");
+        if( !file)
+            throw std::string( who) + ": could not open '" + path + "'\n";
+        bytes = rest.size();
+    }
+};
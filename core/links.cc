@@ -0,0 +1,369 @@
+// Document link index
+// outgoing links of every document, and the reverse (backlinks) graph
+// on disk (journal.cc):
+//  - a snapshot, read through mmap: names in sorted order, links and backlinks
+//    as compressed rows (offsets + ids), usable as is at startup (nothing parsed)
+//  - a journal of the saves since the snapshot, replayed on open (a few records)
+// a save costs a journal record + the update of the links of that document only;
+// the snapshot is rebuilt once the journal grows past its size
+// links are org mode links found in the texts: [[target]] or [[target][label]]
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "document.cc"
+#include "journal.cc"
+
+// document targets of the links in the texts of pages (sorted, unique)
+// external links (http:, mailto:, ...) are skipped, file: prefix and ::search suffix dropped
+inline std::vector<std::string> document_links( const std::vector<Page>& pages) {
+    std::vector<std::string> targets;
+    for( auto& page: pages)
+        for( auto& t: page.texts) {
+            auto& s = t.text;
+            for( size_t at = s.find( "[["); at != std::string::npos; at = s.find( "[[", at)) {
+                size_t end = s.find( ']', at + 2);
+                if( end == std::string::npos)
+                    break;
+
+                std::string target = s.substr( at + 2, end - at - 2);
+                at = end + 1;
+                if( target.compare( 0, 5, "file:") == 0)
+                    target.erase( 0, 5);
+                else {
+                    auto colon = target.find( ':');
+                    if( colon != std::string::npos && colon < target.find( '/') && target.compare( colon, 2, "::") != 0)
+                        continue;       // external
+                }
+                auto search = target.find( "::");
+                if( search != std::string::npos)
+                    target.erase( search);
+                if( !target.empty())
+                    targets.push_back( std::move( target));
+            }
+        }
+
+    std::sort( targets.begin(), targets.end());
+    targets.erase( std::unique( targets.begin(), targets.end()), targets.end());
+    return targets;
+}
+
+// same, from a notebook file (first indexing of an existing library)
+inline std::vector<std::string> document_links( const NotebookReader& notebook) {
+    std::vector<Page> pages;
+    for( int i = 0; i < notebook.pages(); ++i)
+        pages.push_back( notebook.page( i));
+    return document_links( pages);
+}
+
+// snapshot file layout, all uint32 after the header, ids in name order (binary search):
+//  header | name offsets [nodes + 1] | chars (padded)
+//         | links offsets [nodes + 1] | link targets [edges] | backlinks offsets [nodes + 1] | backlink sources [edges]
+struct LinkIndexHeader {
+    char magic[4] = { 'S', 'L', 'N', 'K' };
+    uint32_t format = 1;
+    uint32_t nodes = 0;
+    uint32_t edges = 0;
+    uint32_t chars = 0;         // bytes of names, padded to 4
+    uint32_t reserved = 0;
+};
+
+class LinkIndex {
+    std::string path;
+
+    // snapshot
+    Snapshot snapshot;
+    uint32_t nodes = 0;
+    const uint32_t* name_at = nullptr;
+    const char* chars = nullptr;
+    const uint32_t* out_at = nullptr;
+    const uint32_t* out_to = nullptr;
+    const uint32_t* in_at = nullptr;
+    const uint32_t* in_from = nullptr;
+
+    // changes since snapshot
+    std::vector<std::string> added;                                 // names of ids >= nodes
+    std::unordered_map<std::string, uint32_t> added_ids;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> changed;    // document => links, replaces the snapshot ones
+    std::unordered_map<uint32_t, std::vector<uint32_t>> incoming;   // target => changed documents linking to it
+
+    Journal journal;
+
+public:
+    // index files: path (snapshot) and path.log (journal), created if missing
+    explicit LinkIndex( const std::string& path)
+        : path( path), journal( path + ".log", "LinkIndex")
+    {
+        load();
+        journal.open( [&]( const std::string& record){ return replay( record); });
+    }
+
+    LinkIndex( const LinkIndex&) = delete;
+    LinkIndex& operator=( const LinkIndex&) = delete;
+
+    // document saved with these link targets (see document_links): journaled, then applied
+    void update( const std::string& doc, const std::vector<std::string>& targets) {
+        std::string record;
+        put_name( record, doc);
+        uint32_t count = targets.size();
+        record.append( (const char*) &count, 4);
+        for( auto& t: targets)
+            put_name( record, t);
+        journal.append( record);
+
+        apply( doc, targets);
+
+        if( journal.size() > std::max<size_t>( 64 << 10, snapshot.size()))
+            compact();
+    }
+
+    // document deleted
+    void remove( const std::string& doc) {
+        update( doc, {});
+    }
+
+    // documents linked from doc
+    std::vector<std::string> links( const std::string& doc) const {
+        std::vector<std::string> out;
+        int64_t d = find( doc);
+        if( d >= 0)
+            each_link( d, [&]( uint32_t t){ out.emplace_back( name( t)); });
+        std::sort( out.begin(), out.end());
+        return out;
+    }
+
+    // documents linking to doc
+    std::vector<std::string> backlinks( const std::string& doc) const {
+        std::vector<std::string> out;
+        int64_t d = find( doc);
+        if( d < 0)
+            return out;
+
+        if( d < nodes)
+            for( auto i = in_at[d]; i < in_at[d + 1]; ++i)
+                if( !changed.count( in_from[i]))
+                    out.emplace_back( name( in_from[i]));
+        auto it = incoming.find( d);
+        if( it != incoming.end())
+            for( auto s: it->second)
+                out.emplace_back( name( s));
+
+        std::sort( out.begin(), out.end());
+        return out;
+    }
+
+    // documents and link targets known
+    size_t size() const {
+        return nodes + added.size();
+    }
+
+    // rebuild the snapshot from the current graph (atomic replace), empty the journal
+    // documents without links and not linked to are dropped
+    void compact() {
+        uint32_t total = size();
+        std::vector<std::vector<uint32_t>> out( total);
+        std::vector<uint32_t> in_count( total, 0);
+        for( uint32_t d = 0; d < total; ++d) {
+            each_link( d, [&]( uint32_t t){ out[d].push_back( t); ++in_count[t]; });
+            std::sort( out[d].begin(), out[d].end());
+        }
+
+        // kept nodes, new ids in name order
+        std::vector<uint32_t> kept;
+        for( uint32_t d = 0; d < total; ++d)
+            if( !out[d].empty() || in_count[d])
+                kept.push_back( d);
+        std::sort( kept.begin(), kept.end(), [&]( uint32_t a, uint32_t b){ return name( a) < name( b); });
+        std::vector<uint32_t> renum( total, UINT32_MAX);
+        for( uint32_t i = 0; i < kept.size(); ++i)
+            renum[ kept[i]] = i;
+
+        LinkIndexHeader h;
+        h.nodes = kept.size();
+        std::vector<uint32_t> name_offsets{ 0};
+        std::string names;
+        std::vector<uint32_t> o_at{ 0}, o_to, i_at( h.nodes + 1, 0), i_from;
+        for( auto d: kept) {
+            auto n = name( d);
+            names.append( n.data(), n.size());
+            name_offsets.push_back( names.size());
+            for( auto t: out[d])
+                o_to.push_back( renum[t]);
+            std::sort( o_to.begin() + o_at.back(), o_to.end());
+            o_at.push_back( o_to.size());
+        }
+        names.resize( (names.size() + 3) & ~3, '\0');
+        h.chars = names.size();
+        h.edges = o_to.size();
+
+        // backlinks: transpose (sources come out sorted)
+        for( auto t: o_to)
+            ++i_at[ t + 1];
+        for( uint32_t i = 0; i < h.nodes; ++i)
+            i_at[i + 1] += i_at[i];
+        i_from.resize( h.edges);
+        auto fill = i_at;
+        for( uint32_t s = 0; s < h.nodes; ++s)
+            for( auto i = o_at[s]; i < o_at[s + 1]; ++i)
+                i_from[ fill[ o_to[i]]++] = s;
+
+        Snapshot::save( path, { { &h, sizeof( h)}, { name_offsets.data(), name_offsets.size() * 4}, { names.data(), names.size()},
+                                { o_at.data(), o_at.size() * 4}, { o_to.data(), o_to.size() * 4},
+                                { i_at.data(), i_at.size() * 4}, { i_from.data(), i_from.size() * 4} }, "LinkIndex");
+
+        // journal is now in the snapshot
+        journal.drop( journal.size());
+
+        unload();
+        added.clear();
+        added_ids.clear();
+        changed.clear();
+        incoming.clear();
+        load();
+    }
+
+private:
+    static void put_name( std::string& out, const std::string& n) {
+        uint16_t len = std::min<size_t>( n.size(), 0xffff);
+        out.append( (const char*) &len, 2);
+        out.append( n.data(), len);
+    }
+
+    std::string_view name( uint32_t id) const {
+        if( id < nodes)
+            return std::string_view( chars + name_at[id], name_at[id + 1] - name_at[id]);
+        return added[ id - nodes];
+    }
+
+    // id of a name, -1 if unknown
+    int64_t find( std::string_view n) const {
+        uint32_t lo = 0, hi = nodes;
+        while( lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            int c = name( mid).compare( n);
+            if( c == 0)
+                return mid;
+            if( c < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        auto it = added_ids.find( std::string( n));
+        return it == added_ids.end() ? -1 : (int64_t) it->second;
+    }
+
+    uint32_t id( const std::string& n) {
+        int64_t i = find( n);
+        if( i >= 0)
+            return i;
+        uint32_t next = nodes + added.size();
+        added.push_back( n);
+        added_ids.emplace( n, next);
+        return next;
+    }
+
+    // current links of d: changed ones, else snapshot ones
+    template<class F>
+    void each_link( uint32_t d, F f) const {
+        auto it = changed.find( d);
+        if( it != changed.end()) {
+            for( auto t: it->second)
+                f( t);
+        }
+        else if( d < nodes)
+            for( auto i = out_at[d]; i < out_at[d + 1]; ++i)
+                f( out_to[i]);
+    }
+
+    void apply( const std::string& doc, const std::vector<std::string>& targets) {
+        uint32_t d = id( doc);
+        std::vector<uint32_t> to;
+        for( auto& t: targets)
+            to.push_back( id( t));
+        std::sort( to.begin(), to.end());
+        to.erase( std::unique( to.begin(), to.end()), to.end());
+
+        auto erase = [&]( uint32_t t) {
+            auto& v = incoming[t];
+            auto it = std::lower_bound( v.begin(), v.end(), d);
+            if( it != v.end() && *it == d)
+                v.erase( it);
+        };
+        auto it = changed.find( d);
+        if( it != changed.end())
+            for( auto t: it->second)
+                erase( t);
+
+        for( auto t: to) {
+            auto& v = incoming[t];
+            v.insert( std::lower_bound( v.begin(), v.end(), d), d);
+        }
+        changed[d] = std::move( to);
+    }
+
+    // map the snapshot, checked against its size (missing => empty index)
+    void load() {
+        if( !snapshot.load( path, sizeof( LinkIndexHeader), "LinkIndex"))
+            return;
+
+        auto h = (const LinkIndexHeader*) snapshot.data();
+        uint64_t expected = sizeof( LinkIndexHeader) + h->chars + 4 * (3 * (uint64_t) h->nodes + 3 + 2 * (uint64_t) h->edges);
+        if( std::memcmp( h->magic, "SLNK", 4) || h->format != 1 || h->chars % 4 || expected != snapshot.size()) {
+            unload();
+            throw "LinkIndex: '" + path + "' is not a link index\n";
+        }
+
+        nodes = h->nodes;
+        name_at = (const uint32_t*) (h + 1);
+        chars = (const char*) (name_at + nodes + 1);
+        out_at = (const uint32_t*) (chars + h->chars);
+        out_to = out_at + nodes + 1;
+        in_at = out_to + h->edges;
+        in_from = in_at + nodes + 1;
+    }
+
+    void unload() {
+        snapshot.unload();
+        nodes = 0;
+    }
+
+    // journal record of a save, false if malformed
+    bool replay( const std::string& record) {
+        size_t at = 0;
+        bool ok = true;
+        auto get = [&]( void* data, size_t n) {
+            ok = ok && at + n <= record.size();
+            if( ok)
+                std::memcpy( data, record.data() + at, n);
+            at += n;
+        };
+        auto get_name = [&] {
+            uint16_t len = 0;
+            get( &len, 2);
+            std::string n;
+            if( ok && at + len <= record.size())
+                n.assign( record.data() + at, len);
+            else
+                ok = false;
+            at += len;
+            return n;
+        };
+
+        std::string doc = get_name();
+        uint32_t count = 0;
+        get( &count, 4);
+        std::vector<std::string> targets;
+        for( uint32_t i = 0; ok && i < count; ++i)
+            targets.push_back( get_name());
+        if( ok)
+            apply( doc, targets);
+        return ok;
+    }
+};
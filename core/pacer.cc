@@ -0,0 +1,250 @@
+// Frame pacing for animations and continuous updates
+// the panel takes 100+ ms per update: sending frames as fast as they are drawn only queues
+// stale updates behind each other. the pacer:
+//  - measures when updates are really on the panel (update markers, waited on a helper thread)
+//  - limits the updates in flight over a same region
+//  - merges the frames that can't go out yet: only the latest pixels are sent
+//  - targets a frame rate, lowered to what the panel sustains (latency / updates in flight)
+// without completion info (memory frame buffer, wait failing), updates are assumed done
+// after the latency measured so far (or the configured default)
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "fb.cc"
+
+struct PacerConfig {
+    int fps                = 20;    // target frame rate
+    int max_in_flight      = 2;     // updates in flight over a same region
+    int default_latency_ms = 150;   // update time until measured
+    waveform_mode waveform = WAVEFORM_MODE_DU;
+};
+
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = PacerConfig;
+
+private:
+    struct Flight {
+        uint32_t marker;
+        Rect area;
+        Clock::time_point sent;
+    };
+
+    FrameBuffer& fb;
+    Config config;
+
+    std::vector<Flight> flying;         // sent, not known on the panel yet
+    std::vector<Rect> pending;          // frames posted, not sent yet (merged)
+    Clock::time_point next_frame;
+    float latency;                      // ms, moving average of measured update times
+
+    uint32_t frames = 0, merged = 0, measured = 0;
+
+    // completion of markers, on a helper thread (the wait ioctl blocks)
+    std::thread waiter;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<uint32_t> waiting;
+    std::vector<std::pair<uint32_t, bool>> completed;  // marker, known complete
+    bool quit = false;
+    int doorbell;                       // eventfd, rung on completions
+
+public:
+    FramePacer( FrameBuffer& fb, Config config = Config{})
+        : fb( fb), config( config), latency( config.default_latency_ms)
+    {
+        doorbell = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if( doorbell < 0)
+            throw std::string( "FramePacer: could not create eventfd\n");
+        if( fb.can_wait())
+            waiter = std::thread( &FramePacer::wait_loop, this);
+    }
+
+    FramePacer( const FramePacer&) = delete;
+    FramePacer& operator=( const FramePacer&) = delete;
+
+    ~FramePacer() {
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            quit = true;
+        }
+        wake.notify_all();
+        if( waiter.joinable())
+            waiter.join();
+        ::close( doorbell);
+    }
+
+    // poll this fd (Input::watch), then call done()
+    int fd() const {
+        return doorbell;
+    }
+
+    // can a frame over areas go out now: frame time reached, and no region
+    // already covered by max_in_flight updates
+    bool ready( const std::vector<Rect>& areas) {
+        auto now = Clock::now();
+        retire( now);
+        if( now < next_frame)
+            return false;
+
+        for( auto& a: areas) {
+            int over = 0;
+            for( auto& f: flying)
+                over += !f.area.intersected( a).empty();
+            if( over >= config.max_in_flight)
+                return false;
+        }
+        return true;
+    }
+
+    // send a frame whose pixels are in the frame buffer (see ready)
+    void send( const std::vector<Rect>& areas) {
+        auto now = Clock::now();
+        for( auto& r: merge( areas)) {
+            uint32_t marker = fb.refresh( r, config.waveform);
+            flying.push_back( Flight{ marker, r, now});
+            if( waiter.joinable()) {
+                std::lock_guard<std::mutex> guard( lock);
+                waiting.push_back( marker);
+            }
+        }
+        wake.notify_all();
+
+        // the panel sustains max_in_flight updates per latency over a region
+        float frame_ms = std::max( 1000.f / std::max( 1, config.fps), latency / std::max( 1, config.max_in_flight));
+        next_frame = now + std::chrono::microseconds( (int64_t) (frame_ms * 1000));
+        ++frames;
+    }
+
+    // frame drawn straight in the frame buffer: sent when ready, else merged with the next ones
+    void post( const std::vector<Rect>& areas) {
+        if( !pending.empty())
+            ++merged;
+        pending.insert( pending.end(), areas.begin(), areas.end());
+        pending = merge( pending);
+        if( ready( pending)) {
+            send( pending);
+            pending.clear();
+        }
+    }
+
+    // updates known on the panel (doorbell rung)
+    void done() {
+        uint64_t count;
+        (void) !::read( doorbell, &count, sizeof( count));
+
+        std::vector<std::pair<uint32_t, bool>> list;
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            list.swap( completed);
+        }
+
+        auto now = Clock::now();
+        for( auto& c: list) {
+            auto it = std::find_if( flying.begin(), flying.end(), [&]( auto& f){ return f.marker == c.first; });
+            if( it == flying.end())
+                continue;
+            if( c.second) {
+                float ms = std::chrono::duration<float, std::milli>( now - it->sent).count();
+                latency = measured++ ? 0.8f * latency + 0.2f * ms : ms;
+            }
+            flying.erase( it);
+        }
+    }
+
+    // event loop idle hook: sends posted frames when due, return ms before next call, -1 if none
+    int idle() {
+        if( pending.empty())
+            return -1;
+        if( ready( pending)) {
+            send( pending);
+            pending.clear();
+            return -1;
+        }
+        return wait_ms( pending);
+    }
+
+    // ms before ready( areas) may become true, 0 => now
+    // held by updates in flight: the oldest one is assumed done after limit(),
+    // the doorbell usually comes first
+    int wait_ms( const std::vector<Rect>& areas) {
+        if( ready( areas))
+            return 0;
+
+        auto now = Clock::now();
+        if( now < next_frame || flying.empty())
+            return ms( next_frame - now);
+        return ms( flying.front().sent + limit() - now);
+    }
+
+    float latency_ms() const { return latency; }
+    size_t in_flight() const { return flying.size(); }
+    uint32_t frames_sent() const { return frames; }
+    uint32_t frames_merged() const { return merged; }
+
+private:
+    static int ms( Clock::duration d) {
+        return std::max<int>( 0, std::chrono::duration_cast<std::chrono::milliseconds>( d).count() + 1);
+    }
+
+    // without completion info, updates are assumed done after the current latency
+    // (also a safety net if a completion is lost)
+    void retire( Clock::time_point now) {
+        auto l = limit();
+        flying.erase( std::remove_if( flying.begin(), flying.end(), [&]( auto& f){ return now - f.sent >= l; }),
+                      flying.end());
+    }
+
+    Clock::duration limit() const {
+        return std::chrono::milliseconds( (int) (waiter.joinable() ? 4 * latency + 1000 : latency));
+    }
+
+    // overlapping rects as one: a region is updated once per frame
+    static std::vector<Rect> merge( std::vector<Rect> rects) {
+        for( size_t i = 0; i < rects.size(); ++i)
+            for( size_t j = i + 1; j < rects.size(); ) {
+                if( !rects[i].intersected( rects[j]).empty()) {
+                    rects[i] = rects[i].united( rects[j]);
+                    rects.erase( rects.begin() + j);
+                    j = i + 1;
+                }
+                else
+                    ++j;
+            }
+        rects.erase( std::remove_if( rects.begin(), rects.end(), []( auto& r){ return r.empty(); }), rects.end());
+        return rects;
+    }
+
+    void wait_loop() {
+        for( ;;) {
+            uint32_t marker;
+            {
+                std::unique_lock<std::mutex> guard( lock);
+                wake.wait( guard, [&]{ return quit || !waiting.empty(); });
+                if( quit)
+                    return;
+                marker = waiting.front();
+            }
+
+            bool ok = fb.wait( marker);
+            {
+                std::lock_guard<std::mutex> guard( lock);
+                waiting.pop_front();
+                completed.emplace_back( marker, ok);
+            }
+            uint64_t one = 1;
+            (void) !::write( doorbell, &one, sizeof( one));
+        }
+    }
+};
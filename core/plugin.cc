@@ -0,0 +1,318 @@
+// Out-of-process plugins
+// a plugin is a separate process drawing into its own shared memory surface (memfd):
+//  - damaged rects are posted in a lock-free single producer / single consumer ring,
+//    stored in the same mapping as the pixels, then an eventfd rings the host
+//  - the host blits only the damaged rects into the frame buffer and refreshes them,
+//    no pixel goes through a socket or a pipe
+//  - a plugin crash only hangs up its liveness pipe: the host reaps it and keeps running
+//
+// plugin process fds (inherited through exec):
+//  3: surface memfd, 4: doorbell eventfd, 5: liveness pipe (write end, never written)
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+
+#include "fb.cc"
+#include "raster.cc"
+
+constexpr uint32_t PLUGIN_MAGIC = 0x4c505453;  // "STPL"
+constexpr uint32_t PLUGIN_ABI   = 1;
+constexpr uint32_t PLUGIN_RING  = 64;           // damage entries, power of 2
+
+constexpr int PLUGIN_FD_SURFACE  = 3;
+constexpr int PLUGIN_FD_DOORBELL = 4;
+constexpr int PLUGIN_FD_ALIVE    = 5;
+
+// ring indexes are shared between processes: must not hide a lock
+static_assert( std::atomic<uint32_t>::is_always_lock_free, "plugin ring needs lock-free 32 bits atomics");
+
+// damaged rect of the plugin surface
+struct PluginDamage {
+    int32_t x, y, width, height;
+    uint32_t waveform;              // waveform_mode, host only accepts a few
+};
+
+// head of the shared mapping, pixels follow at offset pixels
+// header fields are written by the host before the plugin starts, host never reads them back
+struct PluginShared {
+    uint32_t magic;
+    uint32_t abi;
+    int32_t width, height;
+    int32_t stride;                 // bytes per row
+    uint32_t pixels;                // offset of first row
+
+    alignas( 64) std::atomic<uint32_t> head;        // written by plugin
+    alignas( 64) std::atomic<uint32_t> tail;        // written by host
+    std::atomic<uint32_t> overflow;                 // ring was full: refresh whole surface
+    PluginDamage ring[ PLUGIN_RING];
+};
+
+// plugin side: attach to the surface given by the host
+class PluginClient {
+    PluginShared* shared;
+    size_t length;
+    int doorbell;
+
+public:
+    PluginClient() {
+        struct stat st;
+        if( fstat( PLUGIN_FD_SURFACE, &st) || st.st_size < (off_t) sizeof( PluginShared))
+            throw std::string( "Plugin: no surface (not started by a plugin host?)\n");
+        length = st.st_size;
+
+        shared = (PluginShared*) mmap( 0, length, PROT_READ | PROT_WRITE, MAP_SHARED, PLUGIN_FD_SURFACE, 0);
+        if( shared == MAP_FAILED)
+            throw std::string( "Plugin: unable to mmap surface\n");
+
+        if( shared->magic != PLUGIN_MAGIC || shared->abi != PLUGIN_ABI)
+            throw "Plugin: host ABI " + std::to_string( shared->abi) + ", expected " + std::to_string( PLUGIN_ABI) + "\n";
+
+        doorbell = PLUGIN_FD_DOORBELL;
+    }
+
+    PluginClient( const PluginClient&) = delete;
+    PluginClient& operator=( const PluginClient&) = delete;
+
+    ~PluginClient() {
+        munmap( shared, length);
+    }
+
+    // pixels shown by the host, RGB565 like the frame buffer
+    Surface surface() const {
+        return Surface( (uint8_t*) shared + shared->pixels, shared->width, shared->height, shared->stride);
+    }
+
+    // post a damaged rect (surface coordinates), single thread only
+    // a full ring degrades to a refresh of the whole surface
+    void damage( const Rect& r, waveform_mode waveform = WAVEFORM_MODE_DU) {
+        uint32_t head = shared->head.load( std::memory_order_relaxed);
+        uint32_t tail = shared->tail.load( std::memory_order_acquire);
+
+        if( head - tail >= PLUGIN_RING)
+            shared->overflow.store( 1, std::memory_order_release);
+        else {
+            shared->ring[ head % PLUGIN_RING] = PluginDamage{ r.topLeft.x, r.topLeft.y, r.width(), r.height(), (uint32_t) waveform};
+            shared->head.store( head + 1, std::memory_order_release);
+        }
+
+        uint64_t one = 1;
+        if( ::write( doorbell, &one, sizeof( one)) < 0 && errno != EAGAIN)
+            throw std::string( "Plugin: host is gone\n");
+    }
+};
+
+// one plugin process, seen from the host
+struct Plugin {
+    std::string path;
+    Rect area;                      // frame buffer area showing the surface
+    pid_t pid = -1;
+    int doorbell = -1;              // eventfd, readable when damage was posted
+    int alive = -1;                 // pipe read end, hangs up when the process is gone
+    PluginShared* shared = nullptr;
+    size_t length = 0;
+    int width = 0, height = 0, stride = 0;
+    uint32_t pixels = 0;            // host copies: the shared header is not trusted
+
+    bool running() const { return pid > 0; }
+
+    Surface surface() const {
+        return Surface( (uint8_t*) shared + pixels, width, height, stride);
+    }
+};
+
+// host side: launch plugins, composite their damage, survive their crashes
+class PluginHost {
+    FrameBuffer& fb;
+    std::vector<Plugin*> plugins;
+
+public:
+    PluginHost( FrameBuffer& fb)
+        : fb( fb) {}
+
+    PluginHost( const PluginHost&) = delete;
+    PluginHost& operator=( const PluginHost&) = delete;
+
+    ~PluginHost() {
+        for( auto p: plugins) {
+            stop( *p);
+            release( *p);
+            delete p;
+        }
+    }
+
+    // start executable path showing in area of the frame buffer
+    // returned plugin stays valid until the host is destroyed
+    // poll plugin.doorbell => composite(), plugin.alive hang up => reap()
+    Plugin& launch( const std::string& path, const Rect& area, const std::vector<std::string>& args = {}) {
+        auto p = new Plugin;
+        plugins.push_back( p);
+        p->path = path;
+        p->area = area.intersected( fb);
+        p->width = p->area.width();
+        p->height = p->area.height();
+        p->stride = (p->width * 2 + 63) & ~63;              // cache line aligned rows
+        p->pixels = (sizeof( PluginShared) + 4095) & ~4095; // page aligned pixels
+        p->length = p->pixels + (size_t) p->stride * p->height;
+
+        int surface = memfd_create( "stylo-plugin", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if( surface < 0)
+            throw "Plugin: memfd_create failed (errno= " + std::to_string( errno) + ")\n";
+
+        // sealed size: the plugin can not shrink the file under the host mapping (SIGBUS)
+        if( ftruncate( surface, p->length) || fcntl( surface, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+            ::close( surface);
+            throw "Plugin: could not size surface of '" + path + "'\n";
+        }
+
+        p->shared = (PluginShared*) mmap( 0, p->length, PROT_READ | PROT_WRITE, MAP_SHARED, surface, 0);
+        if( p->shared == MAP_FAILED) {
+            p->shared = nullptr;
+            ::close( surface);
+            throw "Plugin: unable to mmap surface of '" + path + "'\n";
+        }
+
+        auto s = p->shared;
+        s->magic = PLUGIN_MAGIC;
+        s->abi = PLUGIN_ABI;
+        s->width = p->width;
+        s->height = p->height;
+        s->stride = p->stride;
+        s->pixels = p->pixels;
+        blit( p->surface(), Point{ 0, 0}, Surface( fb), p->area);    // start from what is shown
+
+        int pipe[2];
+        p->doorbell = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if( p->doorbell < 0 || pipe2( pipe, O_CLOEXEC)) {
+            ::close( surface);
+            throw "Plugin: could not create doorbell of '" + path + "'\n";
+        }
+        p->alive = pipe[0];
+
+        std::vector<char*> argv;
+        argv.push_back( (char*) path.c_str());
+        for( auto& a: args)
+            argv.push_back( (char*) a.c_str());
+        argv.push_back( nullptr);
+
+        p->pid = fork();
+        if( p->pid == 0) {
+            // child: only async-signal-safe calls until exec
+            // dup2 clears close-on-exec on the copies
+            int fds[] = { surface, p->doorbell, pipe[1] };
+            for( int i = 0; i < 3; ++i)
+                fds[i] = fcntl( fds[i], F_DUPFD_CLOEXEC, 10);
+            dup2( fds[0], PLUGIN_FD_SURFACE);
+            dup2( fds[1], PLUGIN_FD_DOORBELL);
+            dup2( fds[2], PLUGIN_FD_ALIVE);
+            execv( path.c_str(), argv.data());
+            _exit( 127);
+        }
+
+        ::close( surface);          // mapping and child keep it alive
+        ::close( pipe[1]);
+        if( p->pid < 0)
+            throw "Plugin: could not fork '" + path + "'\n";
+
+        return *p;
+    }
+
+    // blit and refresh damage posted by plugin
+    // every rect is clipped to the surface: plugin memory is not trusted
+    void composite( Plugin& p) {
+        if( !p.shared)
+            return;
+
+        uint64_t rings;
+        if( ::read( p.doorbell, &rings, sizeof( rings)) < 0 && errno != EAGAIN)
+            return;
+
+        auto s = p.shared;
+        uint32_t tail = s->tail.load( std::memory_order_relaxed);
+        uint32_t head = s->head.load( std::memory_order_acquire);
+        bool full = s->overflow.exchange( 0, std::memory_order_acquire) || head - tail > PLUGIN_RING;
+
+        std::vector<Rect> fast, clean;      // DU / high fidelity updates
+        if( full)
+            clean.push_back( Rect{ Point{ 0, 0}, Point{ p.width, p.height} });
+        else {
+            for( ; tail != head; ++tail) {
+                PluginDamage d = s->ring[ tail % PLUGIN_RING];
+                Rect r{ Point{ d.x, d.y}, Point{ d.x + std::max( d.width, 0), d.y + std::max( d.height, 0)} };
+                r = r.intersected( Rect{ Point{ 0, 0}, Point{ p.width, p.height} });
+                if( r.empty())
+                    continue;
+                (d.waveform == WAVEFORM_MODE_DU ? fast : clean).push_back( r);
+            }
+        }
+        s->tail.store( head, std::memory_order_release);
+
+        Surface screen( fb);
+        for( auto* list: { &fast, &clean })
+            for( auto& r: *list)
+                r = blit( screen, Point{ p.area.topLeft.x + r.topLeft.x, p.area.topLeft.y + r.topLeft.y}, p.surface(), r);
+
+        if( !fast.empty())
+            fb.refresh( fast, WAVEFORM_MODE_DU);
+        if( !clean.empty())
+            fb.refresh( clean, WAVEFORM_MODE_GL16_FAST);
+    }
+
+    // plugin process is gone (liveness pipe hung up): collect its status, clear its area
+    // return exit status as waitpid() gives it, -1 if it was not running
+    int reap( Plugin& p, uint16_t paper = 0xffff) {
+        if( !p.running())
+            return -1;
+
+        kill( p.pid, SIGKILL);      // hung up its pipe but still alive: do not wait for it
+        int status = 0;
+        while( waitpid( p.pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        p.pid = -1;
+
+        if( WIFSIGNALED( status) && WTERMSIG( status) != SIGKILL)
+            std::cerr << "Plugin: '" << p.path << "' crashed (signal " << WTERMSIG( status) << ")" << std::endl;
+        else if( WIFEXITED( status) && WEXITSTATUS( status))
+            std::cerr << "Plugin: '" << p.path << "' failed (exit " << WEXITSTATUS( status) << ")" << std::endl;
+
+        release( p);
+        fill( Surface( fb), p.area, paper);
+        fb.refresh( p.area, WAVEFORM_MODE_GC16);
+        return status;
+    }
+
+    // ask plugin to quit, reap() follows when its pipe hangs up
+    void stop( Plugin& p) {
+        if( p.running())
+            kill( p.pid, SIGTERM);
+    }
+
+private:
+    void release( Plugin& p) {
+        if( p.running()) {
+            kill( p.pid, SIGKILL);
+            waitpid( p.pid, nullptr, 0);
+            p.pid = -1;
+        }
+        if( p.shared)
+            munmap( p.shared, p.length);
+        p.shared = nullptr;
+        for( int* fd: { &p.doorbell, &p.alive })
+            if( *fd >= 0) {
+                ::close( *fd);
+                *fd = -1;
+            }
+    }
+};
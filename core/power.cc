@@ -0,0 +1,264 @@
+// Power aware idle management
+// the event loop only wakes up for input or for a deadline that is really pending:
+//  - EPDC power down delay: long while writing (no power cycle between strokes),
+//    short once idle so the controller powers down right after the last update
+//  - non-urgent updates (clock, status, plugins, background renders) are coalesced,
+//    over a short window while active and a long one while idle
+//  - background workers are suspended while idle
+//  - wakeups and updates per minute are counted, without any timer
+#pragma once
+
+#include <array>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include "fb.cc"
+
+// earliest of two event loop timeouts (ms, -1 => none)
+inline int next_timeout( int a, int b) {
+    if( a < 0) return b;
+    if( b < 0) return a;
+    return std::min( a, b);
+}
+
+// events in the last minute, 1 s buckets aged on use
+class RateCounter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    std::array<uint32_t, 60> buckets{};
+    int64_t last = 0;               // second of the last bucket used
+
+    void advance( Clock::time_point t) {
+        int64_t now = std::chrono::duration_cast<std::chrono::seconds>( t.time_since_epoch()).count();
+        for( int64_t s = std::max( last + 1, now - 59); s <= now; ++s)
+            buckets[ s % 60] = 0;
+        last = std::max( last, now);
+    }
+
+public:
+    void add( Clock::time_point t, uint32_t n = 1) {
+        advance( t);
+        buckets[ last % 60] += n;
+    }
+
+    uint32_t per_minute( Clock::time_point t) {
+        advance( t);
+        uint32_t sum = 0;
+        for( auto b: buckets)
+            sum += b;
+        return sum;
+    }
+};
+
+// lets background workers be paused between work units
+// workers call wait() before each unit, it blocks while suspended
+class WorkerGate {
+    std::mutex lock;
+    std::condition_variable resumed;
+    bool suspended = false;
+
+public:
+    void suspend() {
+        std::lock_guard<std::mutex> guard( lock);
+        suspended = true;
+    }
+
+    void resume() {
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            suspended = false;
+        }
+        resumed.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> guard( lock);
+        resumed.wait( guard, [&]{ return !suspended; });
+    }
+
+    // same, or until released() is true (eg: worker quitting), checked again on wake()
+    void wait( const std::function<bool()>& released) {
+        std::unique_lock<std::mutex> guard( lock);
+        resumed.wait( guard, [&]{ return !suspended || released(); });
+    }
+
+    // waiters check released() again
+    void wake() {
+        { std::lock_guard<std::mutex> guard( lock); }
+        resumed.notify_all();
+    }
+
+    bool paused() {
+        std::lock_guard<std::mutex> guard( lock);
+        return suspended;
+    }
+};
+
+struct PowerConfig {
+    int idle_ms          = 3000;    // no input for that long => idle
+    int active_delay_ms  = 1000;    // EPDC power down delay while active
+    int idle_delay_ms    = 0;       // EPDC power down delay while idle
+    int active_batch_ms  = 100;     // non-urgent updates coalescing window, active
+    int idle_batch_ms    = 2000;    // non-urgent updates coalescing window, idle
+    bool suspend_workers = true;    // pause gate while idle
+};
+
+class PowerManager {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = PowerConfig;
+
+    struct Pending {
+        waveform_mode waveform;
+        std::vector<Rect> rects;
+    };
+
+private:
+    FrameBuffer& fb;
+    Config config;
+    WorkerGate gate;
+
+    bool active = true;
+    Clock::time_point last_input;
+    Clock::time_point flush_at;                 // deadline of pending updates
+    std::vector<Pending> pending;
+
+    RateCounter wakeup_rate, update_rate;
+    uint32_t updates_seen;
+
+public:
+    PowerManager( FrameBuffer& fb, Config config = Config{})
+        : fb( fb), config( config), updates_seen( fb.updates)
+    {
+        last_input = Clock::now();
+        fb.set_powerdown_delay( config.active_delay_ms);
+    }
+
+    PowerManager( const PowerManager&) = delete;
+    PowerManager& operator=( const PowerManager&) = delete;
+
+    ~PowerManager() {
+        gate.resume();
+    }
+
+    // pen/touch/button activity
+    void activity() {
+        last_input = Clock::now();
+        if( active)
+            return;
+
+        active = true;
+        fb.set_powerdown_delay( config.active_delay_ms);
+        gate.resume();
+
+        // pending updates now wait for the short window only
+        auto limit = last_input + std::chrono::milliseconds( config.active_batch_ms);
+        if( !pending.empty() && flush_at > limit)
+            flush_at = limit;
+    }
+
+    // non-urgent update, coalesced with the other ones
+    // urgent ones (ink under the pen) go straight to fb.refresh()
+    void post( const Rect& r, waveform_mode waveform = WAVEFORM_MODE_GL16_FAST) {
+        if( r.empty())
+            return;
+
+        if( pending.empty())
+            flush_at = Clock::now() + std::chrono::milliseconds( active ? config.active_batch_ms : config.idle_batch_ms);
+
+        auto it = std::find_if( pending.begin(), pending.end(), [&]( auto& p){ return p.waveform == waveform; });
+        if( it == pending.end()) {
+            pending.push_back( Pending{ waveform, {}});
+            it = pending.end() - 1;
+        }
+
+        auto& rects = it->rects;
+        for( auto& q: rects)
+            if( !q.intersected( r).empty() || q.united( r).area() <= q.area() + r.area()) {
+                q = q.united( r);
+                return;
+            }
+        rects.push_back( r);
+        if( rects.size() > 16) {                // bound the list: one box for all
+            Rect all = rects[0];
+            for( auto& q: rects)
+                all = all.united( q);
+            rects.assign( 1, all);
+        }
+    }
+
+    // send coalesced updates now (eg: before suspend)
+    void flush() {
+        for( auto& p: pending)
+            fb.refresh( p.rects, p.waveform);
+        pending.clear();
+    }
+
+    // to be called from the event loop (see Input::loop( callback, idle)), after each wake up
+    // return ms before next call is needed, -1 => sleep until next event
+    int idle() {
+        auto now = Clock::now();
+        wakeup_rate.add( now);
+        account( now);
+
+        if( !pending.empty() && now >= flush_at) {
+            flush();
+            account( now);
+        }
+
+        int timeout = -1;
+        if( active) {
+            auto idle_at = last_input + std::chrono::milliseconds( config.idle_ms);
+            if( now >= idle_at)
+                enter_idle();
+            else
+                timeout = ms( idle_at - now);
+        }
+
+        if( !pending.empty())
+            timeout = next_timeout( timeout, ms( flush_at - now));
+        return timeout;
+    }
+
+    bool idling() const {
+        return !active;
+    }
+
+    // background workers: call workers().wait() between work units
+    WorkerGate& workers() {
+        return gate;
+    }
+
+    uint32_t wakeups_per_minute() {
+        return wakeup_rate.per_minute( Clock::now());
+    }
+
+    uint32_t updates_per_minute() {
+        auto now = Clock::now();
+        account( now);
+        return update_rate.per_minute( now);
+    }
+
+private:
+    static int ms( Clock::duration d) {
+        return std::max<int>( 0, std::chrono::duration_cast<std::chrono::milliseconds>( d).count() + 1);
+    }
+
+    void account( Clock::time_point now) {
+        update_rate.add( now, fb.updates - updates_seen);
+        updates_seen = fb.updates;
+    }
+
+    void enter_idle() {
+        active = false;
+        fb.set_powerdown_delay( config.idle_delay_ms);
+        if( config.suspend_workers)
+            gate.suspend();
+    }
+};
@@ -0,0 +1,256 @@
+// Raster operations on 16 bits (RGB565) surfaces
+// frame buffer or off-screen bitmaps: rect fill, blit, paper patterns
+// every op is clipped to the surface, and only touches the requested region
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fb.cc"
+
+// view on a 16 bits pixel buffer
+struct Surface {
+    uint8_t* data;
+    int width, height;
+    int stride;                 // bytes per row
+
+    Surface( uint8_t* data, int width, int height, int stride)
+        : data( data), width( width), height( height), stride( stride) {}
+
+    Surface( const FrameBuffer& fb)
+        : Surface( fb.mem_map, fb.width(), fb.height(), fb.finfo.line_length) {}
+
+    uint16_t* row( int y) const {
+        return (uint16_t*) (data + y * stride);
+    }
+
+    Rect bounds() const {
+        return Rect{ Point{ 0, 0}, Point{ width, height} };
+    }
+};
+
+// off-screen surface, in cached memory
+struct Bitmap: Surface {
+    std::vector<uint16_t> pixels;
+
+    Bitmap( int width, int height, uint16_t color = 0xffff)
+        : Surface( nullptr, width, height, width * 2), pixels( width * height, color)
+    {
+        data = (uint8_t*) pixels.data();
+    }
+
+    Bitmap( const Bitmap& b)
+        : Surface( b), pixels( b.pixels)
+    {
+        data = (uint8_t*) pixels.data();
+    }
+
+    Bitmap& operator=( const Bitmap&) = delete;
+};
+
+// fill count pixels with color
+inline void fill_row( uint16_t* p, int count, uint16_t color) {
+    if( (color >> 8) == (color & 0xff)) {      // black, white, ...
+        std::memset( p, color & 0xff, count * 2);
+        return;
+    }
+
+    int i = 0;
+#if defined(__ARM_NEON)
+    uint16x8_t v = vdupq_n_u16( color);
+    for( ; i + 16 <= count; i += 16) {
+        vst1q_u16( p + i, v);
+        vst1q_u16( p + i + 8, v);
+    }
+#elif defined(__SSE2__)
+    __m128i v = _mm_set1_epi16( (short) color);
+    for( ; i + 16 <= count; i += 16) {
+        _mm_storeu_si128( (__m128i*) (p + i), v);
+        _mm_storeu_si128( (__m128i*) (p + i + 8), v);
+    }
+#endif
+    for( ; i < count; ++i)
+        p[i] = color;
+}
+
+// darken count pixels towards color: p = min( p, color)
+// gray RGB565 values order like their gray level, and the op is idempotent,
+// so overlapping spans of translucent ink (highlighter) do not build up
+inline void darken_row( uint16_t* p, int count, uint16_t color) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    uint16x8_t v = vdupq_n_u16( color);
+    for( ; i + 8 <= count; i += 8)
+        vst1q_u16( p + i, vminq_u16( vld1q_u16( p + i), v));
+#elif defined(__SSE2__)
+    // no unsigned 16 bits min in SSE2: flip sign bit, use signed min
+    const __m128i sign = _mm_set1_epi16( (short) 0x8000);
+    __m128i v = _mm_xor_si128( _mm_set1_epi16( (short) color), sign);
+    for( ; i + 8 <= count; i += 8) {
+        __m128i x = _mm_xor_si128( _mm_loadu_si128( (const __m128i*) (p + i)), sign);
+        _mm_storeu_si128( (__m128i*) (p + i), _mm_xor_si128( _mm_min_epi16( x, v), sign));
+    }
+#endif
+    for( ; i < count; ++i)
+        p[i] = std::min( p[i], color);
+}
+
+// rect fill with any RGB565 color
+inline Rect fill( const Surface& s, const Rect& r, uint16_t color) {
+    auto c = r.intersected( s.bounds());
+    if( c.empty())
+        return c;
+
+    // contiguous rows => single span
+    if( c.topLeft.x == 0 && c.bottomRight.x == s.width && s.stride == s.width * 2) {
+        fill_row( s.row( c.topLeft.y), c.width() * c.height(), color);
+        return c;
+    }
+
+    for( int y = c.topLeft.y; y < c.bottomRight.y; ++y)
+        fill_row( s.row( y) + c.topLeft.x, c.width(), color);
+    return c;
+}
+
+// rect fill with a gray level
+inline Rect fill_gray( const Surface& s, const Rect& r, uint8_t gray) {
+    return fill( s, r, gray_to_rgb565( gray));
+}
+
+// copy area from of src at position to in dst, clipped on both surfaces
+// src and dst may be the same surface (overlapping areas are handled)
+inline Rect blit( const Surface& dst, Point to, const Surface& src, Rect from) {
+    // clip source, and move destination accordingly
+    auto clipped = from.intersected( src.bounds());
+    if( clipped.empty())
+        return clipped;
+    to.x += clipped.topLeft.x - from.topLeft.x;
+    to.y += clipped.topLeft.y - from.topLeft.y;
+    from = clipped;
+
+    // clip destination, and move source accordingly
+    Rect d{ to, Point{ to.x + from.width(), to.y + from.height()} };
+    auto c = d.intersected( dst.bounds());
+    if( c.empty())
+        return c;
+
+    int sx = from.topLeft.x + c.topLeft.x - to.x;
+    int sy = from.topLeft.y + c.topLeft.y - to.y;
+    int bytes = c.width() * 2;
+
+    // same buffer moving down: copy bottom up
+    bool reverse = dst.data == src.data && c.topLeft.y > sy;
+    for( int i = 0; i < c.height(); ++i) {
+        int y = reverse ? c.height() - 1 - i : i;
+        std::memmove( dst.row( c.topLeft.y + y) + c.topLeft.x, src.row( sy + y) + sx, bytes);
+    }
+    return c;
+}
+
+// scaled copy: dst pixel (x, y) of area to shows src pixel (sx + (x - to.x) * step, sy + (y - to.y) * step)
+// nearest neighbour in 16.16 fixed point, pixels outside of src get color outside
+// cost only depends on the size of area to
+inline Rect blit_scaled( const Surface& dst, Rect to, const Surface& src, float sx, float sy, float step, uint16_t outside = 0xffff) {
+    to = to.intersected( dst.bounds());
+    if( to.empty())
+        return to;
+
+    const int32_t dx = (int32_t) (step * 65536);
+    const int32_t x0 = (int32_t) (sx * 65536);
+    std::vector<int32_t> column( to.width());       // source x of each dst column, -1 => outside
+    for( int i = 0, fx = x0; i < to.width(); ++i, fx += dx) {
+        int x = fx >> 16;
+        column[i] = fx >= 0 && x < src.width ? x : -1;
+    }
+
+    for( int y = to.topLeft.y; y < to.bottomRight.y; ++y) {
+        auto d = dst.row( y) + to.topLeft.x;
+        int32_t fy = (int32_t) ((sy + (y - to.topLeft.y) * step) * 65536);
+        int row = fy >> 16;
+        if( fy < 0 || row >= src.height) {
+            fill_row( d, to.width(), outside);
+            continue;
+        }
+
+        auto s = src.row( row);
+        for( int i = 0; i < to.width(); ++i)
+            d[i] = column[i] < 0 ? outside : s[ column[i]];
+    }
+    return to;
+}
+
+// half size copy of src into dst (dst at least src / 2), 2x2 box filter on gray pixels
+inline void downsample( const Surface& dst, const Surface& src) {
+    int w = std::min( dst.width, src.width / 2), h = std::min( dst.height, src.height / 2);
+    for( int y = 0; y < h; ++y) {
+        auto a = src.row( 2 * y), b = src.row( 2 * y + 1);
+        auto d = dst.row( y);
+        for( int x = 0; x < w; ++x) {
+            // green channel holds the gray level on 6 bits
+            int g = ((a[2*x] >> 5) & 0x3f) + ((a[2*x+1] >> 5) & 0x3f) + ((b[2*x] >> 5) & 0x3f) + ((b[2*x+1] >> 5) & 0x3f);
+            d[x] = gray_to_rgb565( (uint8_t) (g * 255 / 252));
+        }
+    }
+}
+
+// paper templates
+enum class Pattern {
+    Ruled,      // horizontal lines
+    Grid,       // horizontal + vertical lines
+    Dotted      // dots at grid intersections
+};
+
+struct PatternSpec {
+    Pattern kind = Pattern::Ruled;
+    int spacing = 60;               // distance between lines (pixels)
+    int thickness = 2;              // line width / dot size
+    uint16_t paper = 0xffff;
+    uint16_t ink = gray_to_rgb565( 0xa0);
+    Point origin{ 0, 0};            // pattern phase, keeps tiles of a page aligned
+};
+
+// paint pattern on area, pattern stays aligned whatever the area
+inline Rect pattern( const Surface& s, const Rect& r, const PatternSpec& p) {
+    auto c = r.intersected( s.bounds());
+    if( c.empty() || p.spacing <= 0)
+        return c;
+
+    // offset of v in the pattern period
+    auto phase = [&]( int v, int o) {
+        int m = (v - o) % p.spacing;
+        return m < 0 ? m + p.spacing : m;
+    };
+
+    // columns covered by vertical lines (or dots), as spans of the first row
+    std::vector<std::pair<int,int>> spans;
+    if( p.kind != Pattern::Ruled)
+        for( int x = c.topLeft.x - phase( c.topLeft.x, p.origin.x); x < c.bottomRight.x; x += p.spacing) {
+            int x0 = std::max( x, c.topLeft.x), x1 = std::min( x + p.thickness, c.bottomRight.x);
+            if( x0 < x1)
+                spans.emplace_back( x0, x1 - x0);
+        }
+
+    for( int y = c.topLeft.y; y < c.bottomRight.y; ++y) {
+        auto row = s.row( y);
+        bool line = phase( y, p.origin.y) < p.thickness;
+
+        if( line && p.kind != Pattern::Dotted) {
+            fill_row( row + c.topLeft.x, c.width(), p.ink);
+            continue;
+        }
+
+        fill_row( row + c.topLeft.x, c.width(), p.paper);
+        if( p.kind == Pattern::Grid || (p.kind == Pattern::Dotted && line))
+            for( auto& sp: spans)
+                fill_row( row + sp.first, sp.second, p.ink);
+    }
+    return c;
+}
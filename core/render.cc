@@ -0,0 +1,241 @@
+// Page rendering
+// same code for the device display and headless export:
+// strokes are rasterized as round capped segments, row spans clipped to the damaged area,
+// inked by their brush (brush.cc); texts are drawn with a built-in 5x7 bitmap font
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "document.cc"
+#include "brush.cc"
+
+// page to surface mapping: surface = (page - origin) * scale
+struct View {
+    float scale = 1;
+    float x = 0, y = 0;         // page position shown at surface origin
+
+    float sx( float px) const { return (px - x) * scale; }
+    float sy( float py) const { return (py - y) * scale; }
+
+    // page area shown by surface rect r
+    Rect page( const Rect& r) const {
+        return Rect{ Point{ (int) std::floor( r.topLeft.x / scale + x), (int) std::floor( r.topLeft.y / scale + y)},
+                     Point{ (int) std::ceil( r.bottomRight.x / scale + x), (int) std::ceil( r.bottomRight.y / scale + y)} };
+    }
+
+    // surface area covered by page rect r
+    Rect surface( const Rect& r) const {
+        return Rect{ Point{ (int) std::floor( sx( r.topLeft.x)), (int) std::floor( sy( r.topLeft.y))},
+                     Point{ (int) std::ceil( sx( r.bottomRight.x)), (int) std::ceil( sy( r.bottomRight.y))} };
+    }
+};
+
+// pixels of row y (centers) at distance <= r of segment (x0,y0)-(x1,y1)
+// capsule is convex => a single span, union of both end discs and the band between them
+inline bool capsule_span( float x0, float y0, float x1, float y1, float r, float y, float& left, float& right) {
+    left = 1e9f;
+    right = -1e9f;
+
+    auto disc = [&]( float cx, float cy) {
+        float dy = y - cy;
+        if( std::fabs( dy) <= r) {
+            float dx = std::sqrt( r * r - dy * dy);
+            left = std::min( left, cx - dx);
+            right = std::max( right, cx + dx);
+        }
+    };
+    disc( x0, y0);
+    disc( x1, y1);
+
+    float dx = x1 - x0, dy = y1 - y0;
+    float len = std::sqrt( dx * dx + dy * dy);
+    if( len > 1e-3f) {
+        float ux = dx / len, uy = dy / len;
+        // along: (x - x0) * ux + (y - y0) * uy in [0, len]
+        // across: -(x - x0) * uy + (y - y0) * ux in [-r, r]
+        float lo = -1e9f, hi = 1e9f;
+        auto bound = [&]( float a, float b, float min, float max) {    // a * x + b in [min, max]
+            if( std::fabs( a) < 1e-6f) {
+                if( b < min || b > max) { lo = 1; hi = 0; }
+                return;
+            }
+            float p = (min - b) / a, q = (max - b) / a;
+            lo = std::max( lo, std::min( p, q));
+            hi = std::min( hi, std::max( p, q));
+        };
+        bound( ux, -x0 * ux + (y - y0) * uy, 0, len);
+        bound( -uy, x0 * uy + (y - y0) * ux, -r, r);
+        if( lo <= hi) {
+            left = std::min( left, lo);
+            right = std::max( right, hi);
+        }
+    }
+    return left <= right;
+}
+
+// segment with round caps, in surface coordinates: span( y, x0, x1) for each row, clipped
+// return the area covered
+template<class Span>
+inline Rect capsule( const Rect& clip, float x0, float y0, float x1, float y1, float r, Span span) {
+    Rect box{ Point{ (int) std::floor( std::min( x0, x1) - r), (int) std::floor( std::min( y0, y1) - r)},
+              Point{ (int) std::ceil( std::max( x0, x1) + r) + 1, (int) std::ceil( std::max( y0, y1) + r) + 1} };
+    box = box.intersected( clip);
+
+    for( int y = box.topLeft.y; y < box.bottomRight.y; ++y) {
+        float left, right;
+        if( !capsule_span( x0, y0, x1, y1, r, y + 0.5f, left, right))
+            continue;
+
+        int a = std::max( (int) std::ceil( left - 0.5f), box.topLeft.x);
+        int b = std::min( (int) std::floor( right - 0.5f) + 1, box.bottomRight.x);
+        if( a < b)
+            span( y, a, b);
+    }
+    return box;
+}
+
+// filled segment with round caps, in surface coordinates
+inline void fill_capsule( const Surface& s, const Rect& clip, float x0, float y0, float x1, float y1, float r, uint16_t color) {
+    capsule( clip.intersected( s.bounds()), x0, y0, x1, y1, r, [&]( int y, int a, int b) {
+        fill_row( s.row( y) + a, b - a, color);
+    });
+}
+
+// incremental stroke rendering: each new sample inks the segment from the previous one
+// same code for wet ink under the pen and for stored strokes
+class BrushStroke {
+    const BrushTable* table;
+    uint8_t color;
+    float width;                // nominal width, surface pixels
+    View view;
+    bool started = false;
+    StrokePoint last;
+    float last_radius;
+
+public:
+    BrushStroke( Brush brush, uint8_t color, uint16_t width, const View& view = View{})
+        : table( &BrushTable::get( brush)), color( color), width( width * view.scale), view( view) {}
+
+    BrushStroke( const Stroke& stroke, const View& view = View{})
+        : BrushStroke( stroke.brush, stroke.color, stroke.width, view) {}
+
+    // ink up to sample p, clipped to surface area clip
+    // return surface area to refresh
+    Rect add( const Surface& s, const Rect& clip, const StrokePoint& p) {
+        float r = std::max( 0.5f, table->radius( width, p));
+        float r0 = started ? last_radius : r;
+        const StrokePoint& from = started ? last : p;
+        float x0 = view.sx( from.x), y0 = view.sy( from.y), x1 = view.sx( p.x), y1 = view.sy( p.y), rm = (r0 + r) / 2;
+        int alpha = table->opacity( from) + table->opacity( p);
+
+        started = true;
+        last = p;
+        last_radius = r;
+
+        // segment away from clip (eg: tiles, see tiles.cc)
+        if( std::max( x0, x1) + rm + 1 < clip.topLeft.x || std::min( x0, x1) - rm - 1 >= clip.bottomRight.x
+            || std::max( y0, y1) + rm + 1 < clip.topLeft.y || std::min( y0, y1) - rm - 1 >= clip.bottomRight.y)
+            return Rect{ Point{ 0, 0}, Point{ 0, 0} };
+
+        // segment ends may differ: average radius and opacity
+        Ink ink( table->blend, color, (alpha + 1) / 2);
+        return capsule( clip.intersected( s.bounds()), x0, y0, x1, y1, rm,
+                        [&]( int y, int a, int b){ ink( s, y, a, b); });
+    }
+};
+
+// stroke with its brush, clipped to surface area clip
+inline void render( const Stroke& stroke, const Surface& s, const Rect& clip, const View& view = View{}) {
+    BrushStroke brush( stroke, view);
+    for( auto& p: stroke.points)
+        brush.add( s, clip, p);
+}
+
+// built-in 5x7 font, printable ASCII: 5 columns per glyph, bit 0 at the top
+// a glyph sits on a 6 x 10 grid of size / 10 pixels (advance 0.6 size, see bounds( Text)), 7 rows above the baseline
+static const uint8_t font_5x7[95][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00}, { 0x00, 0x00, 0x5f, 0x00, 0x00}, { 0x00, 0x07, 0x00, 0x07, 0x00}, { 0x14, 0x7f, 0x14, 0x7f, 0x14},  //  !"#
+    { 0x24, 0x2a, 0x7f, 0x2a, 0x12}, { 0x23, 0x13, 0x08, 0x64, 0x62}, { 0x36, 0x49, 0x55, 0x22, 0x50}, { 0x00, 0x05, 0x03, 0x00, 0x00},  // $%&'
+    { 0x00, 0x1c, 0x22, 0x41, 0x00}, { 0x00, 0x41, 0x22, 0x1c, 0x00}, { 0x14, 0x08, 0x3e, 0x08, 0x14}, { 0x08, 0x08, 0x3e, 0x08, 0x08},  // ()*+
+    { 0x00, 0x50, 0x30, 0x00, 0x00}, { 0x08, 0x08, 0x08, 0x08, 0x08}, { 0x00, 0x60, 0x60, 0x00, 0x00}, { 0x20, 0x10, 0x08, 0x04, 0x02},  // ,-./
+    { 0x3e, 0x51, 0x49, 0x45, 0x3e}, { 0x00, 0x42, 0x7f, 0x40, 0x00}, { 0x42, 0x61, 0x51, 0x49, 0x46}, { 0x21, 0x41, 0x45, 0x4b, 0x31},  // 0123
+    { 0x18, 0x14, 0x12, 0x7f, 0x10}, { 0x27, 0x45, 0x45, 0x45, 0x39}, { 0x3c, 0x4a, 0x49, 0x49, 0x30}, { 0x01, 0x71, 0x09, 0x05, 0x03},  // 4567
+    { 0x36, 0x49, 0x49, 0x49, 0x36}, { 0x06, 0x49, 0x49, 0x29, 0x1e}, { 0x00, 0x36, 0x36, 0x00, 0x00}, { 0x00, 0x56, 0x36, 0x00, 0x00},  // 89:;
+    { 0x08, 0x14, 0x22, 0x41, 0x00}, { 0x14, 0x14, 0x14, 0x14, 0x14}, { 0x00, 0x41, 0x22, 0x14, 0x08}, { 0x02, 0x01, 0x51, 0x09, 0x06},  // <=>?
+    { 0x32, 0x49, 0x79, 0x41, 0x3e}, { 0x7e, 0x11, 0x11, 0x11, 0x7e}, { 0x7f, 0x49, 0x49, 0x49, 0x36}, { 0x3e, 0x41, 0x41, 0x41, 0x22},  // @ABC
+    { 0x7f, 0x41, 0x41, 0x22, 0x1c}, { 0x7f, 0x49, 0x49, 0x49, 0x41}, { 0x7f, 0x09, 0x09, 0x09, 0x01}, { 0x3e, 0x41, 0x49, 0x49, 0x7a},  // DEFG
+    { 0x7f, 0x08, 0x08, 0x08, 0x7f}, { 0x00, 0x41, 0x7f, 0x41, 0x00}, { 0x20, 0x40, 0x41, 0x3f, 0x01}, { 0x7f, 0x08, 0x14, 0x22, 0x41},  // HIJK
+    { 0x7f, 0x40, 0x40, 0x40, 0x40}, { 0x7f, 0x02, 0x0c, 0x02, 0x7f}, { 0x7f, 0x04, 0x08, 0x10, 0x7f}, { 0x3e, 0x41, 0x41, 0x41, 0x3e},  // LMNO
+    { 0x7f, 0x09, 0x09, 0x09, 0x06}, { 0x3e, 0x41, 0x51, 0x21, 0x5e}, { 0x7f, 0x09, 0x19, 0x29, 0x46}, { 0x46, 0x49, 0x49, 0x49, 0x31},  // PQRS
+    { 0x01, 0x01, 0x7f, 0x01, 0x01}, { 0x3f, 0x40, 0x40, 0x40, 0x3f}, { 0x1f, 0x20, 0x40, 0x20, 0x1f}, { 0x3f, 0x40, 0x38, 0x40, 0x3f},  // TUVW
+    { 0x63, 0x14, 0x08, 0x14, 0x63}, { 0x07, 0x08, 0x70, 0x08, 0x07}, { 0x61, 0x51, 0x49, 0x45, 0x43}, { 0x00, 0x7f, 0x41, 0x41, 0x00},  // XYZ[
+    { 0x02, 0x04, 0x08, 0x10, 0x20}, { 0x00, 0x41, 0x41, 0x7f, 0x00}, { 0x04, 0x02, 0x01, 0x02, 0x04}, { 0x40, 0x40, 0x40, 0x40, 0x40},  // \]^_
+    { 0x00, 0x01, 0x02, 0x04, 0x00}, { 0x20, 0x54, 0x54, 0x54, 0x78}, { 0x7f, 0x48, 0x44, 0x44, 0x38}, { 0x38, 0x44, 0x44, 0x44, 0x20},  // `abc
+    { 0x38, 0x44, 0x44, 0x48, 0x7f}, { 0x38, 0x54, 0x54, 0x54, 0x18}, { 0x08, 0x7e, 0x09, 0x01, 0x02}, { 0x08, 0x54, 0x54, 0x54, 0x3c},  // defg
+    { 0x7f, 0x08, 0x04, 0x04, 0x78}, { 0x00, 0x44, 0x7d, 0x40, 0x00}, { 0x20, 0x40, 0x44, 0x3d, 0x00}, { 0x7f, 0x10, 0x28, 0x44, 0x00},  // hijk
+    { 0x00, 0x41, 0x7f, 0x40, 0x00}, { 0x7c, 0x04, 0x18, 0x04, 0x78}, { 0x7c, 0x08, 0x04, 0x04, 0x78}, { 0x38, 0x44, 0x44, 0x44, 0x38},  // lmno
+    { 0x7c, 0x14, 0x14, 0x14, 0x08}, { 0x08, 0x14, 0x14, 0x18, 0x7c}, { 0x7c, 0x08, 0x04, 0x04, 0x08}, { 0x48, 0x54, 0x54, 0x54, 0x20},  // pqrs
+    { 0x04, 0x3f, 0x44, 0x40, 0x20}, { 0x3c, 0x40, 0x40, 0x20, 0x7c}, { 0x1c, 0x20, 0x40, 0x20, 0x1c}, { 0x3c, 0x40, 0x30, 0x40, 0x3c},  // tuvw
+    { 0x44, 0x28, 0x10, 0x28, 0x44}, { 0x0c, 0x50, 0x50, 0x50, 0x3c}, { 0x44, 0x64, 0x54, 0x4c, 0x44}, { 0x00, 0x08, 0x36, 0x41, 0x00},  // xyz{
+    { 0x00, 0x00, 0x7f, 0x00, 0x00}, { 0x00, 0x41, 0x36, 0x08, 0x00}, { 0x02, 0x01, 0x02, 0x04, 0x02},                                  // |}~
+};
+
+// glyph of code point c: accented latin letters as their base letter, others as '?'
+inline const uint8_t* glyph( uint32_t c) {
+    static const char latin[] = "AAAAAAACEEEEIIIIDNOOOOOxOUUUUYPsaaaaaaaceeeeiiiidnooooo/ouuuuypy";    // U+00C0 ... U+00FF
+    if( c >= 0xc0 && c <= 0xff)
+        c = latin[ c - 0xc0];
+    if( c < 0x20 || c > 0x7e)
+        c = '?';
+    return font_5x7[ c - 0x20];
+}
+
+// text in black, clipped to surface area clip
+inline void render( const Text& text, const Surface& s, const Rect& clip, const View& view = View{}) {
+    auto area = clip.intersected( s.bounds());
+    float u = text.size / 10.f;                     // font pixel, in page pixels
+    float x = text.pos.x, y = text.pos.y - 7 * u;   // glyph top left
+
+    // font pixel (column, row) of the glyph at x, y: at least one surface pixel (small scales)
+    auto dot = [&]( int column, int row) {
+        int x0 = (int) std::floor( view.sx( x + column * u)), y0 = (int) std::floor( view.sy( y + row * u));
+        int x1 = std::max( x0 + 1, (int) std::floor( view.sx( x + (column + 1) * u)));
+        int y1 = std::max( y0 + 1, (int) std::floor( view.sy( y + (row + 1) * u)));
+        fill( s, Rect{ Point{ x0, y0}, Point{ x1, y1} }.intersected( area), 0x0000);
+    };
+
+    for( size_t i = 0; i < text.text.size(); ) {
+        uint32_t c = utf8_next( text.text, i);
+        if( c == '\n') {
+            x = text.pos.x;
+            y += text.line_height();
+            continue;
+        }
+        auto g = glyph( c);
+        for( int column = 0; column < 5; ++column)
+            for( int row = 0; g[ column] >> row; ++row)
+                if( g[ column] >> row & 1)
+                    dot( column, row);
+        x += 6 * u;
+    }
+}
+
+// page area shown in surface area clip: paper, then strokes and texts crossing it
+inline void render( const Page& page, const Surface& s, Rect clip, const View& view = View{}, uint16_t paper = 0xffff) {
+    clip = clip.intersected( s.bounds());
+    if( clip.empty())
+        return;
+
+    fill( s, clip, paper);
+
+    auto area = view.page( clip);
+    for( auto& stroke: page.strokes)
+        if( !stroke->bounds().intersected( area).empty())
+            render( *stroke, s, clip, view);
+    for( auto& text: page.texts)
+        if( !bounds( text).intersected( area).empty())
+            render( text, s, clip, view);
+}
@@ -0,0 +1,652 @@
+// Full-text search over notes
+// inverted index: term => documents and word positions, as varint delta coded posting lists
+// on disk (journal.cc):
+//  - a snapshot, read through mmap: sorted document names, sorted terms, posting lists
+//  - a journal of the saves since the snapshot, replayed on open
+// saves are journaled when posted, then indexed on a background thread (tokenize, apply), queries run meanwhile
+// queries: words (all must match), prefix*, "phrase of words" (prefix allowed on its last word)
+// text of a document: typed texts, plus recognized handwriting when a recognizer is given
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "document.cc"
+#include "journal.cc"
+#include "power.cc"
+
+// recognized text of the strokes of a page ("" if none)
+using Handwriting = std::function<std::string( const Page& page)>;
+
+// searchable text of a document: texts of every page, then their recognized handwriting
+inline std::string document_text( const std::vector<Page>& pages, const Handwriting& handwriting = nullptr) {
+    std::string text;
+    for( auto& page: pages) {
+        for( auto& t: page.texts) {
+            text += t.text;
+            text += '\n';
+        }
+        if( handwriting && !page.strokes.empty()) {
+            text += handwriting( page);
+            text += '\n';
+        }
+    }
+    return text;
+}
+
+// words of a text, lowercase (ASCII), bytes >= 0x80 kept as word characters (UTF-8)
+// f( term, position): positions count words, a line break counts as one more (no phrase across lines)
+template<class F>
+inline void tokenize( std::string_view text, F f) {
+    constexpr size_t MAX_TERM = 64;
+    uint32_t position = 0;
+    std::string term;
+    for( size_t i = 0; i <= text.size(); ++i) {
+        unsigned char c = i < text.size() ? text[i] : ' ';
+        if( (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)
+            term += c;
+        else if( c >= 'A' && c <= 'Z')
+            term += c - 'A' + 'a';
+        else {
+            if( !term.empty()) {
+                if( term.size() <= MAX_TERM)
+                    f( term, position);
+                ++position;
+                term.clear();
+            }
+            if( c == '\n')
+                ++position;
+        }
+    }
+}
+
+// posting list coding: per document, doc delta, count, position deltas (varints)
+struct Postings {
+    static void put( std::string& out, uint32_t v) {
+        while( v >= 0x80) {
+            out += (char) (v | 0x80);
+            v >>= 7;
+        }
+        out += (char) v;
+    }
+
+    static uint32_t get( const uint8_t*& p, const uint8_t* end) {
+        uint32_t v = 0;
+        for( int shift = 0; p < end && shift < 35; shift += 7) {
+            uint8_t b = *p++;
+            v |= (uint32_t) (b & 0x7f) << shift;
+            if( !(b & 0x80))
+                break;
+        }
+        return v;
+    }
+
+    // f( doc, positions)
+    template<class F>
+    static void decode( const uint8_t* p, const uint8_t* end, F f) {
+        std::vector<uint32_t> positions;
+        uint32_t doc = 0;
+        while( p < end) {
+            doc += get( p, end);
+            uint32_t count = get( p, end);
+            positions.clear();
+            uint32_t at = 0;
+            for( uint32_t i = 0; i < count && p < end; ++i)
+                positions.push_back( at += get( p, end));
+            f( doc, positions);
+        }
+    }
+};
+
+struct SearchHit {
+    std::string doc;
+    uint32_t matches;           // occurrences of the query words / phrases
+};
+
+// snapshot file layout (uint32 tables, names and terms in sorted order):
+//  header | doc offsets [docs + 1] | doc chars (padded) | term offsets [terms + 1] | term chars (padded)
+//         | posting offsets [terms + 1] | postings (padded)
+struct SearchIndexHeader {
+    char magic[4] = { 'S', 'I', 'D', 'X' };
+    uint32_t format = 1;
+    uint32_t docs = 0;
+    uint32_t terms = 0;
+    uint32_t doc_chars = 0;
+    uint32_t term_chars = 0;
+    uint32_t postings = 0;
+    uint32_t reserved = 0;
+};
+
+class SearchIndex {
+    using Positions = std::vector<uint32_t>;
+    using List = std::vector<std::pair<uint32_t, Positions>>;      // doc => positions, by doc
+
+    std::string path;
+
+    // snapshot
+    Snapshot snapshot;
+    SearchIndexHeader header;
+    const uint32_t* doc_at = nullptr;
+    const char* doc_chars = nullptr;
+    const uint32_t* term_at = nullptr;
+    const char* term_chars = nullptr;
+    const uint32_t* post_at = nullptr;
+    const uint8_t* postings = nullptr;
+
+    // changes since snapshot: saved documents get ids >= header.docs
+    std::unordered_set<uint32_t> replaced;                      // snapshot docs saved again or removed
+    std::vector<std::string> docs;                              // names of the saved documents
+    std::unordered_map<std::string, uint32_t> doc_ids;
+    std::vector<std::vector<std::string>> doc_terms;            // terms of each saved document
+    std::map<std::string, List> live;                           // term => saved documents postings
+
+    mutable std::shared_mutex lock;                             // queries shared, changes exclusive
+
+    // background indexing
+    struct Job {
+        std::string doc;
+        std::string text;
+        bool remove;
+    };
+    std::deque<Job> jobs;
+    std::mutex jobs_lock;
+    std::condition_variable wake, idle;
+    bool busy = false, quit = false;
+    std::atomic<bool> stopping{ false};
+    std::atomic<int> flushing{ 0};              // flush() waiting: the gate does not hold the worker
+    std::thread worker;
+    WorkerGate* gate;
+
+    // posting a save journals it and queues it under journal_lock: once the queue is empty,
+    // every journaled save is in the index (see compaction_point)
+    std::mutex journal_lock;
+    Journal journal;
+
+public:
+    // index files: path (snapshot) and path.log (journal), created if missing
+    // gate: background indexing pauses with the other workers (see PowerManager::workers)
+    explicit SearchIndex( const std::string& path, WorkerGate* gate = nullptr)
+        : path( path), gate( gate), journal( path + ".log", "SearchIndex")
+    {
+        load();
+        journal.open( [&]( const std::string& record){ return replay( record); });
+        worker = std::thread( &SearchIndex::main, this);
+    }
+
+    SearchIndex( const SearchIndex&) = delete;
+    SearchIndex& operator=( const SearchIndex&) = delete;
+
+    // saves still queued are in the journal: indexed on next open
+    ~SearchIndex() {
+        stopping = true;
+        if( gate)
+            gate->wake();
+        {
+            std::lock_guard<std::mutex> guard( jobs_lock);
+            quit = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    // document saved (see document_text): journaled now (throws if it can't be), indexed in the background
+    void update( const std::string& doc, std::string text) {
+        submit( Job{ doc, std::move( text), false});
+    }
+
+    // document deleted
+    void remove( const std::string& doc) {
+        submit( Job{ doc, "", true});
+    }
+
+    // wait until saves posted so far are searchable (even while the workers gate is suspended)
+    void flush() {
+        ++flushing;
+        if( gate)
+            gate->wake();
+        std::unique_lock<std::mutex> guard( jobs_lock);
+        idle.wait( guard, [&]{ return jobs.empty() && !busy; });
+        --flushing;
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> guard( lock);
+        return header.docs - replaced.size() + std::count_if( doc_terms.begin(), doc_terms.end(), []( auto& t){ return !t.empty(); });
+    }
+
+    // documents matching every word / prefix* / "phrase" of query, most matches first
+    std::vector<SearchHit> search( const std::string& query, size_t limit = 50) const {
+        // query elements: words of a phrase, last one may be a prefix
+        struct Element {
+            std::vector<std::string> words;
+            bool prefix = false;
+        };
+        std::vector<Element> elements;
+        for( size_t i = 0; i < query.size(); ) {
+            size_t end;
+            Element e;
+            if( query[i] == '"') {
+                end = query.find( '"', i + 1);
+                if( end == std::string::npos)
+                    end = query.size();
+                std::string_view inner( query.data() + i + 1, end - i - 1);
+                tokenize( inner, [&]( const std::string& t, uint32_t){ e.words.push_back( t); });
+                e.prefix = !inner.empty() && inner.back() == '*';
+                ++end;
+            }
+            else {
+                end = query.find_first_of( " \t\"", i);
+                if( end == std::string::npos)
+                    end = query.size();
+                std::string_view word( query.data() + i, end - i);
+                tokenize( word, [&]( const std::string& t, uint32_t){ e.words.push_back( t); });
+                e.prefix = !word.empty() && word.back() == '*';
+            }
+            if( !e.words.empty())
+                elements.push_back( std::move( e));
+            i = std::max( end, i + 1);
+        }
+        if( elements.empty())
+            return {};
+
+        std::shared_lock<std::shared_mutex> guard( lock);
+
+        // doc => matches, intersected over elements
+        std::unordered_map<uint32_t, uint32_t> result;
+        bool first = true;
+        for( auto& e: elements) {
+            std::unordered_map<uint32_t, uint32_t> found;
+            if( e.words.size() == 1)
+                for( auto& d: postings_of( e.words[0], e.prefix))
+                    found[ d.first] += d.second.size();
+            else
+                phrase( e.words, e.prefix, found);
+
+            if( first)
+                result.swap( found);
+            else
+                for( auto it = result.begin(); it != result.end(); ) {
+                    auto f = found.find( it->first);
+                    if( f == found.end())
+                        it = result.erase( it);
+                    else {
+                        it->second += f->second;
+                        ++it;
+                    }
+                }
+            first = false;
+            if( result.empty())
+                break;
+        }
+
+        std::vector<SearchHit> hits;
+        for( auto& r: result)
+            hits.push_back( SearchHit{ std::string( doc_name( r.first)), r.second});
+        std::sort( hits.begin(), hits.end(), []( auto& a, auto& b){ return a.matches != b.matches ? a.matches > b.matches : a.doc < b.doc; });
+        if( hits.size() > limit)
+            hits.resize( limit);
+        return hits;
+    }
+
+private:
+    void submit( Job job) {
+        std::string record;
+        uint16_t len = std::min<size_t>( job.doc.size(), 0xffff);
+        record.append( (const char*) &len, 2);
+        record.append( job.doc.data(), len);
+        record += (char) job.remove;
+        uint32_t size = job.text.size();
+        record.append( (const char*) &size, 4);
+        record += job.text;
+
+        std::lock_guard<std::mutex> guard( journal_lock);
+        journal.append( record);
+        post( std::move( job));
+    }
+
+    void post( Job job) {
+        {
+            std::lock_guard<std::mutex> guard( jobs_lock);
+            // a newer save of the same document replaces a pending one
+            auto it = std::find_if( jobs.begin(), jobs.end(), [&]( auto& j){ return j.doc == job.doc; });
+            if( it != jobs.end())
+                *it = std::move( job);
+            else
+                jobs.push_back( std::move( job));
+        }
+        wake.notify_all();
+    }
+
+    void main() {
+        for( ;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> guard( jobs_lock);
+                busy = false;
+                idle.notify_all();
+                wake.wait( guard, [&]{ return quit || !jobs.empty(); });
+                if( quit)
+                    return;
+                job = std::move( jobs.front());
+                jobs.pop_front();
+                busy = true;
+            }
+            if( gate)
+                gate->wait( [&]{ return stopping || flushing > 0; });
+            if( stopping)
+                return;
+
+            try {
+                apply( job);
+                if( size_t covered = compaction_point())
+                    compact( covered);
+            }
+            catch( const std::string& e) {
+                std::cerr << e;         // index stays as it was, the save itself is done
+            }
+            catch( const char* e) {
+                std::cerr << e;
+            }
+        }
+    }
+
+    // the document postings are built out of the lock, then swapped in
+    void apply( const Job& job) {
+        std::map<std::string, Positions> terms;
+        if( !job.remove)
+            tokenize( job.text, [&]( const std::string& t, uint32_t p){ terms[t].push_back( p); });
+
+        std::unique_lock<std::shared_mutex> guard( lock);
+        int64_t old = snapshot_doc( job.doc);
+        if( old >= 0)
+            replaced.insert( old);
+
+        auto it = doc_ids.find( job.doc);
+        uint32_t d;
+        if( it == doc_ids.end()) {
+            d = header.docs + docs.size();
+            docs.push_back( job.doc);
+            doc_terms.emplace_back();
+            doc_ids.emplace( job.doc, d);
+        }
+        else
+            d = it->second;
+
+        // drop previous postings of the document
+        auto& own = doc_terms[ d - header.docs];
+        for( auto& t: own) {
+            auto l = live.find( t);
+            auto& list = l->second;
+            list.erase( std::remove_if( list.begin(), list.end(), [&]( auto& p){ return p.first == d; }), list.end());
+            if( list.empty())
+                live.erase( l);
+        }
+        own.clear();
+
+        for( auto& t: terms) {
+            live[ t.first].emplace_back( d, std::move( t.second));
+            own.push_back( t.first);
+        }
+    }
+
+    // journal size the index covers when it is worth compacting, 0 => not now
+    // (journal still small, or saves journaled but not indexed yet)
+    size_t compaction_point() {
+        std::lock_guard<std::mutex> guard( journal_lock);
+        if( journal.size() <= std::max<size_t>( 256 << 10, snapshot.size() / 2))
+            return 0;
+        std::lock_guard<std::mutex> queued( jobs_lock);
+        return jobs.empty() ? journal.size() : 0;
+    }
+
+    // rebuild the snapshot from snapshot + changes (atomic replace), keep only the journal
+    // past covered (saves posted meanwhile, still queued)
+    // on the indexing thread, queries and saves go on meanwhile
+    void compact( size_t covered) {
+        // only the indexing thread changes the index: reading it here needs no lock
+        std::vector<std::pair<std::string_view, uint32_t>> names;          // name, old id
+        for( uint32_t d = 0; d < header.docs; ++d)
+            if( !replaced.count( d))
+                names.emplace_back( doc_name( d), d);
+        for( uint32_t i = 0; i < docs.size(); ++i)
+            if( !doc_terms[i].empty())
+                names.emplace_back( docs[i], header.docs + i);
+        std::sort( names.begin(), names.end());
+
+        std::unordered_map<uint32_t, uint32_t> renum;
+        SearchIndexHeader h;
+        h.docs = names.size();
+        std::vector<uint32_t> d_at{ 0}, t_at{ 0}, p_at{ 0};
+        std::string d_chars, t_chars, blob;
+        for( uint32_t i = 0; i < names.size(); ++i) {
+            renum[ names[i].second] = i;
+            d_chars.append( names[i].first.data(), names[i].first.size());
+            d_at.push_back( d_chars.size());
+        }
+
+        // terms of both sides, in order
+        auto encode = [&]( const std::string& term, List& list) {
+            if( list.empty())
+                return;
+            std::sort( list.begin(), list.end(), []( auto& a, auto& b){ return a.first < b.first; });
+            uint32_t prev = 0;
+            for( auto& d: list) {
+                Postings::put( blob, d.first - prev);
+                prev = d.first;
+                Postings::put( blob, d.second.size());
+                uint32_t at = 0;
+                for( auto p: d.second) {
+                    Postings::put( blob, p - at);
+                    at = p;
+                }
+            }
+            t_chars += term;
+            t_at.push_back( t_chars.size());
+            p_at.push_back( blob.size());
+        };
+
+        uint32_t t = 0;
+        auto l = live.begin();
+        while( t < header.terms || l != live.end()) {
+            int c = t == header.terms ? 1 : l == live.end() ? -1 : term( t).compare( l->first);
+            std::string name( c <= 0 ? term( t) : std::string_view( l->first));
+            List list;
+            if( c <= 0) {
+                snapshot_postings( t++, [&]( uint32_t d, const Positions& p){ list.emplace_back( renum[d], p); });
+            }
+            if( c >= 0) {
+                for( auto& d: l->second)
+                    list.emplace_back( renum[ d.first], d.second);
+                ++l;
+            }
+            encode( name, list);
+        }
+        h.terms = t_at.size() - 1;
+        for( auto* s: { &d_chars, &t_chars, &blob})
+            s->resize( (s->size() + 3) & ~3, '\0');
+        h.doc_chars = d_chars.size();
+        h.term_chars = t_chars.size();
+        h.postings = blob.size();
+
+        Snapshot::save( path, { { &h, sizeof( h)}, { d_at.data(), d_at.size() * 4}, { d_chars.data(), d_chars.size()},
+                                { t_at.data(), t_at.size() * 4}, { t_chars.data(), t_chars.size()},
+                                { p_at.data(), p_at.size() * 4}, { blob.data(), blob.size()} }, "SearchIndex");
+
+        // swap in the new snapshot and journal
+        std::lock_guard<std::mutex> journal_guard( journal_lock);
+        journal.drop( covered);
+        std::unique_lock<std::shared_mutex> guard( lock);
+
+        unload();
+        replaced.clear();
+        docs.clear();
+        doc_ids.clear();
+        doc_terms.clear();
+        live.clear();
+        load();
+    }
+
+    std::string_view doc_name( uint32_t d) const {
+        if( d < header.docs)
+            return std::string_view( doc_chars + doc_at[d], doc_at[d + 1] - doc_at[d]);
+        return docs[ d - header.docs];
+    }
+
+    std::string_view term( uint32_t t) const {
+        return std::string_view( term_chars + term_at[t], term_at[t + 1] - term_at[t]);
+    }
+
+    int64_t snapshot_doc( std::string_view name) const {
+        uint32_t lo = 0, hi = header.docs;
+        while( lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            int c = doc_name( mid).compare( name);
+            if( c == 0)
+                return mid;
+            if( c < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return -1;
+    }
+
+    // first snapshot term >= word
+    uint32_t lower_term( std::string_view word) const {
+        uint32_t lo = 0, hi = header.terms;
+        while( lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if( term( mid) < word) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // snapshot postings of term t, replaced documents skipped
+    template<class F>
+    void snapshot_postings( uint32_t t, F f) const {
+        Postings::decode( postings + post_at[t], postings + post_at[t + 1], [&]( uint32_t d, const Positions& p) {
+            if( !replaced.count( d))
+                f( d, p);
+        });
+    }
+
+    // doc => positions of word (or of every term starting with word), snapshot + changes
+    std::unordered_map<uint32_t, Positions> postings_of( const std::string& word, bool prefix) const {
+        std::unordered_map<uint32_t, Positions> out;
+        auto add = [&]( uint32_t d, const Positions& p) {
+            auto& v = out[d];
+            v.insert( v.end(), p.begin(), p.end());
+        };
+        auto matches = [&]( std::string_view t) {
+            return prefix ? t.compare( 0, word.size(), word) == 0 : t == word;
+        };
+
+        for( uint32_t t = lower_term( word); t < header.terms && matches( term( t)); ++t)
+            snapshot_postings( t, add);
+        for( auto l = live.lower_bound( word); l != live.end() && matches( l->first); ++l)
+            for( auto& d: l->second)
+                add( d.first, d.second);
+
+        if( prefix)
+            for( auto& o: out)
+                std::sort( o.second.begin(), o.second.end());
+        return out;
+    }
+
+    // occurrences of words at consecutive positions
+    void phrase( const std::vector<std::string>& words, bool prefix, std::unordered_map<uint32_t, uint32_t>& found) const {
+        std::vector<std::unordered_map<uint32_t, Positions>> lists;
+        for( size_t i = 0; i < words.size(); ++i) {
+            lists.push_back( postings_of( words[i], prefix && i + 1 == words.size()));
+            if( lists.back().empty())
+                return;
+        }
+
+        for( auto& d: lists[0]) {
+            std::vector<const Positions*> other;
+            for( size_t i = 1; i < lists.size(); ++i) {
+                auto it = lists[i].find( d.first);
+                if( it == lists[i].end())
+                    break;
+                other.push_back( &it->second);
+            }
+            if( other.size() + 1 != lists.size())
+                continue;
+
+            uint32_t n = 0;
+            for( auto p: d.second) {
+                bool all = true;
+                for( size_t i = 0; all && i < other.size(); ++i)
+                    all = std::binary_search( other[i]->begin(), other[i]->end(), p + i + 1);
+                n += all;
+            }
+            if( n)
+                found[ d.first] += n;
+        }
+    }
+
+    // map the snapshot, checked against its size (missing => empty index)
+    void load() {
+        header = SearchIndexHeader{};
+        if( !snapshot.load( path, sizeof( SearchIndexHeader), "SearchIndex"))
+            return;
+
+        auto h = (const SearchIndexHeader*) snapshot.data();
+        uint64_t expected = sizeof( SearchIndexHeader) + 4 * ((uint64_t) h->docs + 1) + h->doc_chars
+                            + 8 * ((uint64_t) h->terms + 1) + h->term_chars + h->postings;
+        if( std::memcmp( h->magic, "SIDX", 4) || h->format != 1 || (h->doc_chars | h->term_chars) % 4 || expected != snapshot.size()) {
+            unload();
+            throw "SearchIndex: '" + path + "' is not a search index\n";
+        }
+
+        header = *h;
+        doc_at = (const uint32_t*) (h + 1);
+        doc_chars = (const char*) (doc_at + header.docs + 1);
+        term_at = (const uint32_t*) (doc_chars + header.doc_chars);
+        term_chars = (const char*) (term_at + header.terms + 1);
+        post_at = (const uint32_t*) (term_chars + header.term_chars);
+        postings = (const uint8_t*) (post_at + header.terms + 1);
+    }
+
+    void unload() {
+        snapshot.unload();
+        header = SearchIndexHeader{};
+    }
+
+    // journal record of a save, false if malformed
+    bool replay( const std::string& record) {
+        uint32_t size = record.size();
+        if( size < 7)
+            return false;
+        uint16_t len;
+        std::memcpy( &len, record.data(), 2);
+        if( (uint32_t) (2 + len + 5) > size)
+            return false;
+        Job job;
+        job.doc.assign( record.data() + 2, len);
+        job.remove = record[ 2 + len];
+        uint32_t text;
+        std::memcpy( &text, record.data() + 3 + len, 4);
+        if( 7 + len + (uint64_t) text != size)
+            return false;
+        job.text.assign( record.data() + 7 + len, text);
+
+        apply( job);
+        return true;
+    }
+};
@@ -0,0 +1,284 @@
+// Stroke selection and transform
+// strokes are picked with a lasso (or a rect), then moved / scaled / rotated:
+//  - while dragging, only the outline of the selection is drawn over a snapshot of the screen,
+//    so a preview costs the same for 1 or 10000 selected strokes
+//  - on release, strokes are replaced through the history (undoable), and the page is
+//    re-rendered only on the old and new areas of the selection
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "document.cc"
+#include "render.cc"
+#include "history.cc"
+#include "tiles.cc"
+
+// 2D affine transform: x' = a x + c y + tx, y' = b x + d y + ty
+struct Affine {
+    float a = 1, b = 0, c = 0, d = 1;
+    float tx = 0, ty = 0;
+
+    static Affine move( float dx, float dy) {
+        return Affine{ 1, 0, 0, 1, dx, dy};
+    }
+
+    static Affine scale( float sx, float sy, float cx, float cy) {
+        return Affine{ sx, 0, 0, sy, cx - sx * cx, cy - sy * cy};
+    }
+
+    static Affine rotate( float angle, float cx, float cy) {
+        float cs = std::cos( angle), sn = std::sin( angle);
+        return Affine{ cs, sn, -sn, cs, cx - cs * cx + sn * cy, cy - sn * cx - cs * cy};
+    }
+
+    // this transform, followed by t
+    Affine then( const Affine& t) const {
+        return Affine{ t.a * a + t.c * b, t.b * a + t.d * b,
+                       t.a * c + t.c * d, t.b * c + t.d * d,
+                       t.a * tx + t.c * ty + t.tx, t.b * tx + t.d * ty + t.ty };
+    }
+
+    float x( float px, float py) const { return a * px + c * py + tx; }
+    float y( float px, float py) const { return b * px + d * py + ty; }
+
+    // length scale (geometric mean of the axes scales)
+    float stretch() const {
+        return std::sqrt( std::fabs( a * d - b * c));
+    }
+
+    bool identity() const {
+        return a == 1 && b == 0 && c == 0 && d == 1 && tx == 0 && ty == 0;
+    }
+
+    // bounding box of transformed rect
+    Rect map( const Rect& r) const {
+        float xs[4], ys[4];
+        corners( r, xs, ys);
+        return Rect{ Point{ (int) std::floor( *std::min_element( xs, xs + 4)), (int) std::floor( *std::min_element( ys, ys + 4))},
+                     Point{ (int) std::ceil( *std::max_element( xs, xs + 4)) + 1, (int) std::ceil( *std::max_element( ys, ys + 4)) + 1} };
+    }
+
+    // transformed corners of r, clockwise from top left
+    void corners( const Rect& r, float* xs, float* ys) const {
+        float px[4] = { (float) r.topLeft.x, (float) r.bottomRight.x, (float) r.bottomRight.x, (float) r.topLeft.x };
+        float py[4] = { (float) r.topLeft.y, (float) r.topLeft.y, (float) r.bottomRight.y, (float) r.bottomRight.y };
+        for( int i = 0; i < 4; ++i) {
+            xs[i] = x( px[i], py[i]);
+            ys[i] = y( px[i], py[i]);
+        }
+    }
+};
+
+// closed selection path, page coordinates
+class Lasso {
+    std::vector<Point> points;
+    Rect box{ Point{ 0, 0}, Point{ 0, 0} };
+
+public:
+    Lasso() = default;
+
+    // rect selection
+    explicit Lasso( const Rect& r)
+        : points{ r.topLeft, Point{ r.bottomRight.x, r.topLeft.y}, r.bottomRight, Point{ r.topLeft.x, r.bottomRight.y} },
+          box( r) {}
+
+    void add( Point p) {
+        Rect dot{ p, Point{ p.x + 1, p.y + 1} };
+        box = points.empty() ? dot : box.united( dot);
+        points.push_back( p);
+    }
+
+    const Rect& bounds() const {
+        return box;
+    }
+
+    // even-odd rule, path closed from last to first point
+    bool contains( float x, float y) const {
+        if( points.size() < 3 || x < box.topLeft.x || y < box.topLeft.y || x >= box.bottomRight.x || y >= box.bottomRight.y)
+            return false;
+
+        bool inside = false;
+        for( size_t i = 0, j = points.size() - 1; i < points.size(); j = i++) {
+            auto& p = points[i];
+            auto& q = points[j];
+            if( (p.y > y) != (q.y > y) && x < q.x + (float) (p.x - q.x) * (y - q.y) / (p.y - q.y))
+                inside = !inside;
+        }
+        return inside;
+    }
+};
+
+// strokes with at least share of their points inside the lasso
+inline std::vector<uint32_t> select_strokes( const Page& page, const Lasso& lasso, float share = 0.5f) {
+    std::vector<uint32_t> selected;
+    for( uint32_t i = 0; i < page.strokes.size(); ++i) {
+        auto& s = *page.strokes[i];
+        if( s.points.empty() || s.bounds().intersected( lasso.bounds()).empty())
+            continue;
+
+        size_t inside = 0;
+        for( auto& p: s.points)
+            inside += lasso.contains( p.x, p.y);
+        if( inside >= share * s.points.size())
+            selected.push_back( i);
+    }
+    return selected;
+}
+
+inline StrokeRef transformed( const Stroke& s, const Affine& t) {
+    auto r = std::make_shared<Stroke>( s);
+    for( auto& p: r->points) {
+        float x = t.x( p.x, p.y), y = t.y( p.x, p.y);
+        p.x = (int16_t) std::lround( std::min( 32767.f, std::max( -32768.f, x)));
+        p.y = (int16_t) std::lround( std::min( 32767.f, std::max( -32768.f, y)));
+    }
+    r->width = (uint16_t) std::max( 1l, std::min( 65535l, std::lround( s.width * t.stretch())));
+    return r;
+}
+
+// selected strokes of a page, and their pending transform
+class Selection {
+    std::vector<uint32_t> indices;
+    Rect area{ Point{ 0, 0}, Point{ 0, 0} };    // page area of selected strokes
+
+public:
+    Affine transform;
+
+    Selection() = default;
+
+    Selection( const Page& page, std::vector<uint32_t> strokes)
+        : indices( std::move( strokes))
+    {
+        for( size_t i = 0; i < indices.size(); ++i) {
+            auto b = page.strokes[ indices[i]]->bounds();
+            area = i ? area.united( b) : b;
+        }
+    }
+
+    bool empty() const { return indices.empty(); }
+    size_t size() const { return indices.size(); }
+    const std::vector<uint32_t>& strokes() const { return indices; }
+
+    // page area before / after transform
+    const Rect& bounds() const { return area; }
+    Rect target() const { return transform.map( area); }
+
+    float cx() const { return (area.topLeft.x + area.bottomRight.x) / 2.f; }
+    float cy() const { return (area.topLeft.y + area.bottomRight.y) / 2.f; }
+
+    // apply transform to strokes through history
+    // return the page areas to re-render: old and new place of the selection
+    template<class Pages>
+    std::vector<Rect> commit( Pages& pages, int page, History& history) {
+        if( empty() || transform.identity())
+            return {};
+
+        std::vector<std::pair<uint32_t, StrokeRef>> changes;
+        changes.reserve( indices.size());
+        Rect after{ Point{ 0, 0}, Point{ 0, 0} };
+        for( auto i: indices) {
+            auto s = transformed( *pages[ page].strokes[i], transform);
+            auto b = s->bounds();
+            after = after.empty() ? b : after.united( b);
+            changes.emplace_back( i, std::move( s));
+        }
+        history.replace_strokes( pages, page, changes);
+
+        std::vector<Rect> damage{ area, after};
+        area = after;
+        transform = Affine{};
+        return damage;
+    }
+};
+
+// outline preview of a selection being dragged
+// the screen is restored from a snapshot under the previous outline, then the new one is drawn
+class SelectionPreview {
+    FrameBuffer& fb;
+    Bitmap backdrop;            // screen without outline
+    View view;
+    struct Span { int y, x0, x1; };
+    std::vector<Span> spans;    // outline pixels, restored from backdrop
+    std::vector<Rect> drawn;    // screen areas covered by the outline
+    uint16_t color;
+
+public:
+    SelectionPreview( FrameBuffer& fb, const View& view = View{}, uint8_t gray = 0x40)
+        : fb( fb), backdrop( fb.width(), fb.height()), view( view), color( gray_to_rgb565( gray))
+    {
+        blit( backdrop, Point{ 0, 0}, Surface( fb), fb);
+    }
+
+    // outline of selection under its current transform, fast refresh of old + new outline
+    void show( const Selection& selection) {
+        Surface screen( fb);
+        auto areas = erase();
+
+        float xs[4], ys[4];
+        selection.transform.corners( selection.bounds(), xs, ys);
+        for( int i = 0; i < 4; ++i) {
+            int j = (i + 1) % 4;
+            float x0 = view.sx( xs[i]), y0 = view.sy( ys[i]), x1 = view.sx( xs[j]), y1 = view.sy( ys[j]);
+            Rect box = capsule( screen.bounds(), x0, y0, x1, y1, 1.5f, [&]( int y, int a, int b) {
+                fill_row( screen.row( y) + a, b - a, color);
+                spans.push_back( Span{ y, a, b});
+            });
+            drawn.push_back( box);
+            areas.push_back( box);
+        }
+        fb.refresh( areas, WAVEFORM_MODE_DU);
+    }
+
+    // remove outline (eg: drag cancelled)
+    void hide() {
+        auto areas = erase();
+        fb.refresh( areas, WAVEFORM_MODE_DU);
+    }
+
+    // page was re-rendered in area (screen coordinates): keep snapshot in sync
+    void update( const Rect& area) {
+        blit( backdrop, area.topLeft, Surface( fb), area);
+    }
+
+private:
+    std::vector<Rect> erase() {
+        Surface screen( fb);
+        for( auto& s: spans)
+            std::memcpy( screen.row( s.y) + s.x0, backdrop.row( s.y) + s.x0, (s.x1 - s.x0) * 2);
+        spans.clear();
+
+        std::vector<Rect> areas;
+        areas.swap( drawn);
+        return areas;
+    }
+};
+
+// re-render page areas (page coordinates) after an edit, and refresh them
+inline void redraw( FrameBuffer& fb, const Page& page, const std::vector<Rect>& areas, const View& view = View{},
+                    waveform_mode waveform = WAVEFORM_MODE_GL16_FAST) {
+    Surface screen( fb);
+    std::vector<Rect> damage;
+    for( auto& a: areas) {
+        auto r = view.surface( a).intersected( screen.bounds());
+        if( r.empty())
+            continue;
+        render( page, screen, r, view);
+        damage.push_back( r);
+    }
+    fb.refresh( damage, waveform);
+}
+
+// same, areas rendered in tiles over the pool
+inline void redraw( FrameBuffer& fb, const Page& page, const std::vector<Rect>& areas, TilePool& pool, const View& view = View{},
+                    waveform_mode waveform = WAVEFORM_MODE_GL16_FAST) {
+    std::vector<Rect> rects;
+    for( auto& a: areas)
+        rects.push_back( view.surface( a));
+    fb.refresh( render( page, Surface( fb), rects, pool, view), waveform);
+}
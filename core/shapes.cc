@@ -0,0 +1,477 @@
+// Shape recognition for technical drawing
+// the stroke being drawn is fed sample by sample: line (least squares) and
+// area moments (ellipse) sums are updated in O(1) per sample,
+// so on pen up (or hold) only the final solve, a corner search and the snapping are left.
+// shapes: line, polyline / polygon, rectangle, circle, ellipse;
+// snapped to the paper grid and to round angles, then they replace the freehand stroke
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+#include "fb.cc"
+#include "document.cc"
+#include "history.cc"
+
+enum class Shape {
+    None,
+    Line,
+    Polyline,           // open or closed (polygon)
+    Rectangle,
+    Circle,
+    Ellipse
+};
+
+struct ShapeConfig {
+    int grid          = 60;     // grid spacing (see PatternSpec), 0 => no grid snapping
+    Point origin{ 0, 0};        // grid phase
+    float grid_snap   = 12;     // max distance (pixels) to snap a point onto the grid
+    float angle_step  = 15;     // degrees, 0 => no angle snapping
+    float angle_snap  = 6;      // max deviation (degrees) to snap an angle
+    float tolerance   = 0.035f; // max fit error, relative to the shape size
+    int max_corners   = 8;      // polylines with more corners stay freehand
+    int hold_ms       = 700;    // pen held still that long => recognize
+    float hold_radius = 6;      // pixels of jitter allowed while holding
+};
+
+class ShapeRecognizer {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = ShapeConfig;
+
+    struct Vec {
+        float x, y;
+    };
+
+    struct Result {
+        Shape shape = Shape::None;
+        StrokeRef stroke;       // exact shape, style of the freehand stroke
+        float error = 0;        // fit error, relative to the shape size
+    };
+
+private:
+    Config config;
+    std::vector<Vec> points;
+    float length = 0;
+    uint64_t pressure = 0;
+
+    // line fit sums (relative to first point, for precision)
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+    // area moments of the polygon closed by the pen path (Green), relative to first point
+    double a2 = 0, mx = 0, my = 0, mxx = 0, mxy = 0, myy = 0;
+
+    Vec anchor{};
+    Clock::time_point anchor_time;
+
+public:
+    ShapeRecognizer( Config config = Config{})
+        : config( config) {}
+
+    void reset() {
+        *this = ShapeRecognizer( config);
+    }
+
+    // next sample of the stroke being drawn
+    void add( const StrokePoint& p) {
+        Vec v{ (float) p.x, (float) p.y };
+        if( points.empty()) {
+            anchor = v;
+            anchor_time = Clock::now();
+        }
+        else {
+            auto& q = points.back();
+            length += std::hypot( v.x - q.x, v.y - q.y);
+            edge( local( q), local( v));
+
+            if( std::hypot( v.x - anchor.x, v.y - anchor.y) > config.hold_radius) {
+                anchor = v;
+                anchor_time = Clock::now();
+            }
+        }
+        points.push_back( v);
+        pressure += p.pressure;
+
+        auto l = local( v);
+        sx += l.x; sy += l.y;
+        sxx += l.x * l.x; sxy += l.x * l.y; syy += l.y * l.y;
+    }
+
+    // pen kept still long enough
+    bool held( Clock::time_point now = Clock::now()) const {
+        return points.size() > 2 && now - anchor_time >= std::chrono::milliseconds( config.hold_ms);
+    }
+
+    // best shape for the samples so far, styled as stroke
+    Result recognize( const Stroke& style) const {
+        Result r;
+        if( points.size() < 3 || length < 3 * config.hold_radius)
+            return r;
+
+        float diagonal = std::hypot( bounds_w(), bounds_h());
+        auto& first = points.front();
+        auto& last = points.back();
+        bool closed = std::hypot( last.x - first.x, last.y - first.y) < std::max( 0.15f * diagonal, 2 * config.hold_radius)
+                      && length > 2 * diagonal;
+
+        std::vector<Vec> shape;
+        if( !closed) {
+            if( line( shape, r.error))
+                r.shape = Shape::Line;
+            else if( polyline( shape, false, r.error))
+                r.shape = Shape::Polyline;
+        }
+        else {
+            if( rectangle( shape, r.error))
+                r.shape = Shape::Rectangle;
+            else if( ellipse( shape, r.error, r.shape))
+                ;
+            else if( polyline( shape, true, r.error))
+                r.shape = Shape::Polyline;
+        }
+
+        if( r.shape == Shape::None)
+            return r;
+
+        auto s = std::make_shared<Stroke>();
+        s->brush = style.brush;
+        s->color = style.color;
+        s->width = style.width;
+        uint16_t p = (uint16_t) (pressure / points.size());
+        for( auto& v: shape)
+            s->points.push_back( StrokePoint{ (int16_t) std::lround( v.x), (int16_t) std::lround( v.y), p, 0, 0});
+        r.stroke = std::move( s);
+        return r;
+    }
+
+private:
+    Vec local( Vec v) const {
+        return Vec{ v.x - points.front().x, v.y - points.front().y };
+    }
+
+    // polygon moments, edge from p to q
+    void edge( Vec p, Vec q) {
+        double c = (double) p.x * q.y - (double) q.x * p.y;
+        a2 += c;
+        mx += (p.x + q.x) * c;
+        my += (p.y + q.y) * c;
+        mxx += (p.x * p.x + p.x * q.x + q.x * q.x) * c;
+        myy += (p.y * p.y + p.y * q.y + q.y * q.y) * c;
+        mxy += (p.x * q.y + 2 * p.x * p.y + 2 * q.x * q.y + q.x * p.y) * c;
+    }
+
+    float bounds_w() const {
+        auto mm = std::minmax_element( points.begin(), points.end(), []( auto& a, auto& b){ return a.x < b.x; });
+        return mm.second->x - mm.first->x;
+    }
+
+    float bounds_h() const {
+        auto mm = std::minmax_element( points.begin(), points.end(), []( auto& a, auto& b){ return a.y < b.y; });
+        return mm.second->y - mm.first->y;
+    }
+
+    // snapping
+
+    float snap_angle( float angle) const {
+        if( config.angle_step <= 0)
+            return angle;
+        float step = config.angle_step * (float) M_PI / 180;
+        float snapped = std::round( angle / step) * step;
+        return std::fabs( snapped - angle) <= config.angle_snap * (float) M_PI / 180 ? snapped : angle;
+    }
+
+    float snap_length( float l) const {
+        if( config.grid <= 0)
+            return l;
+        float snapped = std::round( l / config.grid) * config.grid;
+        return std::fabs( snapped - l) <= config.grid_snap && snapped > 0 ? snapped : l;
+    }
+
+    Vec snap_point( Vec v) const {
+        if( config.grid <= 0)
+            return v;
+        float ox = config.origin.x, oy = config.origin.y;
+        Vec g{ ox + std::round( (v.x - ox) / config.grid) * config.grid, oy + std::round( (v.y - oy) / config.grid) * config.grid };
+        return std::hypot( g.x - v.x, g.y - v.y) <= config.grid_snap ? g : v;
+    }
+
+    // fits
+
+    bool line( std::vector<Vec>& shape, float& error) const {
+        double n = points.size();
+        double cx = sx / n, cy = sy / n;
+        double vxx = sxx / n - cx * cx, vyy = syy / n - cy * cy, vxy = sxy / n - cx * cy;
+
+        // smallest eigenvalue of covariance: mean squared distance to the line
+        double tr = vxx + vyy, det = vxx * vyy - vxy * vxy;
+        double small = tr / 2 - std::sqrt( std::max( 0.0, tr * tr / 4 - det));
+        float span = std::hypot( points.back().x - points.front().x, points.back().y - points.front().y);
+        error = (float) std::sqrt( std::max( 0.0, small)) / std::max( span, 1.f);
+        if( error > config.tolerance)
+            return false;
+
+        Vec a = snap_point( points.front());
+        float angle = snap_angle( std::atan2( points.back().y - a.y, points.back().x - a.x));
+        float l = snap_length( std::hypot( points.back().x - a.x, points.back().y - a.y));
+        Vec b{ a.x + l * std::cos( angle), a.y + l * std::sin( angle) };
+
+        // end on the grid when the snapped direction goes through a grid point nearby
+        Vec g = snap_point( b);
+        if( std::fabs( (g.x - a.x) * std::sin( angle) - (g.y - a.y) * std::cos( angle)) < 0.5f)
+            b = g;
+
+        shape = { a, b };
+        return true;
+    }
+
+    // corners by Douglas-Peucker, then segments snapped one after the other
+    bool polyline( std::vector<Vec>& shape, bool closed, float& error) const {
+        float diagonal = std::hypot( bounds_w(), bounds_h());
+        auto corners = simplify( std::max( 3.f, config.tolerance * diagonal));
+        if( closed)
+            corners.back() = corners.front();
+
+        int segments = corners.size() - 1;
+        if( segments < 2 || segments > config.max_corners)
+            return false;
+
+        // segments must be straight, not a curve cut in chords
+        double err = 0;
+        for( int i = 0; i < segments; ++i)
+            err += deviation( corners[i], corners[i + 1]);
+        error = (float) std::sqrt( err / points.size()) / std::max( diagonal, 1.f);
+        if( error > config.tolerance / 3)
+            return false;
+
+        shape.clear();
+        shape.push_back( snap_point( points[ corners[0]]));
+        for( int i = 1; i <= segments; ++i) {
+            if( closed && i == segments) {
+                shape.push_back( shape.front());
+                break;
+            }
+            auto& p = points[ corners[i - 1]];
+            auto& q = points[ corners[i]];
+            float angle = snap_angle( std::atan2( q.y - p.y, q.x - p.x));
+            float l = snap_length( std::hypot( q.x - p.x, q.y - p.y));
+            auto& from = shape.back();
+            Vec to{ from.x + l * std::cos( angle), from.y + l * std::sin( angle) };
+            Vec g = snap_point( to);
+            shape.push_back( std::hypot( g.x - to.x, g.y - to.y) < 0.5f ? g : to);
+        }
+        return true;
+    }
+
+    // sum of squared distances of points (i, j) to segment i - j
+    double deviation( int i, int j) const {
+        auto& a = points[i];
+        auto& b = points[j];
+        float dx = b.x - a.x, dy = b.y - a.y, l = std::max( 1e-3f, std::hypot( dx, dy));
+        double sum = 0;
+        for( int k = i + 1; k < j; ++k) {
+            float d = ((points[k].x - a.x) * dy - (points[k].y - a.y) * dx) / l;
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    // closed path with 4 corners at right angles
+    bool rectangle( std::vector<Vec>& shape, float& error) const {
+        float diagonal = std::hypot( bounds_w(), bounds_h());
+        auto corners = simplify( std::max( 3.f, 2 * config.tolerance * diagonal));
+        corners.back() = corners.front();
+        if( corners.size() != 5)
+            return false;
+
+        // edge directions, folded modulo 90 degrees
+        double fx = 0, fy = 0;
+        for( int i = 0; i < 4; ++i) {
+            auto& p = points[ corners[i]];
+            auto& q = points[ corners[i + 1]];
+            float a = std::atan2( q.y - p.y, q.x - p.x);
+            float l = std::hypot( q.x - p.x, q.y - p.y);
+            fx += l * std::cos( 4 * a);
+            fy += l * std::sin( 4 * a);
+
+            // corner angle close to 90 degrees
+            auto& r = points[ corners[ (i + 2) % 4]];
+            float b = std::atan2( r.y - q.y, r.x - q.x);
+            float turn = std::fabs( std::remainder( b - a, (float) M_PI));
+            if( std::fabs( turn - (float) M_PI / 2) > 0.35f)
+                return false;
+        }
+        float angle = snap_angle( (float) std::atan2( fy, fx) / 4);
+        float cs = std::cos( angle), sn = std::sin( angle);
+
+        // bounds of the path in the rectangle frame
+        float u0 = 1e9f, u1 = -1e9f, v0 = 1e9f, v1 = -1e9f;
+        double err = 0;
+        for( auto& p: points) {
+            float u = p.x * cs + p.y * sn, v = -p.x * sn + p.y * cs;
+            u0 = std::min( u0, u); u1 = std::max( u1, u);
+            v0 = std::min( v0, v); v1 = std::max( v1, v);
+        }
+        // each side at the mean of the points closest to it (bounds are biased by jitter)
+        double sum[4] = {}, count[4] = {};
+        for( auto& p: points) {
+            float u = p.x * cs + p.y * sn, v = -p.x * sn + p.y * cs;
+            float d[4] = { std::fabs( u - u0), std::fabs( u - u1), std::fabs( v - v0), std::fabs( v - v1) };
+            int side = std::min_element( d, d + 4) - d;
+            err += d[ side] * d[ side];
+            sum[ side] += side < 2 ? u : v;
+            count[ side] += 1;
+        }
+        error = (float) std::sqrt( err / points.size()) / std::max( diagonal, 1.f);
+        if( error > config.tolerance || !count[0] || !count[1] || !count[2] || !count[3])
+            return false;
+        u0 = sum[0] / count[0]; u1 = sum[1] / count[1];
+        v0 = sum[2] / count[2]; v1 = sum[3] / count[3];
+
+        auto at = [&]( float u, float v){ return Vec{ u * cs - v * sn, u * sn + v * cs }; };
+        if( angle == 0) {           // axis aligned: corners on the grid
+            Vec a = snap_point( Vec{ u0, v0}), b = snap_point( Vec{ u1, v1});
+            u0 = a.x; v0 = a.y; u1 = b.x; v1 = b.y;
+        }
+        shape = { at( u0, v0), at( u1, v0), at( u1, v1), at( u0, v1), at( u0, v0) };
+        return true;
+    }
+
+    // ellipse with the same area moments as the closed path, circle when axes are close
+    bool ellipse( std::vector<Vec>& shape, float& error, Shape& kind) const {
+        double a = a2 + closing( 0), area = a / 2;
+        if( std::fabs( area) < 1)
+            return false;
+
+        // centroid and central second moments (closing edge included)
+        double cx = (mx + closing( 1)) / (3 * a), cy = (my + closing( 2)) / (3 * a);
+        double uxx = (mxx + closing( 3)) / (6 * a) - cx * cx;
+        double uyy = (myy + closing( 4)) / (6 * a) - cy * cy;
+        double uxy = (mxy + closing( 5)) / (12 * a) - cx * cy;
+
+        // region of an ellipse of half axes (ra, rb): variances ra^2 / 4, rb^2 / 4
+        double tr = uxx + uyy, det = uxx * uyy - uxy * uxy;
+        double disc = std::sqrt( std::max( 0.0, tr * tr / 4 - det));
+        double l1 = tr / 2 + disc, l2 = tr / 2 - disc;
+        if( l2 <= 0)
+            return false;
+        float ra = 2 * std::sqrt( l1), rb = 2 * std::sqrt( l2);
+        float phi = 0.5f * std::atan2( 2 * uxy, uxx - uyy);
+
+        Vec c{ (float) cx + points.front().x, (float) cy + points.front().y };
+        float cs = std::cos( phi), sn = std::sin( phi);
+        double err = 0;
+        for( auto& p: points) {
+            float dx = p.x - c.x, dy = p.y - c.y;
+            float u = dx * cs + dy * sn, v = -dx * sn + dy * cs;
+            float rho = std::sqrt( u * u / (ra * ra) + v * v / (rb * rb));
+            err += (rho - 1) * (rho - 1);
+        }
+        error = (float) std::sqrt( err / points.size());
+        if( error > config.tolerance * 1.5f)
+            return false;
+
+        c = snap_point( c);
+        if( ra < 1.15f * rb) {
+            kind = Shape::Circle;
+            ra = rb = snap_length( std::sqrt( ra * rb));
+        }
+        else {
+            kind = Shape::Ellipse;
+            phi = snap_angle( phi);
+            cs = std::cos( phi); sn = std::sin( phi);
+        }
+
+        int n = std::max( 24, (int) (2 * M_PI * std::max( ra, rb) / 6));
+        shape.clear();
+        for( int i = 0; i <= n; ++i) {
+            float t = 2 * (float) M_PI * i / n;
+            float u = ra * std::cos( t), v = rb * std::sin( t);
+            shape.push_back( Vec{ c.x + u * cs - v * sn, c.y + u * sn + v * cs });
+        }
+        return true;
+    }
+
+    // moment term of the closing edge (last point to first), same order as edge()
+    double closing( int term) const {
+        Vec p = local( points.back()), q{ 0, 0 };
+        double c = (double) p.x * q.y - (double) q.x * p.y;
+        switch( term) {
+            default:
+            case 0: return c;
+            case 1: return (p.x + q.x) * c;
+            case 2: return (p.y + q.y) * c;
+            case 3: return (p.x * p.x + p.x * q.x + q.x * q.x) * c;
+            case 4: return (p.y * p.y + p.y * q.y + q.y * q.y) * c;
+            case 5: return (p.x * q.y + 2 * p.x * p.y + 2 * q.x * q.y + q.x * p.y) * c;
+        }
+    }
+
+    // indexes of the corners kept by Douglas-Peucker at tolerance eps
+    std::vector<int> simplify( float eps) const {
+        std::vector<char> keep( points.size(), 0);
+        keep.front() = keep.back() = 1;
+
+        // closed path: split at the point farthest from the start first
+        int split = 0;
+        float far = 0;
+        for( size_t i = 0; i < points.size(); ++i) {
+            float d = std::hypot( points[i].x - points[0].x, points[i].y - points[0].y);
+            if( d > far) { far = d; split = i; }
+        }
+        keep[ split] = 1;
+
+        std::vector<std::pair<int, int>> todo{ { 0, split}, { split, (int) points.size() - 1} };
+        while( !todo.empty()) {
+            auto [i, j] = todo.back();
+            todo.pop_back();
+            if( j - i < 2)
+                continue;
+
+            auto& a = points[i];
+            auto& b = points[j];
+            float dx = b.x - a.x, dy = b.y - a.y, l = std::max( 1e-3f, std::hypot( dx, dy));
+            int worst = -1;
+            float max = eps;
+            for( int k = i + 1; k < j; ++k) {
+                float d = std::fabs( (points[k].x - a.x) * dy - (points[k].y - a.y) * dx) / l;
+                if( d > max) { max = d; worst = k; }
+            }
+            if( worst >= 0) {
+                keep[ worst] = 1;
+                todo.emplace_back( i, worst);
+                todo.emplace_back( worst, j);
+            }
+        }
+
+        std::vector<int> corners;
+        for( size_t i = 0; i < points.size(); ++i)
+            if( keep[i])
+                corners.push_back( i);
+
+        // drop the split point when it is not a corner (straight through)
+        if( corners.size() > 2) {
+            auto it = std::find( corners.begin(), corners.end(), split);
+            if( it != corners.begin() && it + 1 != corners.end()) {
+                auto& a = points[ *(it - 1)];
+                auto& b = points[ *(it + 1)];
+                auto& p = points[ split];
+                float dx = b.x - a.x, dy = b.y - a.y, l = std::max( 1e-3f, std::hypot( dx, dy));
+                if( std::fabs( (p.x - a.x) * dy - (p.y - a.y) * dx) / l <= eps)
+                    corners.erase( it);
+            }
+        }
+        return corners;
+    }
+};
+
+// replace freehand stroke index of page by its recognized shape (undoable)
+// return the page area to re-render (old and new stroke), empty if no shape
+template<class Pages>
+Rect snap_stroke( Pages& pages, int page, uint32_t index, const ShapeRecognizer& recognizer, History& history) {
+    auto result = recognizer.recognize( *pages[ page].strokes[ index]);
+    if( result.shape == Shape::None)
+        return Rect{ Point{ 0, 0}, Point{ 0, 0} };
+    return history.replace_strokes( pages, page, { { index, result.stroke} });
+}
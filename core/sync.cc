@@ -0,0 +1,570 @@
+// Delta sync of documents to a PC / cloud store
+// files are cut in content-defined chunks (gear rolling hash, FastCDC style cut points): an edit
+// only changes the chunks around it, whatever it shifts. a sync sends the chunk list of the file,
+// and the data of the chunks the store does not have:
+//  - the sender remembers the chunks of the last synced version, and only asks the store about new ones
+//  - the store finds chunks in the files it has (chunked the same way), assembles the new
+//    version in a temporary file and renames it over the old one: readers see either version
+// transport: in process (DirectTransport), or a byte stream (StreamTransport + serve(): socket, pipe, usb serial...)
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct ChunkId {
+    uint64_t a, b;              // two independent 64 bits hashes of the data
+
+    bool operator==( const ChunkId& o) const { return a == o.a && b == o.b; }
+};
+
+struct ChunkIdHash {
+    size_t operator()( const ChunkId& id) const { return id.a; }
+};
+
+struct Chunk {
+    ChunkId id;
+    uint32_t size;
+};
+
+// chunk sizes: min, mean (power of 2), max
+struct ChunkConfig {
+    uint32_t min  = 2 << 10;
+    uint32_t mean = 8 << 10;
+    uint32_t max  = 64 << 10;
+};
+
+// 64 bits hash, 8 bytes at a time
+inline uint64_t chunk_hash( const uint8_t* p, size_t n, uint64_t seed) {
+    auto mix = []( uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        return x ^ (x >> 33);
+    };
+    uint64_t h = seed ^ (n * 0x9e3779b97f4a7c15ull);
+    size_t i = 0;
+    for( ; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy( &w, p + i, 8);
+        h = (h ^ mix( w)) * 0x9e3779b97f4a7c15ull;
+        h = (h << 27) | (h >> 37);
+    }
+    uint64_t tail = 0;
+    std::memcpy( &tail, p + i, n - i);
+    return mix( h ^ mix( tail ^ seed));
+}
+
+inline ChunkId chunk_id( const uint8_t* p, size_t n) {
+    return ChunkId{ chunk_hash( p, n, 0x243f6a8885a308d3ull), chunk_hash( p, n, 0x13198a2e03707344ull)};
+}
+
+// content-defined chunks of data
+// cut where the gear hash of the last 64 bytes has its top bits clear: harder to cut before
+// the mean size, easier after (normalized chunking, sizes stay close to the mean)
+inline std::vector<Chunk> chunks( const uint8_t* data, size_t size, const ChunkConfig& config = ChunkConfig{}) {
+    static const auto gear = []{
+        std::vector<uint64_t> t( 256);
+        uint64_t x = 0x9e3779b97f4a7c15ull;
+        for( auto& g: t) {              // splitmix64
+            uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            g = z ^ (z >> 31);
+        }
+        return t;
+    }();
+
+    int bits = 0;
+    while( (1u << (bits + 1)) <= config.mean)
+        ++bits;
+    uint64_t hard = ~0ull << (64 - bits - 2), easy = ~0ull << (64 - bits + 2);
+
+    std::vector<Chunk> out;
+    for( size_t at = 0; at < size; ) {
+        const uint8_t* p = data + at;
+        size_t n = size - at, cut = std::min<size_t>( n, config.max);
+        if( n > config.min) {
+            size_t normal = std::min<size_t>( cut, config.mean);
+            uint64_t h = 0;
+            size_t i = config.min;
+            for( ; i < normal; ++i)
+                if( !((h = (h << 1) + gear[ p[i]]) & hard))
+                    break;
+            if( i == normal)
+                for( ; i < cut; ++i)
+                    if( !((h = (h << 1) + gear[ p[i]]) & easy))
+                        break;
+            cut = std::min( i + 1, cut);
+        }
+        out.push_back( Chunk{ chunk_id( p, cut), (uint32_t) cut});
+        at += cut;
+    }
+    return out;
+}
+
+// file content, read only mapping
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile( const std::string& path) {
+        int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0)
+            throw "Sync: could not open '" + path + "'\n";
+        struct stat st{};
+        if( fstat( fd, &st) == 0 && st.st_size > 0) {
+            void* m = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if( m != MAP_FAILED) {
+                data = (const uint8_t*) m;
+                size = st.st_size;
+            }
+        }
+        ::close( fd);
+        if( !data && st.st_size > 0)
+            throw "Sync: could not map '" + path + "'\n";
+    }
+
+    MappedFile( const MappedFile&) = delete;
+    MappedFile& operator=( const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if( data)
+            munmap( (void*) data, size);
+    }
+};
+
+// receiving side: a directory of files, chunks looked up in the files already there
+class SyncStore {
+    struct Location {
+        std::string file;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    std::string dir;
+    ChunkConfig config;
+    std::unordered_map<ChunkId, Location, ChunkIdHash> index;
+    std::unordered_map<std::string, std::vector<Chunk>> files;
+    std::unordered_map<ChunkId, std::string, ChunkIdHash> staged;      // received, not committed yet
+
+public:
+    // files of dir are chunked to know what is there (same chunking as the sender)
+    explicit SyncStore( const std::string& dir, ChunkConfig config = ChunkConfig{})
+        : dir( dir), config( config)
+    {
+        ::mkdir( dir.c_str(), 0755);
+        DIR* d = opendir( dir.c_str());
+        if( !d)
+            throw "SyncStore: could not open '" + dir + "'\n";
+        std::vector<std::string> names;
+        while( auto e = readdir( d))
+            if( e->d_name[0] != '.')
+                names.push_back( e->d_name);
+        closedir( d);
+
+        for( auto& name: names) {
+            struct stat st;
+            if( !stat( (dir + "/" + name).c_str(), &st) && S_ISREG( st.st_mode))
+                rescan( name);
+        }
+    }
+
+    // for each id: chunk available (in a file, or received)
+    std::vector<bool> has( const std::vector<ChunkId>& ids) const {
+        std::vector<bool> out;
+        for( auto& id: ids)
+            out.push_back( index.count( id) || staged.count( id));
+        return out;
+    }
+
+    void put( const ChunkId& id, std::string data) {
+        if( !(chunk_id( (const uint8_t*) data.data(), data.size()) == id))
+            throw std::string( "SyncStore: chunk data does not match its id\n");
+        staged[ id] = std::move( data);
+    }
+
+    // file name made of chunks, replaced atomically
+    // false if chunks are missing (store changed since the sender last synced): nothing written
+    bool commit( const std::string& name, const std::vector<Chunk>& recipe) {
+        if( name.empty() || name[0] == '.' || name.find( '/') != std::string::npos)
+            throw "SyncStore: bad file name '" + name + "'\n";
+        for( auto& c: recipe)
+            if( !index.count( c.id) && !staged.count( c.id))
+                return false;
+
+        std::string path = dir + "/" + name, tmp = dir + "/." + name + ".tmp";
+        FILE* f = std::fopen( tmp.c_str(), "wb");
+        if( !f)
+            throw "SyncStore: could not create '" + tmp + "'\n";
+
+        std::unordered_map<std::string, int> sources;
+        bool ok = true;
+        std::string buffer, changed;
+        for( auto& c: recipe) {
+            auto s = staged.find( c.id);
+            const std::string* data = &buffer;
+            if( s != staged.end())
+                data = &s->second;
+            else {
+                auto& l = index.at( c.id);
+                auto fd = sources.find( l.file);
+                if( fd == sources.end())
+                    fd = sources.emplace( l.file, ::open( (dir + "/" + l.file).c_str(), O_RDONLY | O_CLOEXEC)).first;
+                buffer.resize( l.size);
+                ok = ok && fd->second >= 0 && pread( fd->second, buffer.data(), l.size, l.offset) == (ssize_t) l.size;
+
+                // file edited in the store since it was chunked
+                if( ok && !(chunk_id( (const uint8_t*) buffer.data(), l.size) == c.id)) {
+                    changed = l.file;
+                    break;
+                }
+            }
+            ok = ok && data->size() == c.size && std::fwrite( data->data(), 1, c.size, f) == c.size;
+        }
+        for( auto& s: sources)
+            if( s.second >= 0)
+                ::close( s.second);
+        ok = ok && std::fflush( f) == 0 && fsync( fileno( f)) == 0;
+        std::fclose( f);
+        if( !changed.empty()) {
+            ::unlink( tmp.c_str());
+            rescan( changed);
+            return false;
+        }
+        if( !ok || std::rename( tmp.c_str(), path.c_str())) {
+            ::unlink( tmp.c_str());
+            throw "SyncStore: could not write '" + path + "'\n";
+        }
+
+        add( name, recipe);
+        staged.clear();
+        return true;
+    }
+
+private:
+    void rescan( const std::string& name) {
+        MappedFile file( dir + "/" + name);
+        add( name, chunks( file.data, file.size, config));
+    }
+
+    // chunks of file name, replacing its previous ones
+    void add( const std::string& name, const std::vector<Chunk>& recipe) {
+        auto old = files.find( name);
+        if( old != files.end())
+            for( auto& c: old->second) {
+                auto it = index.find( c.id);
+                if( it != index.end() && it->second.file == name)
+                    index.erase( it);
+            }
+
+        uint64_t offset = 0;
+        for( auto& c: recipe) {
+            index.emplace( c.id, Location{ name, offset, c.size});
+            offset += c.size;
+        }
+        files[ name] = recipe;
+    }
+};
+
+// way to a store, counts the bytes it moves
+class SyncTransport {
+public:
+    uint64_t sent = 0, received = 0;
+
+    virtual ~SyncTransport() = default;
+    virtual std::vector<bool> has( const std::vector<ChunkId>& ids) = 0;
+    virtual void put( const ChunkId& id, const uint8_t* data, uint32_t size) = 0;
+    virtual bool commit( const std::string& name, const std::vector<Chunk>& recipe) = 0;
+};
+
+// store in the same process (local directory, tests)
+class DirectTransport: public SyncTransport {
+    SyncStore& store;
+
+public:
+    explicit DirectTransport( SyncStore& store): store( store) {}
+
+    std::vector<bool> has( const std::vector<ChunkId>& ids) override {
+        sent += ids.size() * sizeof( ChunkId);
+        received += ids.size();
+        return store.has( ids);
+    }
+
+    void put( const ChunkId& id, const uint8_t* data, uint32_t size) override {
+        sent += sizeof( id) + size;
+        store.put( id, std::string( (const char*) data, size));
+    }
+
+    bool commit( const std::string& name, const std::vector<Chunk>& recipe) override {
+        sent += name.size() + recipe.size() * sizeof( Chunk);
+        return store.commit( name, recipe);
+    }
+};
+
+// stream protocol, requests: op (1 byte) | payload, host byte order (same program on both ends)
+//  'H' count | ids                        => count answers (1 byte)
+//  'P' id | size | data                   => no answer (pipelined)
+//  'C' name size | name | count | chunks  => status (0 done, 1 missing chunks, 2 error) | size | message
+struct SyncStream {
+    int fd;
+
+    void write( const void* data, size_t size) {
+        auto p = (const uint8_t*) data;
+        while( size) {
+            ssize_t n = ::write( fd, p, size);
+            if( n < 0 && errno == EINTR)
+                continue;
+            if( n <= 0)
+                throw std::string( "Sync: connection lost\n");
+            p += n;
+            size -= n;
+        }
+    }
+
+    // false on end of stream before any byte
+    bool read( void* data, size_t size) {
+        auto p = (uint8_t*) data;
+        size_t total = size;
+        while( size) {
+            ssize_t n = ::read( fd, p, size);
+            if( n < 0 && errno == EINTR)
+                continue;
+            if( n == 0 && size == total)
+                return false;
+            if( n <= 0)
+                throw std::string( "Sync: connection lost\n");
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    template<class T> void put( const T& v) { write( &v, sizeof( v)); }
+    template<class T> T get() {
+        T v;
+        if( !read( &v, sizeof( v)))
+            throw std::string( "Sync: connection lost\n");
+        return v;
+    }
+};
+
+// store at the other end of a stream (fd not owned)
+class StreamTransport: public SyncTransport {
+    SyncStream stream;
+
+public:
+    explicit StreamTransport( int fd): stream{ fd} {}
+
+    std::vector<bool> has( const std::vector<ChunkId>& ids) override {
+        stream.put( 'H');
+        stream.put( (uint32_t) ids.size());
+        stream.write( ids.data(), ids.size() * sizeof( ChunkId));
+        sent += 5 + ids.size() * sizeof( ChunkId);
+
+        std::vector<uint8_t> answers( ids.size());
+        if( !stream.read( answers.data(), answers.size()) && !ids.empty())
+            throw std::string( "Sync: connection lost\n");
+        received += answers.size();
+        return std::vector<bool>( answers.begin(), answers.end());
+    }
+
+    void put( const ChunkId& id, const uint8_t* data, uint32_t size) override {
+        stream.put( 'P');
+        stream.put( id);
+        stream.put( size);
+        stream.write( data, size);
+        sent += 1 + sizeof( id) + 4 + size;
+    }
+
+    bool commit( const std::string& name, const std::vector<Chunk>& recipe) override {
+        stream.put( 'C');
+        stream.put( (uint16_t) name.size());
+        stream.write( name.data(), name.size());
+        stream.put( (uint32_t) recipe.size());
+        stream.write( recipe.data(), recipe.size() * sizeof( Chunk));
+        sent += 7 + name.size() + recipe.size() * sizeof( Chunk);
+
+        auto status = stream.get<uint8_t>();
+        std::string message( stream.get<uint32_t>(), '\0');
+        if( !stream.read( message.data(), message.size()) && !message.empty())
+            throw std::string( "Sync: connection lost\n");
+        received += 5 + message.size();
+        if( status == 2)
+            throw message;
+        return status == 0;
+    }
+};
+
+// answer requests on fd until the other end closes it
+inline void serve( SyncStore& store, int fd) {
+    SyncStream stream{ fd};
+    for( char op; stream.read( &op, 1); ) {
+        if( op == 'H') {
+            std::vector<ChunkId> ids( stream.get<uint32_t>());
+            if( !stream.read( ids.data(), ids.size() * sizeof( ChunkId)) && !ids.empty())
+                return;
+            auto found = store.has( ids);
+            std::vector<uint8_t> answers( found.begin(), found.end());
+            stream.write( answers.data(), answers.size());
+        }
+        else if( op == 'P') {
+            auto id = stream.get<ChunkId>();
+            std::string data( stream.get<uint32_t>(), '\0');
+            if( !stream.read( data.data(), data.size()) && !data.empty())
+                return;
+            try {
+                store.put( id, std::move( data));
+            }
+            catch( const std::string&) {
+                // not staged: the commit reports the chunk missing
+            }
+        }
+        else if( op == 'C') {
+            std::string name( stream.get<uint16_t>(), '\0');
+            if( !stream.read( name.data(), name.size()) && !name.empty())
+                return;
+            std::vector<Chunk> recipe( stream.get<uint32_t>());
+            if( !stream.read( recipe.data(), recipe.size() * sizeof( Chunk)) && !recipe.empty())
+                return;
+
+            uint8_t status;
+            std::string message;
+            try {
+                status = store.commit( name, recipe) ? 0 : 1;
+            }
+            catch( const std::string& e) {
+                status = 2;
+                message = e;
+            }
+            catch( const char* e) {
+                status = 2;
+                message = e;
+            }
+            stream.put( status);
+            stream.put( (uint32_t) message.size());
+            stream.write( message.data(), message.size());
+        }
+        else
+            throw std::string( "Sync: bad request\n");
+    }
+}
+
+struct SyncStats {
+    size_t chunks = 0;          // in the file
+    size_t new_chunks = 0;      // not in the last synced version
+    size_t sent_chunks = 0;     // missing in the store
+    uint64_t file_bytes = 0;
+    uint64_t sent_bytes = 0;    // everything through the transport, requests included
+};
+
+// sending side: remembers the chunks of the last synced version of each document (state_dir)
+class DocumentSync {
+    std::string state_dir;
+    SyncTransport& transport;
+    ChunkConfig config;
+
+public:
+    DocumentSync( const std::string& state_dir, SyncTransport& transport, ChunkConfig config = ChunkConfig{})
+        : state_dir( state_dir), transport( transport), config( config)
+    {
+        ::mkdir( state_dir.c_str(), 0755);
+    }
+
+    // file path stored as name in the store
+    SyncStats sync( const std::string& path, const std::string& name) {
+        MappedFile file( path);
+        auto recipe = chunks( file.data, file.size, config);
+        uint64_t sent = transport.sent;
+
+        std::unordered_set<ChunkId, ChunkIdHash> known;
+        for( auto& c: load( name))
+            known.insert( c.id);
+
+        SyncStats stats;
+        stats.chunks = recipe.size();
+        stats.file_bytes = file.size;
+
+        // store changed meanwhile (files removed, another device): ask about every chunk, once
+        for( int pass = 0; ; ++pass) {
+            std::vector<ChunkId> ask;
+            std::vector<uint64_t> offsets;
+            std::vector<uint32_t> sizes;
+            std::unordered_set<ChunkId, ChunkIdHash> asked;
+            uint64_t offset = 0;
+            for( auto& c: recipe) {
+                if( (pass || !known.count( c.id)) && asked.insert( c.id).second) {
+                    ask.push_back( c.id);
+                    offsets.push_back( offset);
+                    sizes.push_back( c.size);
+                }
+                offset += c.size;
+            }
+            if( !pass)
+                stats.new_chunks = ask.size();
+
+            auto found = transport.has( ask);
+            for( size_t i = 0; i < ask.size(); ++i)
+                if( !found[i]) {
+                    transport.put( ask[i], file.data + offsets[i], sizes[i]);
+                    ++stats.sent_chunks;
+                }
+
+            if( transport.commit( name, recipe))
+                break;
+            if( pass)
+                throw "Sync: store is missing chunks of '" + name + "'\n";
+        }
+
+        save( name, recipe);
+        stats.sent_bytes = transport.sent - sent;
+        return stats;
+    }
+
+private:
+    std::string state( const std::string& name) const {
+        return state_dir + "/" + name + ".sync";
+    }
+
+    std::vector<Chunk> load( const std::string& name) const {
+        std::vector<Chunk> recipe;
+        FILE* f = std::fopen( state( name).c_str(), "rb");
+        if( !f)
+            return recipe;
+        uint32_t count;
+        if( std::fread( &count, 4, 1, f) == 1) {
+            recipe.resize( count);
+            if( std::fread( recipe.data(), sizeof( Chunk), count, f) != count)
+                recipe.clear();     // torn: next sync asks the store about everything
+        }
+        std::fclose( f);
+        return recipe;
+    }
+
+    void save( const std::string& name, const std::vector<Chunk>& recipe) const {
+        std::string path = state( name), tmp = path + ".tmp";
+        FILE* f = std::fopen( tmp.c_str(), "wb");
+        if( !f)
+            throw "Sync: could not create '" + tmp + "'\n";
+        uint32_t count = recipe.size();
+        bool ok = std::fwrite( &count, 4, 1, f) == 1 && std::fwrite( recipe.data(), sizeof( Chunk), count, f) == count;
+        ok = std::fclose( f) == 0 && ok;
+        if( !ok || std::rename( tmp.c_str(), path.c_str())) {
+            ::unlink( tmp.c_str());
+            throw "Sync: could not save '" + path + "'\n";
+        }
+    }
+};
@@ -1,72 +1,52 @@
 #include <iostream>
 #include <math.h>
+#include <poll.h>
 
 #include "../fb.cc"
+#include "../pacer.cc"
 
 using namespace std;
 
-#include "cairo.h"
+#include "../canvas.cc"
 
 // small wrapper around cairo
 // for test (see cairomm as alternative)
-/* Destroy a cairo surface */
-
-
+// draws off-screen (see Canvas), finished areas go to the screen on present()
 struct Draw {
-	cairo_surface_t* surface;
-	cairo_t *cr;
+    Canvas canvas;
 
     Draw( FrameBuffer& fb)
+        : canvas( fb)
     {
-        /* Create the cairo surface which will be used to draw to */
-        surface = cairo_image_surface_create_for_data(  fb.mem_map,
-                                                        CAIRO_FORMAT_RGB16_565,
-                                                        fb.vinfo.xres,
-                                                        fb.vinfo.yres,
-                                                        cairo_format_stride_for_width(CAIRO_FORMAT_RGB16_565, fb.vinfo.xres));
-        cairo_surface_set_user_data(surface, NULL, this,
-                                    &cairo_linuxfb_surface_destroy);
-	    cr = cairo_create(surface);
-
-        /* 
-        * We clear the cairo surface here before drawing
-        * This is required in case something was drawn on this surface
-        * previously, the previous contents would not be cleared without this.
-        */
-        //cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-        //cairo_paint(cr);
-        //cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-
-        cairo_set_line_width(cr, 0.5);
-        cairo_move_to(cr, 10, 10);
-        cairo_line_to(cr, 1000, 1500);
-
-        cairo_stroke(cr); 
-        fb.refresh();       // full refresh   
-    }
-
-    static
-    void cairo_linuxfb_surface_destroy(void *device)
-    {
+        canvas.draw( fb, []( cairo_t* cr) {
+            cairo_set_line_width(cr, 0.5);
+            cairo_move_to(cr, 10, 10);
+            cairo_line_to(cr, 1000, 1500);
+            cairo_stroke(cr);
+        });
+        canvas.present( WAVEFORM_MODE_GL16_FAST);       // full refresh
     }
 
     Rect draw_at( int x, int y) {
-        cairo_arc(cr, x, y, 10.0, 0.0, 2 * M_PI);
-        cairo_fill_preserve(cr);
-        cairo_stroke(cr);
-
-        return Rect{ Point{x,y}, Point{x+10,y+10} };
+        return canvas.draw( Rect{ Point{x-11,y-11}, Point{x+12,y+12} }, [&]( cairo_t* cr) {
+            cairo_arc(cr, x, y, 10.0, 0.0, 2 * M_PI);
+            cairo_fill_preserve(cr);
+            cairo_stroke(cr);
+        });
     }
 
     Rect erase_at( int x, int y ) {
-        return Rect{ Point{x,y}, Point{x+10,y+10} };
+        return canvas.draw( Rect{ Point{x-11,y-11}, Point{x+12,y+12} }, []( cairo_t* cr) {
+            cairo_set_source_rgb(cr, 1, 1, 1);
+            cairo_paint(cr);
+        });
     }
 };
 
 int main(int argc,char** argv) {
 try {
     cerr << "Hello World" << endl;
-    auto fb = FrameBuffer::open();
+    auto fb = FrameBuffer::open_default();
     fb.to_s();
 
     // drawing tool
@@ -75,23 +55,38 @@ try {
     // orbit a figure around the center of the screen
     const Point center{ fb.width()/2, fb.height()/2};
     const double r = 500;
-    double x = 0, y = 0;
+    double x = r + center.x, y = center.y;
 
-    for( double a=0; a < 2*3.14; a += 1*3.14/180) 
+    // one turn in 6 s whatever the panel speed: frames the panel can't take are merged
+    FramePacer pacer( fb);
+    auto start = FramePacer::Clock::now();
+    const double period = 6;
+    int drawn = 0;
+
+    for( double a = 0; a < 2*M_PI; )
     {
-        //int a = 0;
-        auto erase_rect = dr.erase_at( x, y);        // erase previous
+        // sleep until the next frame can go out, or an update is done
+        pollfd pfd{ pacer.fd(), POLLIN, 0};
+        if( poll( &pfd, 1, pacer.wait_ms( dr.canvas.pending())) > 0)
+            pacer.done();
+
+        dr.erase_at( x, y);        // erase previous
 
         // move
-        double x  = r*cos(a) + center.x;
-        double y  = r*sin(a) + center.y;
+        a = 2*M_PI * chrono::duration<double>( FramePacer::Clock::now() - start).count() / period;
+        x  = r*cos(a) + center.x;
+        y  = r*sin(a) + center.y;
 
-        auto draw_rect = dr.draw_at( x, y);         // redraw
+        dr.draw_at( x, y);         // redraw
+        ++drawn;
 
-        // fast refresh
-        fb.refresh( draw_rect, erase_rect);
+        // blit of both areas + fast refresh, only when the panel can take it
+        if( pacer.ready( dr.canvas.pending()))
+            pacer.send( dr.canvas.flush());
     }
 
+    cerr << drawn << " frames drawn, " << pacer.frames_sent() << " sent, update latency "
+         << pacer.latency_ms() << " ms" << endl;
 
     cerr << "done" << endl;
 }
@@ -6,7 +6,7 @@ using namespace std;
 int main(int argc,char** argv) {
 try {
     cerr << "Hello World" << endl;
-    auto fb = FrameBuffer::open();
+    auto fb = FrameBuffer::open_default();
     fb.to_s();
 
     fb.fill( 0x00);
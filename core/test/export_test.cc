@@ -0,0 +1,139 @@
+// Headless export: runs on the device or on a linux host
+// checks text output, then PNG chunk CRCs of every page
+// usage: export_test [notebook] [out_dir] [threads]
+//  without notebook, a synthetic one is generated in out_dir/synthetic.stylo
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include <sys/stat.h>
+
+#include "../document.cc"
+#include "../export.cc"
+
+using namespace std;
+
+// pages of spirals and a caption
+void synthetic( const string& path, int pages) {
+    NotebookWriter writer( path);
+    for( int i = 0; i < pages; ++i) {
+        Page page;
+        for( int k = 0; k < 40; ++k) {
+            auto s = make_shared<Stroke>();
+            s->width = 2 + k % 6;
+            s->color = (k * 37) % 200;
+            double cx = 150 + (k * 277 + i * 31) % 1100, cy = 200 + (k * 431 + i * 17) % 1500;
+            for( int n = 0; n < 200; ++n) {
+                double a = n * 0.08, r = 5 + n * 0.4;
+                s->points.push_back( StrokePoint{ (int16_t) (cx + r * cos( a)), (int16_t) (cy + r * sin( a)), 2000, 0, 0});
+            }
+            page.strokes.push_back( s);
+        }
+        page.texts.push_back( Text{ Point{ 100, 60}, 40, "page " + to_string( i + 1) + " (synthetic)\nnotes: café, 10 €"});
+        writer.add( page);
+    }
+    writer.finish();
+}
+
+// every chunk CRC of a PNG file, return the number of bad ones (-1: not a PNG)
+int png_bad_crcs( const string& path) {
+    FILE* f = fopen( path.c_str(), "rb");
+    if( !f)
+        return -1;
+    uint8_t signature[8];
+    int bad = fread( signature, 1, 8, f) == 8 && !memcmp( signature, "\x89PNG\r\n\x1a\n", 8) ? 0 : -1;
+    uint8_t head[8];
+    while( bad >= 0 && fread( head, 1, 8, f) == 8) {
+        uint32_t size = head[0] << 24 | head[1] << 16 | head[2] << 8 | head[3];
+        vector<uint8_t> data( 4 + size + 4);
+        memcpy( data.data(), head + 4, 4);
+        if( fread( data.data() + 4, 1, size + 4, f) != size + 4) {
+            bad = -1;
+            break;
+        }
+        uint8_t* tail = data.data() + 4 + size;
+        uint32_t stored = tail[0] << 24 | tail[1] << 16 | tail[2] << 8 | tail[3];
+        bad += crc32( 0, data.data(), 4 + size) != stored;
+        if( !memcmp( head + 4, "IEND", 4))
+            break;
+    }
+    fclose( f);
+    return bad;
+}
+
+// text drawn in the PNG raster (both lines, inside its bounds only), WinAnsi hex strings per line in the PDF
+int text_failures() {
+    Page page;
+    page.texts.push_back( Text{ Point{ 100, 200}, 40, "Stylo café\nline 2"});
+    auto& t = page.texts[0];
+
+    Bitmap canvas( 600, 400);
+    render( page, canvas, canvas.bounds());
+    auto box = bounds( t);
+    int inside = 0, outside = 0, second = 0;
+    for( int y = 0; y < canvas.height; ++y)
+        for( int x = 0; x < canvas.width; ++x)
+            if( canvas.row( y)[x] != 0xffff) {
+                bool in = box.contains( Point{ x, y});
+                inside += in;
+                outside += !in;
+                second += in && y > t.pos.y + t.size / 3;
+            }
+
+    int failures = 0;
+    if( !inside || !second || outside) {
+        cerr << "text raster: " << inside << " pixels inside, " << second << " on line 2, " << outside << " outside" << endl;
+        ++failures;
+    }
+    auto pdf = PdfWriter::content( page, 1872);
+    if( pdf.find( "<5374796c6f20636166e9> Tj 1 0 0 -1 100 250 Tm <6c696e652032> Tj ET") == string::npos) {
+        cerr << "text pdf: " << pdf << endl;
+        ++failures;
+    }
+    return failures;
+}
+
+int main(int argc,char** argv) {
+try {
+    string out = argc > 2 ? argv[2] : "export";
+    int threads = argc > 3 ? atoi( argv[3]) : 0;
+    mkdir( out.c_str(), 0755);
+
+    string path = argc > 1 ? argv[1] : out + "/synthetic.stylo";
+    if( argc <= 1)
+        synthetic( path, 20);
+
+    NotebookReader notebook( path);
+    cerr << path << ": " << notebook.pages() << " pages" << endl;
+
+    auto start = chrono::steady_clock::now();
+    export_png( notebook, out, threads);
+    auto png = chrono::steady_clock::now();
+    export_pdf( notebook, out + "/notebook.pdf", threads);
+    auto pdf = chrono::steady_clock::now();
+
+    int failures = text_failures();
+    for( int i = 0; i < notebook.pages(); ++i) {
+        char name[32];
+        snprintf( name, sizeof( name), "/page-%04d.png", i + 1);
+        int bad = png_bad_crcs( out + name);
+        if( bad) {
+            cerr << out + name << (bad < 0 ? ": not a PNG" : ": bad chunk CRC") << endl;
+            ++failures;
+        }
+    }
+
+    cerr << "png: " << chrono::duration<double, milli>( png - start).count() << " ms, "
+         << "pdf: " << chrono::duration<double, milli>( pdf - png).count() << " ms" << endl;
+    cerr << (failures ? "check failed" : "done") << endl;
+    return failures ? 1 : 0;
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
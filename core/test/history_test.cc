@@ -0,0 +1,137 @@
+// Undo / redo history: runs on a linux host
+// stroke add / replace / erase with undo and redo, text edits growing the text,
+// typing merged in one edit, memory budget dropping the oldest edits
+#include <iostream>
+
+#include "../document.cc"
+#include "../history.cc"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check( bool ok, const string& what) {
+    if( !ok) {
+        cerr << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+static bool covers( const Rect& outer, const Rect& inner) {
+    return outer.united( inner).area() == outer.area();
+}
+
+static StrokeRef line( int x0, int y0, int x1, int y1, int points = 2) {
+    auto s = make_shared<Stroke>();
+    for( int i = 0; i < points; ++i)
+        s->points.push_back( StrokePoint{ (int16_t) (x0 + (x1 - x0) * i / (points - 1)),
+                                          (int16_t) (y0 + (y1 - y0) * i / (points - 1)), 2000, 0, 0});
+    return s;
+}
+
+int main() {
+try {
+    // strokes: add, replace, undo, redo
+    {
+        vector<Page> pages( 2);
+        History history;
+
+        auto a = line( 100, 100, 200, 100), b = line( 500, 600, 700, 650);
+        auto r = history.add_stroke( pages, 1, a);
+        check( pages[1].strokes.size() == 1 && covers( r, a->bounds()), "add_stroke");
+
+        r = history.replace_strokes( pages, 1, { { 0, b}});
+        check( pages[1].strokes[0] == b, "replace_strokes applied");
+        check( covers( r, a->bounds()) && covers( r, b->bounds()), "replace damage covers before and after");
+
+        int page = -1;
+        r = history.undo( pages, &page);
+        check( page == 1 && pages[1].strokes[0] == a, "undo replace");
+        check( covers( r, a->bounds()) && covers( r, b->bounds()), "undo damage covers before and after");
+
+        r = history.redo( pages, &page);
+        check( pages[1].strokes[0] == b && covers( r, a->bounds()) && covers( r, b->bounds()), "redo replace");
+
+        history.erase_strokes( pages, 1, { 0});
+        check( pages[1].strokes.empty(), "erase_strokes");
+        history.undo( pages);
+        history.undo( pages);
+        history.undo( pages);
+        check( pages[1].strokes.empty() && !history.can_undo(), "undo back to empty page");
+        check( history.undo( pages).empty(), "undo with nothing to undo");
+        history.redo( pages);
+        check( pages[1].strokes.size() == 1 && pages[1].strokes[0] == a, "redo add");
+
+        history.add_stroke( pages, 1, b);
+        check( !history.can_redo(), "new edit clears redo");
+    }
+
+    // text: an insertion makes the text larger, undo / redo must re-render the larger box
+    {
+        vector<Page> pages( 1);
+        History history;
+        history.add_text( pages, 0, Text{ Point{ 100, 300}, 32, "ab"});
+        auto small = bounds( pages[0].texts[0]);
+
+        auto r = history.edit_text( pages, 0, 0, 2, 0, "cdefghij");
+        auto large = bounds( pages[0].texts[0]);
+        check( pages[0].texts[0].text == "abcdefghij" && covers( r, large), "edit_text damage covers new text");
+
+        r = history.undo( pages);
+        check( pages[0].texts[0].text == "ab", "undo edit_text");
+        check( covers( r, large), "undo damage covers removed characters");
+
+        r = history.redo( pages);
+        check( pages[0].texts[0].text == "abcdefghij" && covers( r, large), "redo damage covers inserted characters");
+
+        // typing continues the redone splice: still one edit
+        size_t edits = history.size();
+        history.edit_text( pages, 0, 0, 10, 0, "k");
+        history.edit_text( pages, 0, 0, 11, 0, "l");
+        auto typed = bounds( pages[0].texts[0]);
+        check( history.size() == edits && pages[0].texts[0].text == "abcdefghijkl", "typing merged");
+        r = history.undo( pages);
+        check( pages[0].texts[0].text == "ab" && covers( r, typed), "undo merged typing");
+        history.redo( pages);
+
+        // deletion: the old (larger) text is damaged
+        r = history.edit_text( pages, 0, 0, 2, 10, "");
+        check( pages[0].texts[0].text == "ab" && covers( r, typed), "deletion damage covers removed characters");
+        r = history.undo( pages);
+        check( pages[0].texts[0].text == "abcdefghijkl" && covers( r, typed) && covers( r, small), "undo deletion");
+    }
+
+    // budget: erased strokes held only by the history count, oldest edits go first
+    {
+        vector<Page> pages( 1);
+        size_t stroke = sizeof( Stroke) + 1000 * sizeof( StrokePoint);
+        History history( 5 * stroke);
+
+        for( int i = 0; i < 20; ++i)
+            pages[0].strokes.push_back( line( 0, i * 10, 1000, i * 10, 1000));
+        for( int i = 0; i < 20; ++i)
+            history.erase_strokes( pages, 0, { 0});
+
+        check( pages[0].strokes.empty(), "every stroke erased");
+        check( history.memory() <= 5 * stroke, "memory within budget");
+        check( history.size() >= 3 && history.size() < 20, "oldest edits dropped");
+
+        size_t kept = history.size();
+        while( history.can_undo())
+            history.undo( pages);
+        check( pages[0].strokes.size() == kept, "undo restores the kept edits only");
+        check( history.memory() == 0, "memory back to zero");
+    }
+
+    cerr << (failures ? "history test failed" : "history test passed") << endl;
+    return failures ? 1 : 0;
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
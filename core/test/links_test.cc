@@ -0,0 +1,67 @@
+// Link index: runs on the device or on a linux host
+// usage: links_test index [notebook...]
+//  notebooks given are (re)indexed as if just saved, then the backlinks of each are shown
+//  without notebook, a synthetic library of 5000 documents is indexed and queried
+#include <iostream>
+#include <chrono>
+
+#include "../document.cc"
+#include "../links.cc"
+
+using namespace std;
+
+static double ms( chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>( chrono::steady_clock::now() - since).count();
+}
+
+int main(int argc,char** argv) {
+try {
+    if( argc < 2) {
+        cerr << "usage: links_test index [notebook...]" << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    LinkIndex index( argv[1]);
+    cerr << "opened: " << index.size() << " documents in " << ms( start) << " ms" << endl;
+
+    vector<string> docs;
+    for( int i = 2; i < argc; ++i) {
+        docs.push_back( argv[i]);
+        NotebookReader notebook( argv[i]);
+        index.update( argv[i], document_links( notebook));
+    }
+
+    if( docs.empty()) {
+        // each document links to 5 others
+        start = chrono::steady_clock::now();
+        for( int i = 0; i < 5000; ++i) {
+            Page page;
+            string text;
+            for( int k = 1; k <= 5; ++k)
+                text += " [[doc" + to_string( (i * k * 7 + k) % 5000) + "]]";
+            page.texts.push_back( Text{ Point{ 0, 0}, 32, text});
+            index.update( "doc" + to_string( i), document_links( { page}));
+        }
+        cerr << "indexed 5000 saves in " << ms( start) << " ms" << endl;
+        docs = { "doc0", "doc42", "doc4999"};
+    }
+
+    for( auto& d: docs) {
+        start = chrono::steady_clock::now();
+        auto back = index.backlinks( d);
+        cerr << d << ": " << index.links( d).size() << " links, " << back.size() << " backlinks ("
+             << ms( start) << " ms)" << endl;
+        for( auto& b: back)
+            cout << "  <- " << b << endl;
+    }
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
@@ -0,0 +1,53 @@
+// Plugin example: square bouncing in the surface given by the host
+// usage: plugin_demo [frames] [crash]
+//  stops after frames updates (default 200), with crash: dies on a segfault instead
+#include <iostream>
+#include <csignal>
+
+#include "../plugin.cc"
+
+using namespace std;
+
+int main(int argc,char** argv) {
+try {
+    int frames = argc > 1 ? atoi( argv[1]) : 200;
+    bool crash = argc > 2 && string( argv[2]) == "crash";
+
+    PluginClient plugin;
+    auto s = plugin.surface();
+    cerr << "plugin_demo: surface " << s.width << "x" << s.height << endl;
+
+    fill( s, s.bounds(), 0xffff);
+    plugin.damage( s.bounds(), WAVEFORM_MODE_GC16);
+
+    const int size = 60;
+    int x = 0, y = 0, dx = 7, dy = 5;
+    Rect previous{ Point{ 0, 0}, Point{ 0, 0} };
+    for( int i = 0; i < frames; ++i) {
+        x += dx; y += dy;
+        if( x < 0 || x + size > s.width)  { dx = -dx; x += 2 * dx; }
+        if( y < 0 || y + size > s.height) { dy = -dy; y += 2 * dy; }
+
+        Rect r{ Point{ x, y}, Point{ x + size, y + size} };
+        fill( s, previous, 0xffff);
+        fill( s, r, 0x0000);
+        plugin.damage( previous.united( r));
+        previous = r;
+
+        usleep( 20000);
+    }
+
+    if( crash)
+        raise( SIGSEGV);
+
+    cerr << "plugin_demo: done" << endl;
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
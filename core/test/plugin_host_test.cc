@@ -0,0 +1,62 @@
+// Plugin host: two plugins side by side, one of them crashing
+// usage: plugin_host_test [plugin]      (default ./plugin_demo)
+//  the host keeps serving pen events and the other plugin after the crash
+#include <iostream>
+
+#include "../fb.cc"
+#include "../input.cc"
+#include "../plugin.cc"
+
+using namespace std;
+
+int main(int argc,char** argv) {
+try {
+    string path = argc > 1 ? argv[1] : "./plugin_demo";
+
+    auto fb = FrameBuffer::open_default();
+    fb.to_s();
+    fb.fill( 0xff);
+    fb.refresh();
+
+    Input input( { DeviceType::Stylus, DeviceType::Buttons });
+    PluginHost host( fb);
+
+    int half = fb.height() / 2;
+    int running = 0;
+    auto start = [&]( Rect area, vector<string> args) {
+        auto& p = host.launch( path, area, args);
+        ++running;
+        input.watch( p.doorbell, [&]( short){ host.composite( p); });
+        input.watch( p.alive, [&, pid = p.pid]( short) {
+            input.unwatch( p.doorbell);
+            input.unwatch( p.alive);
+            host.composite( p);         // last frames
+            int status = host.reap( p);
+            cerr << "plugin " << pid << " gone, status " << status << endl;
+            --running;
+        });
+    };
+    start( Rect{ Point{ 0, 0},    Point{ fb.width(), half} },        { "300"});
+    start( Rect{ Point{ 0, half}, Point{ fb.width(), fb.height()} }, { "100", "crash"});
+
+    input.loop( [&]( Event& ev) {
+            if( ev.touch)
+                cerr << "pen at " << ev.pos.x << "," << ev.pos.y << endl;
+        },
+        [&]{
+            if( !running) {
+                cerr << "done" << endl;
+                exit( 0);
+            }
+            return -1;
+        });
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
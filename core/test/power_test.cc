@@ -0,0 +1,67 @@
+// Power manager: runs on a linux host (memory frame buffer)
+// a stroke longer than the idle delay must keep the manager active (panel powered, workers running),
+// then lifting the pen lets it go idle
+// events are built as the pen decoder does: pen down sets key to BTN_TOUCH for the whole stroke
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+#include "../input.cc"
+#include "../power.cc"
+
+using namespace std;
+
+int main() {
+try {
+    auto fb = FrameBuffer::memory();
+    PowerConfig config;
+    config.idle_ms = 300;
+    PowerManager power( fb, config);
+
+    auto handle = [&]( const Event& ev) {
+        if( user_activity( ev))
+            power.activity();
+        power.idle();
+    };
+
+    Event ev{};
+    ev.source = DeviceType::Stylus;
+    ev.key = BTN_TOOL_PEN;              // pen comes in range
+    handle( ev);
+
+    ev.key = BTN_TOUCH;                 // pen down, then 1 s of writing
+    ev.touch = 1;
+    ev.pressure = 2000;
+    int failures = 0;
+    for( int i = 0; i < 100; ++i) {
+        ev.pos = Point{ 200 + i * 5, 400 + (i % 10) * 3};
+        handle( ev);
+        if( power.idling() || power.workers().paused()) {
+            cerr << "FAIL: idle " << i * 10 << " ms into a stroke" << endl;
+            ++failures;
+            break;
+        }
+        this_thread::sleep_for( chrono::milliseconds( 10));
+    }
+
+    ev.touch = 0;                       // pen lifted: idle after idle_ms
+    handle( ev);
+    this_thread::sleep_for( chrono::milliseconds( config.idle_ms + 50));
+    power.idle();
+    if( !power.idling() || !power.workers().paused()) {
+        cerr << "FAIL: still active " << config.idle_ms + 50 << " ms after the pen was lifted" << endl;
+        ++failures;
+    }
+
+    cerr << (failures ? "power test failed" : "power test passed") << endl;
+    return failures ? 1 : 0;
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
@@ -0,0 +1,123 @@
+// Raster ops: runs on a linux host
+// fills and blits clipped against either surface must only touch (and read) the pixels they should
+#include <iostream>
+
+#include "../raster.cc"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check( bool ok, const string& what) {
+    if( !ok) {
+        cerr << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+// pixel value telling its own position
+static uint16_t at( int x, int y) {
+    return (uint16_t) (y * 256 + x);
+}
+
+static void numbered( const Surface& s) {
+    for( int y = 0; y < s.height; ++y)
+        for( int x = 0; x < s.width; ++x)
+            s.row( y)[x] = at( x, y);
+}
+
+// area of dst at to holds src pixels from, everything else is still color
+static bool copied( const Surface& dst, Rect to, Point from, uint16_t color) {
+    for( int y = 0; y < dst.height; ++y)
+        for( int x = 0; x < dst.width; ++x) {
+            bool inside = x >= to.topLeft.x && x < to.bottomRight.x && y >= to.topLeft.y && y < to.bottomRight.y;
+            uint16_t expected = inside ? at( from.x + x - to.topLeft.x, from.y + y - to.topLeft.y) : color;
+            if( dst.row( y)[x] != expected)
+                return false;
+        }
+    return true;
+}
+
+int main() {
+    Bitmap src( 40, 30);
+    numbered( src);
+
+    // fill clipped to the surface
+    {
+        Bitmap b( 20, 10, 0xffff);
+        auto r = fill( b, Rect{ Point{ -5, 6}, Point{ 8, 40}}, 0x1234);
+        check( r.topLeft.x == 0 && r.topLeft.y == 6 && r.bottomRight.x == 8 && r.bottomRight.y == 10, "fill clip rect");
+        bool ok = true;
+        for( int y = 0; y < b.height; ++y)
+            for( int x = 0; x < b.width; ++x)
+                ok = ok && b.row( y)[x] == (x < 8 && y >= 6 ? 0x1234 : 0xffff);
+        check( ok, "fill pixels");
+    }
+
+    // blit inside both surfaces
+    {
+        Bitmap b( 20, 20, 0);
+        blit( b, Point{ 3, 4}, src, Rect{ Point{ 10, 5}, Point{ 18, 12}});
+        check( copied( b, Rect{ Point{ 3, 4}, Point{ 11, 11}}, Point{ 10, 5}, 0), "blit");
+    }
+
+    // source area starting above / left of the source: destination moves by the clipped amount
+    {
+        Bitmap b( 20, 20, 0);
+        auto r = blit( b, Point{ 2, 3}, src, Rect{ Point{ -4, -2}, Point{ 6, 5}});
+        check( r.topLeft.x == 6 && r.topLeft.y == 5 && r.bottomRight.x == 12 && r.bottomRight.y == 10, "blit source clip rect");
+        check( copied( b, Rect{ Point{ 6, 5}, Point{ 12, 10}}, Point{ 0, 0}, 0), "blit source clip pixels");
+    }
+
+    // source area past the bottom right of the source
+    {
+        Bitmap b( 20, 20, 0);
+        blit( b, Point{ 0, 0}, src, Rect{ Point{ 35, 26}, Point{ 50, 40}});
+        check( copied( b, Rect{ Point{ 0, 0}, Point{ 5, 4}}, Point{ 35, 26}, 0), "blit source clip bottom right");
+    }
+
+    // destination above / left of the destination: source moves by the clipped amount
+    {
+        Bitmap b( 20, 20, 0);
+        auto r = blit( b, Point{ -3, -5}, src, Rect{ Point{ 10, 10}, Point{ 20, 20}});
+        check( r.topLeft.x == 0 && r.topLeft.y == 0 && r.bottomRight.x == 7 && r.bottomRight.y == 5, "blit destination clip rect");
+        check( copied( b, Rect{ Point{ 0, 0}, Point{ 7, 5}}, Point{ 13, 15}, 0), "blit destination clip pixels");
+    }
+
+    // both clipped at once
+    {
+        Bitmap b( 20, 20, 0);
+        blit( b, Point{ -3, 1}, src, Rect{ Point{ -2, -4}, Point{ 8, 6}});
+        check( copied( b, Rect{ Point{ 0, 5}, Point{ 7, 11}}, Point{ 1, 0}, 0), "blit both clipped");
+    }
+
+    // nothing left after clipping
+    {
+        Bitmap b( 20, 20, 0);
+        auto r = blit( b, Point{ 0, 0}, src, Rect{ Point{ -10, -10}, Point{ -2, -1}});
+        check( r.empty() && copied( b, Rect{ Point{ 0, 0}, Point{ 0, 0}}, Point{ 0, 0}, 0), "blit outside of source");
+    }
+
+    // same surface, overlapping areas (scrolling down and up)
+    {
+        Bitmap b( 40, 30);
+        numbered( b);
+        blit( b, Point{ 0, 3}, b, Rect{ Point{ 0, 0}, Point{ 40, 20}});
+        bool ok = true;
+        for( int y = 3; y < 23; ++y)
+            for( int x = 0; x < 40; ++x)
+                ok = ok && b.row( y)[x] == at( x, y - 3);
+        check( ok, "blit overlapping down");
+
+        numbered( b);
+        blit( b, Point{ 0, 0}, b, Rect{ Point{ 0, 3}, Point{ 40, 30}});
+        ok = true;
+        for( int y = 0; y < 27; ++y)
+            for( int x = 0; x < 40; ++x)
+                ok = ok && b.row( y)[x] == at( x, y + 3);
+        check( ok, "blit overlapping up");
+    }
+
+    cerr << (failures ? "raster test failed" : "raster test passed") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+// Stand-in rm2fb server
+// provide the shared frame + message queue of the rM2 rm2fb server on a plain linux host,
+// and print every update received, to test FrameBuffer::rm2fb() without a device
+//
+// usage: rm2fb_server [count]      exit after count updates (default: run until killed)
+#include <iostream>
+#include <csignal>
+
+#include "../fb.cc"
+
+using namespace std;
+
+static volatile sig_atomic_t running = 1;
+
+int main(int argc,char** argv) {
+try {
+    long count = argc > 1 ? atol( argv[1]) : -1;
+
+    const int frame_length = 1404 * 1872 * 2;
+    int shm = ::open( SWTFB_SHM, O_RDWR | O_CREAT, 0600);
+    if( shm < 0 || ftruncate( shm, frame_length))
+        throw string( "rm2fb_server: could not create '" SWTFB_SHM "'\n");
+
+    auto frame = (uint16_t*) mmap( 0, frame_length, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    if( frame == MAP_FAILED)
+        throw string( "rm2fb_server: unable to mmap frame\n");
+
+    int queue = msgget( SWTFB_MSGQ_KEY, IPC_CREAT | 0600);
+    if( queue < 0)
+        throw string( "rm2fb_server: could not create message queue\n");
+
+    signal( SIGINT,  []( int){ running = 0; });
+    signal( SIGTERM, []( int){ running = 0; });
+
+    cerr << "rm2fb_server: waiting for updates" << endl;
+    for( long n = 0; running && n != count; ) {
+        swtfb_update msg;
+        if( msgrcv( queue, &msg, sizeof( msg.mdata), 0, 0) < 0) {
+            if( errno == EINTR)
+                continue;
+            throw "rm2fb_server: msgrcv failed (errno= " + to_string( errno) + ")\n";
+        }
+
+        // updates are done as soon as received here: release the waiting client at once
+        if( msg.mtype == SWTFB_WAIT_t) {
+            sem_t* done = sem_open( msg.mdata.wait_update.sem_name, 0);
+            if( done != SEM_FAILED) {
+                sem_post( done);
+                sem_close( done);
+            }
+            continue;
+        }
+
+        if( msg.mtype != SWTFB_UPDATE_t) {
+            cerr << "rm2fb_server: ignored message type " << msg.mtype << endl;
+            continue;
+        }
+
+        // checksum of the updated region, shows the client pixels are visible here
+        auto& u = msg.mdata.update;
+        auto& r = u.update_region;
+        uint32_t sum = 0;
+        for( uint32_t y = r.top; y < r.top + r.height && y < 1872; ++y)
+            for( uint32_t x = r.left; x < r.left + r.width && x < 1404; ++x)
+                sum = sum * 31 + frame[ y * 1404 + x];
+
+        auto now = chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now().time_since_epoch()).count();
+        cout << "update " << ++n
+             << ": " << r.left << "," << r.top << " " << r.width << "x" << r.height
+             << " waveform=" << u.waveform_mode
+             << " mode=" << u.update_mode
+             << " marker=" << u.update_marker
+             << " checksum=" << hex << sum << dec
+             << " latency=" << (long) (now - msg.mdata.ms) << "ms"
+             << endl;
+    }
+
+    msgctl( queue, IPC_RMID, nullptr);
+    ::unlink( SWTFB_SHM);
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
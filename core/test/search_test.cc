@@ -0,0 +1,74 @@
+// Search index: runs on the device or on a linux host
+// usage: search_test index query [notebook...]
+//  notebooks given are (re)indexed as if just saved, then the query runs
+//  without notebook, a synthetic library of 3000 notes is indexed first
+//  query: words, prefix*, "a phrase"
+#include <iostream>
+#include <chrono>
+
+#include "../document.cc"
+#include "../search.cc"
+
+using namespace std;
+
+static double ms( chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>( chrono::steady_clock::now() - since).count();
+}
+
+int main(int argc,char** argv) {
+try {
+    if( argc < 3) {
+        cerr << "usage: search_test index query [notebook...]" << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    SearchIndex index( argv[1]);
+    cerr << "opened: " << index.size() << " documents in " << ms( start) << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    for( int i = 3; i < argc; ++i) {
+        NotebookReader notebook( argv[i]);
+        vector<Page> pages;
+        for( int p = 0; p < notebook.pages(); ++p)
+            pages.push_back( notebook.page( p));
+        index.update( argv[i], document_text( pages));
+    }
+
+    if( argc == 3) {
+        // notes of 200 words out of a 2000 word vocabulary, plus a known phrase in a few
+        static const char* syllables[] = { "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "ze", "pu"};
+        uint32_t seed = 1;
+        auto next = [&]{ return (seed = seed * 1103515245 + 12345) >> 16; };
+        for( int i = 0; i < 3000; ++i) {
+            string text;
+            for( int w = 0; w < 200; ++w) {
+                int word = next() % 2000;
+                text += syllables[ word % 10];
+                text += syllables[ word / 10 % 10];
+                text += syllables[ word / 100 % 10];
+                text += w % 12 == 11 ? '\n' : ' ';
+            }
+            if( i % 97 == 0)
+                text += "* TODO review the search index\n";
+            index.update( "note" + to_string( i), text);
+        }
+    }
+    index.flush();
+    cerr << "indexed " << (argc == 3 ? 3000 : argc - 3) << " saves in " << ms( start) << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    auto hits = index.search( argv[2]);
+    cerr << hits.size() << " hits in " << ms( start) << " ms" << endl;
+    for( auto& h: hits)
+        cout << h.matches << "\t" << h.doc << endl;
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
@@ -0,0 +1,105 @@
+// Shape recognition: runs on a linux host
+// fixed synthetic strokes (pen samples a few pixels apart, with jitter) and the shape expected for each
+#include <iostream>
+#include <functional>
+#include <cmath>
+
+#include "../shapes.cc"
+
+using namespace std;
+
+// pen path: point at t in [0, 1], sampled every ~step pixels, +-jitter pixels (fixed sequence)
+static vector<StrokePoint> sample( const function<ShapeRecognizer::Vec( float)>& at, float step = 3, float jitter = 1.5f) {
+    uint32_t seed = 7;
+    auto noise = [&]{ seed = seed * 1103515245 + 12345; return ((seed >> 16) % 1000 / 999.f * 2 - 1) * jitter; };
+
+    float length = 0;
+    auto prev = at( 0);
+    for( int i = 1; i <= 1000; ++i) {
+        auto v = at( i / 1000.f);
+        length += hypot( v.x - prev.x, v.y - prev.y);
+        prev = v;
+    }
+
+    vector<StrokePoint> out;
+    int n = max( 3, (int) (length / step));
+    for( int i = 0; i <= n; ++i) {
+        auto v = at( (float) i / n);
+        out.push_back( StrokePoint{ (int16_t) lround( v.x + noise()), (int16_t) lround( v.y + noise()), 2000, 0, 0});
+    }
+    return out;
+}
+
+// along the segments of a polygonal path
+static function<ShapeRecognizer::Vec( float)> path( vector<ShapeRecognizer::Vec> corners) {
+    return [corners]( float t) {
+        vector<float> lengths{ 0};
+        for( size_t i = 1; i < corners.size(); ++i)
+            lengths.push_back( lengths.back() + hypot( corners[i].x - corners[i-1].x, corners[i].y - corners[i-1].y));
+        float d = t * lengths.back();
+        size_t i = 1;
+        while( i + 1 < corners.size() && lengths[i] < d)
+            ++i;
+        float k = (d - lengths[i-1]) / max( 1e-6f, lengths[i] - lengths[i-1]);
+        return ShapeRecognizer::Vec{ corners[i-1].x + k * (corners[i].x - corners[i-1].x),
+                                     corners[i-1].y + k * (corners[i].y - corners[i-1].y) };
+    };
+}
+
+static const char* name( Shape s) {
+    switch( s) {
+        case Shape::None:       return "none";
+        case Shape::Line:       return "line";
+        case Shape::Polyline:   return "polyline";
+        case Shape::Rectangle:  return "rectangle";
+        case Shape::Circle:     return "circle";
+        case Shape::Ellipse:    return "ellipse";
+    }
+    return "?";
+}
+
+int main() {
+    ShapeConfig config;
+    config.grid = 0;                    // shapes as drawn: only classification is checked
+
+    struct Case {
+        const char* what;
+        vector<StrokePoint> points;
+        Shape expected;
+    };
+    vector<Case> cases = {
+        { "line", sample( path( { { 200, 300}, { 900, 620}})), Shape::Line },
+        { "rectangle", sample( path( { { 300, 300}, { 800, 300}, { 800, 650}, { 300, 650}, { 302, 304}})), Shape::Rectangle },
+        { "circle", sample( []( float t){ return ShapeRecognizer::Vec{ 700 + 200 * cosf( t * 6.2832f), 900 + 200 * sinf( t * 6.2832f)}; }),
+          Shape::Circle },
+        { "ellipse", sample( []( float t){ return ShapeRecognizer::Vec{ 700 + 320 * cosf( t * 6.2832f), 900 + 140 * sinf( t * 6.2832f)}; }),
+          Shape::Ellipse },
+        { "open polyline", sample( path( { { 200, 200}, { 600, 200}, { 300, 600}, { 700, 600}})), Shape::Polyline },
+        { "closed polyline", sample( path( { { 500, 300}, { 800, 800}, { 200, 800}, { 498, 304}})), Shape::Polyline },
+        { "scribble", sample( []( float t){ return ShapeRecognizer::Vec{ 300 + 500 * t + 40 * sinf( t * 37), 600 + 90 * sinf( t * 23) * cosf( t * 7)}; }),
+          Shape::None },
+    };
+
+    int failures = 0;
+    Stroke style;
+    for( auto& c: cases) {
+        ShapeRecognizer recognizer( config);
+        for( auto& p: c.points)
+            recognizer.add( p);
+        auto r = recognizer.recognize( style);
+
+        bool ok = r.shape == c.expected && (r.shape == Shape::None) == !r.stroke;
+        cerr << (ok ? "ok   " : "FAIL ") << c.what << ": " << name( r.shape) << " (error " << r.error << ")" << endl;
+        failures += !ok;
+
+        // reset: same recognizer, next stroke from scratch
+        recognizer.reset();
+        if( recognizer.recognize( style).shape != Shape::None) {
+            cerr << "FAIL " << c.what << ": shape left after reset" << endl;
+            ++failures;
+        }
+    }
+
+    cerr << (failures ? "shape recognition test failed" : "shape recognition test passed") << endl;
+    return failures ? 1 : 0;
+}
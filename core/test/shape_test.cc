@@ -0,0 +1,97 @@
+// Shape recognition: draw lines, polylines, rectangles, circles, ellipses
+// on pen up (or when the pen is held still), the freehand stroke is replaced by the snapped shape
+// usage: shape_test          (power button: undo last stroke / shape, long press leaves)
+#include <iostream>
+#include <vector>
+
+#include "../fb.cc"
+#include "../input.cc"
+#include "../document.cc"
+#include "../history.cc"
+#include "../render.cc"
+#include "../selection.cc"
+#include "../shapes.cc"
+
+using namespace std;
+
+int main(int argc,char** argv) {
+try {
+    auto fb = FrameBuffer::open_default();
+    fb.to_s();
+
+    vector<Page> pages( 1);
+    History history;
+    TilePool pool;                      // page renders over all cores
+    redraw( fb, pages[0], { Rect( fb) }, pool, View{}, WAVEFORM_MODE_GC16);
+
+    Input input( { DeviceType::Stylus, DeviceType::Buttons });
+    Surface screen( fb);
+
+    Stroke wet;                         // stroke being drawn
+    wet.width = 4;
+    BrushStroke ink( wet.brush, wet.color, wet.width);
+    ShapeRecognizer recognizer;
+    bool down = false, snapped = false;
+
+    // freehand stroke goes to the page, then is replaced by its shape if any
+    auto finish = [&] {
+        if( wet.points.size() > 1) {
+            auto damage = history.add_stroke( pages, 0, make_shared<Stroke>( wet));
+            uint32_t index = pages[0].strokes.size() - 1;
+            auto t0 = ShapeRecognizer::Clock::now();
+            auto shape = snap_stroke( pages, 0, index, recognizer, history);
+            cerr << "fit: " << chrono::duration_cast<chrono::microseconds>( ShapeRecognizer::Clock::now() - t0).count() << " us" << endl;
+            redraw( fb, pages[0], { shape.empty() ? damage : shape }, pool);
+        }
+        wet.points.clear();
+        recognizer.reset();
+        ink = BrushStroke( wet.brush, wet.color, wet.width);
+    };
+
+    input.loop( [&]( Event& ev) {
+            if( ev.source == DeviceType::Stylus) {
+                if( ev.touch && !snapped) {
+                    StrokePoint p{ (int16_t) ev.pos.x, (int16_t) ev.pos.y, (uint16_t) ev.pressure,
+                                   (int8_t) ev.tilt.x, (int8_t) ev.tilt.y};
+                    wet.points.push_back( p);
+                    recognizer.add( p);
+                    fb.refresh( ink.add( screen, screen.bounds(), p));
+                    down = true;
+                }
+                else if( !ev.touch && down) {
+                    if( !snapped)
+                        finish();
+                    down = snapped = false;
+                }
+            }
+            else if( ev.key == KEY_POWER) {
+                int page;
+                auto damage = history.undo( pages, &page);
+                if( damage.empty()) {
+                    cerr << "leaving" << endl;
+                    exit( 0);
+                }
+                redraw( fb, pages[0], { damage }, pool);
+            }
+        },
+        // pen held still: snap now, rest of the stroke ignored until pen up
+        [&]{
+            if( !down || snapped)
+                return -1;
+            if( recognizer.held()) {
+                finish();
+                snapped = true;
+                return -1;
+            }
+            return 100;
+        });
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
@@ -3,90 +3,93 @@
 
 #include "../fb.cc"
 #include "../input.cc"
+#include "../cleanup.cc"
+#include "../power.cc"
+#include "../render.cc"
 
 using namespace std;
 
-#include "cairo.h"
+#include "../canvas.cc"
 
 // small wrapper around cairo
 // for test (see cairomm as alternative)
-/* Destroy a cairo surface */
-
-
+// draws off-screen (see Canvas), finished areas go to the screen on present()
 struct Draw {
-	cairo_surface_t* surface;
-	cairo_t *cr;
+    Canvas canvas;
 
     Draw( FrameBuffer& fb)
+        : canvas( fb)
     {
-        /* Create the cairo surface which will be used to draw to */
-        surface = cairo_image_surface_create_for_data(  fb.mem_map,
-                                                        CAIRO_FORMAT_RGB16_565,
-                                                        fb.vinfo.xres,
-                                                        fb.vinfo.yres,
-                                                        cairo_format_stride_for_width(CAIRO_FORMAT_RGB16_565, fb.vinfo.xres));
-        cairo_surface_set_user_data(surface, NULL, this,
-                                    &cairo_linuxfb_surface_destroy);
-	    cr = cairo_create(surface);
-
-        /* 
-        * We clear the cairo surface here before drawing
-        * This is required in case something was drawn on this surface
-        * previously, the previous contents would not be cleared without this.
-        */
-        //cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-        //cairo_paint(cr);
-        //cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-
-        cairo_set_line_width(cr, 0.5);
-        cairo_move_to(cr, 10, 10);
-        cairo_line_to(cr, 1000, 1500);
-
-        cairo_stroke(cr); 
-        fb.refresh();       // full refresh   
-    }
-
-    static
-    void cairo_linuxfb_surface_destroy(void *device)
-    {
+        canvas.draw( fb, []( cairo_t* cr) {
+            cairo_set_line_width(cr, 0.5);
+            cairo_move_to(cr, 10, 10);
+            cairo_line_to(cr, 1000, 1500);
+            cairo_stroke(cr);
+        });
+        canvas.present( WAVEFORM_MODE_GL16_FAST);       // full refresh
     }
 
     Rect draw_at( int x, int y) {
-        cairo_arc(cr, x, y, 10.0, 0.0, 2 * M_PI);
-        cairo_fill_preserve(cr);
-        cairo_stroke(cr);
-
-        return Rect{ Point{x,y}, Point{x+10,y+10} };
+        return canvas.draw( Rect{ Point{x-11,y-11}, Point{x+12,y+12} }, [&]( cairo_t* cr) {
+            cairo_arc(cr, x, y, 10.0, 0.0, 2 * M_PI);
+            cairo_fill_preserve(cr);
+            cairo_stroke(cr);
+        });
     }
 
     Rect erase_at( int x, int y ) {
-        return Rect{ Point{x,y}, Point{x+10,y+10} };
+        return canvas.draw( Rect{ Point{x-11,y-11}, Point{x+12,y+12} }, []( cairo_t* cr) {
+            cairo_set_source_rgb(cr, 1, 1, 1);
+            cairo_paint(cr);
+        });
     }
 };
 
 int main(int argc,char** argv) {
 try {
     cerr << "Hello World" << endl;
-    auto fb = FrameBuffer::open();
-    Input input;
+    auto fb = FrameBuffer::open_default();
+    Input input( { DeviceType::Stylus, DeviceType::Buttons });
 
     fb.to_s();
 
     // drawing tool
     Draw dr( fb);
 
+    // clean ghosting once user stops drawing
+    CleanupScheduler cleaner( fb);
+
+    // EPDC power down + no wake up while nothing happens
+    PowerManager power( fb);
+
+    // wet ink: pressure and tilt aware pen, laid in the canvas
+    BrushStroke ink( Brush::Pen, 0x00, 6);
+
     input.loop([&](auto& event){ 
+        if( user_activity( event)) {
+            cleaner.activity();                             // no cleanup flash while writing
+            power.activity();                               // panel stays powered while writing
+        }
+
         if( event.touch) {
-            auto draw_rect = dr.draw_at( event.pos.x, event.pos.y);
-            fb.refresh( draw_rect);                         // fast refresh
+            auto& pixels = dr.canvas.pixels();
+            dr.canvas.touched( ink.add( pixels, pixels.bounds(),
+                StrokePoint{ (int16_t) event.pos.x, (int16_t) event.pos.y, (uint16_t) event.pressure,
+                             (int8_t) event.tilt.x, (int8_t) event.tilt.y}));
+            for( auto& r: dr.canvas.present())              // blit + fast refresh
+                cleaner.mark( r);
         }
+        else
+            ink = BrushStroke( Brush::Pen, 0x00, 6);        // pen lifted: next sample starts a stroke
 
         switch( event.key) {
             case KEY_POWER:
-                cerr << "leaving" << endl;
+                cerr << "leaving: " << power.wakeups_per_minute() << " wakeups/min, "
+                     << power.updates_per_minute() << " updates/min" << endl;
                 exit(0);
         }
-    });
+    },
+    [&]{ return next_timeout( cleaner.idle(), power.idle()); });
 
 
     cerr << "done" << endl;
@@ -0,0 +1,115 @@
+// Delta sync: runs on the device or on a linux host
+// usage: sync_test work_dir [notebook]
+//  the notebook (default: a synthetic one of 200 pages in work_dir) is synced to the store work_dir/store,
+//  in process first, then through a loopback server (socket pair, as over usb / wifi)
+//  the synthetic notebook gets one more page before the second sync
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cmath>
+
+#include <sys/socket.h>
+
+#include "../document.cc"
+#include "../sync.cc"
+
+using namespace std;
+
+static double ms( chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>( chrono::steady_clock::now() - since).count();
+}
+
+static void synthetic( const string& path, int pages) {
+    NotebookWriter writer( path, pages);
+    for( int i = 0; i < pages; ++i) {
+        Page page;
+        for( int k = 0; k < 30; ++k) {
+            auto s = make_shared<Stroke>();
+            s->width = 2 + k % 6;
+            double cx = 150 + (k * 277 + i * 31) % 1100, cy = 200 + (k * 431 + i * 17) % 1500;
+            for( int n = 0; n < 200; ++n) {
+                double a = n * 0.08, r = 5 + n * 0.4 + (i % 7);
+                s->points.push_back( StrokePoint{ (int16_t) (cx + r * cos( a)), (int16_t) (cy + r * sin( a)), 2000, 0, 0});
+            }
+            page.strokes.push_back( s);
+        }
+        writer.add( page);
+    }
+    writer.finish();
+}
+
+static void report( const char* what, const SyncStats& s, double took) {
+    cerr << what << ": " << s.file_bytes / 1024 << " KB in " << s.chunks << " chunks, " << s.new_chunks << " new, "
+         << s.sent_chunks << " sent, " << s.sent_bytes / 1024.0 << " KB moved in " << took << " ms" << endl;
+}
+
+static bool same( const string& a, const string& b) {
+    MappedFile fa( a), fb( b);
+    return fa.size == fb.size && (!fa.size || !memcmp( fa.data, fb.data, fa.size));
+}
+
+int main(int argc,char** argv) {
+try {
+    if( argc < 2) {
+        cerr << "usage: sync_test work_dir [notebook]" << endl;
+        return 1;
+    }
+    string dir = argv[1];
+    ::mkdir( dir.c_str(), 0755);
+    string path = argc > 2 ? argv[2] : dir + "/notebook.stylo";
+    if( argc <= 2)
+        synthetic( path, 200);
+
+    {
+        SyncStore store( dir + "/store");
+        DirectTransport transport( store);
+        DocumentSync sync( dir + "/state", transport);
+        auto start = chrono::steady_clock::now();
+        auto stats = sync.sync( path, "notebook.stylo");
+        report( "in process", stats, ms( start));
+    }
+
+    if( argc <= 2)
+        synthetic( path, 201);
+
+    // store side on its own thread, as a server would be
+    int fds[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+        throw "could not create socket pair";
+    SyncStore store( dir + "/store");
+    thread server( [&]{
+        try {
+            serve( store, fds[1]);
+        }
+        catch( const string& e) {
+            cerr << "server: " << e;
+        }
+        ::close( fds[1]);
+    });
+
+    {
+        StreamTransport transport( fds[0]);
+        DocumentSync sync( dir + "/state", transport);
+        auto start = chrono::steady_clock::now();
+        auto stats = sync.sync( path, "notebook.stylo");
+        report( "loopback", stats, ms( start));
+        start = chrono::steady_clock::now();
+        stats = sync.sync( path, "notebook.stylo");
+        report( "unchanged", stats, ms( start));
+    }
+    ::close( fds[0]);
+    server.join();
+
+    bool ok = same( path, dir + "/store/notebook.stylo");
+    cerr << (ok ? "store copy identical" : "store copy DIFFERS") << endl;
+    return ok ? 0 : 1;
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
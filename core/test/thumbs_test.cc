@@ -0,0 +1,127 @@
+// Thumbnail cache: runs on the device or on a linux host
+// usage: thumbs_test cache_dir [notebook]
+//  without notebook, a synthetic one of 300 pages is generated in cache_dir/synthetic.stylo,
+//  then saved again with one page changed
+//  shows: render time of every page, overview draw time (all pages, smallest level),
+//  overview right after a save (pixels still there, not checked yet), re-renders after it
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <poll.h>
+
+#include "../document.cc"
+#include "../thumbs.cc"
+
+using namespace std;
+
+static double ms( chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>( chrono::steady_clock::now() - since).count();
+}
+
+// spirals, page changed adds one
+static Page spirals( int i, bool changed) {
+    Page page;
+    for( int k = 0; k < 30 + changed; ++k) {
+        auto s = make_shared<Stroke>();
+        s->width = 2 + k % 6;
+        double cx = 150 + (k * 277 + i * 31) % 1100, cy = 200 + (k * 431 + i * 17) % 1500;
+        for( int n = 0; n < 200; ++n) {
+            double a = n * 0.08, r = 5 + n * 0.4;
+            s->points.push_back( StrokePoint{ (int16_t) (cx + r * cos( a)), (int16_t) (cy + r * sin( a)), 2000, 0, 0});
+        }
+        page.strokes.push_back( s);
+    }
+    return page;
+}
+
+static void synthetic( const string& path, int pages, uint32_t version, int changed) {
+    NotebookWriter writer( path, version);
+    for( int i = 0; i < pages; ++i)
+        writer.add( spirals( i, i == changed));
+    writer.finish();
+}
+
+// wait for the worker, return pages rendered
+static size_t wait( ThumbnailCache& cache) {
+    size_t count = 0;
+    while( !cache.idle()) {
+        pollfd p{ cache.fd(), POLLIN, 0};
+        if( poll( &p, 1, 100) > 0)
+            count += cache.done().size();
+    }
+    return count + cache.done().size();
+}
+
+// every page at the smallest level, in rows
+static double overview( ThumbnailCache& cache, const string& path, int pages, int& shown, int* stale = nullptr) {
+    Bitmap screen( 1404, 1872);
+    int level = cache.levels() - 1, w = cache.width( level) + 4, h = cache.height( level) + 4;
+    int columns = screen.width / w;
+
+    auto start = chrono::steady_clock::now();
+    shown = 0;
+    if( stale)
+        *stale = 0;
+    for( int p = 0; p < pages && p / columns * h < screen.height; ++p) {
+        bool old = false;
+        shown += cache.draw( path, p, level, screen, Point{ p % columns * w, p / columns * h}, &old);
+        if( stale)
+            *stale += old;
+    }
+    return ms( start);
+}
+
+int main(int argc,char** argv) {
+try {
+    if( argc < 2) {
+        cerr << "usage: thumbs_test cache_dir [notebook]" << endl;
+        return 1;
+    }
+    string dir = argv[1];
+    string path = argc > 2 ? argv[2] : dir + "/synthetic.stylo";
+    ::mkdir( dir.c_str(), 0755);
+    if( argc <= 2)
+        synthetic( path, 300, 1, -1);
+
+    int pages, shown;
+    {
+        ThumbnailCache cache( dir);
+        auto start = chrono::steady_clock::now();
+        pages = cache.open( path);
+        size_t rendered = wait( cache);
+        cerr << path << ": " << pages << " pages, " << rendered << " rendered in " << ms( start) << " ms" << endl;
+    }
+
+    // as after a restart: everything from the cache file
+    ThumbnailCache cache( dir);
+    auto start = chrono::steady_clock::now();
+    cache.open( path);
+    double took = overview( cache, path, pages, shown);
+    cerr << "overview: opened in " << ms( start) << " ms, " << shown << " thumbnails drawn in " << took << " ms" << endl;
+
+    if( argc <= 2) {
+        synthetic( path, 300, 2, 42);
+        start = chrono::steady_clock::now();
+        cache.open( path);
+        int stale;
+        took = overview( cache, path, pages, shown, &stale);
+        cerr << "saved with page 42 changed: " << shown << " thumbnails drawn (" << stale << " not checked yet) in " << took << " ms" << endl;
+        cache.want( path, { 42});
+        size_t rendered = wait( cache);
+        cerr << "checked " << pages << " pages in " << ms( start) << " ms, " << rendered << " re-rendered" << endl;
+        overview( cache, path, pages, shown, &stale);
+        if( rendered != 1 || stale) {
+            cerr << "expected page 42 only re-rendered, and every page checked" << endl;
+            return 1;
+        }
+    }
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
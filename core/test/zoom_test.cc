@@ -0,0 +1,63 @@
+// Pinch zoom: two fingers zoom / pan the first page of a notebook
+// usage: zoom_test [notebook]      (default: a synthetic page)
+//  scaled preview while fingers move, full render swapped in once they are lifted
+#include <iostream>
+#include <cmath>
+
+#include "../fb.cc"
+#include "../input.cc"
+#include "../document.cc"
+#include "../zoom.cc"
+
+using namespace std;
+
+Page synthetic() {
+    Page page;
+    for( int k = 0; k < 200; ++k) {
+        auto s = make_shared<Stroke>();
+        s->brush = (Brush) (k % 3);
+        s->width = 2 + k % 6;
+        double cx = 150 + (k * 277) % 1100, cy = 200 + (k * 431) % 1500;
+        for( int n = 0; n < 200; ++n) {
+            double a = n * 0.08, r = 5 + n * 0.4;
+            s->points.push_back( StrokePoint{ (int16_t) (cx + r * cos( a)), (int16_t) (cy + r * sin( a)), (uint16_t) (n * 20), 0, 0});
+        }
+        page.strokes.push_back( s);
+    }
+    return page;
+}
+
+int main(int argc,char** argv) {
+try {
+    auto fb = FrameBuffer::open_default();
+    fb.to_s();
+
+    Page page = argc > 1 ? NotebookReader( argv[1]).page( 0) : synthetic();
+
+    Input input( { DeviceType::Touch, DeviceType::Buttons });
+    TilePool pool;                      // settle renders over all cores
+    ZoomConfig config;
+    config.pool = &pool;
+    PageZoom zoom( fb, page, config);
+    zoom.set( View{});
+
+    input.watch( zoom.fd(), [&]( short){ zoom.refine_done(); });
+    input.loop( [&]( Event& ev) {
+            if( ev.source == DeviceType::Touch)
+                zoom.touch( ev);
+            else if( ev.key == KEY_POWER) {
+                cerr << "leaving" << endl;
+                exit( 0);
+            }
+        },
+        [&]{ return zoom.idle(); });
+}
+catch(const char* msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+catch(const string& msg) {
+    cerr << "ERROR : " << msg << endl;
+    return 1;
+}
+}
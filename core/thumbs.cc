@@ -0,0 +1,448 @@
+// Page thumbnails for the navigator and zoom previews
+// pages are rendered at 1/4, then box filtered to 1/8, 1/16 ... (mip levels), packed on 4 bits
+// (the 16 levels of the panel) in a cache file per document, read through mmap:
+// an overview of hundreds of pages is only a few blits away.
+// cache file: header | block per page: entry (page hash, document version) | level 0 | level 1 ...
+//  - a page is fresh when its entry has the document version
+//  - after a save (new version), pages are still shown from their pixels (possibly stale) while the worker
+//    checks them: a page whose content hash (stored bytes) did not change is fresh again without rendering
+//  - the file only grows while open, blocks beyond the page count are ignored
+// rendering runs on a low priority thread: pages asked for (visible) first, then the rest
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "document.cc"
+#include "render.cc"
+#include "power.cc"
+
+// 4 bits gray image, 2 pixels per byte (high nibble first)
+struct PackedGray {
+    int width, height;
+
+    int stride() const { return (width + 1) / 2; }
+    size_t bytes() const { return (size_t) stride() * height; }
+
+    static void pack( const Surface& src, uint8_t* out) {
+        int stride = (src.width + 1) / 2;
+        for( int y = 0; y < src.height; ++y) {
+            auto s = src.row( y);
+            auto d = out + (size_t) y * stride;
+            for( int x = 0; x < src.width; x += 2) {
+                int a = (rgb565_to_gray( s[x]) * 15 + 127) / 255;
+                int b = x + 1 < src.width ? (rgb565_to_gray( s[x + 1]) * 15 + 127) / 255 : 0;
+                d[x / 2] = a << 4 | b;
+            }
+        }
+    }
+
+    // packed pixels drawn at dst position at, clipped
+    Rect blit( const Surface& dst, Point at, const uint8_t* data) const {
+        auto r = Rect{ at, Point{ at.x + width, at.y + height} }.intersected( dst.bounds());
+        if( r.empty())
+            return r;
+
+        uint16_t colors[16];
+        for( int i = 0; i < 16; ++i)
+            colors[i] = gray_to_rgb565( i * 17);
+
+        for( int y = r.topLeft.y; y < r.bottomRight.y; ++y) {
+            auto s = data + (size_t) (y - at.y) * stride();
+            auto d = dst.row( y);
+            for( int x = r.topLeft.x; x < r.bottomRight.x; ++x) {
+                int i = x - at.x;
+                d[x] = colors[ i & 1 ? s[i / 2] & 15 : s[i / 2] >> 4];
+            }
+        }
+        return r;
+    }
+};
+
+struct ThumbConfig {
+    int width  = 1404;          // page size
+    int height = 1872;
+    int shift  = 2;             // level 0 at scale 1 / 2^shift
+    int levels = 3;             // 1/4, 1/8, 1/16
+    uint16_t paper = 0xffff;
+};
+
+struct ThumbHeader {
+    char magic[4] = { 'S', 'T', 'H', 'M' };
+    uint32_t format = 1;
+    uint32_t width = 0, height = 0;     // page size
+    uint32_t shift = 0, levels = 0;
+    uint32_t blocks = 0;                // page blocks in file
+    uint32_t reserved = 0;
+};
+
+struct ThumbEntry {
+    uint64_t hash;              // page content, 0 => never rendered
+    uint32_t version;           // document version it was checked against
+    uint32_t reserved;
+};
+
+class ThumbnailCache {
+public:
+    using Config = ThumbConfig;
+
+private:
+    // cache file mapping, kept alive by the worker while it writes
+    struct Mapping {
+        uint8_t* data = nullptr;
+        size_t size = 0;
+
+        ~Mapping() {
+            if( data)
+                munmap( data, size);
+        }
+    };
+
+    struct Doc {
+        std::shared_ptr<NotebookReader> reader;
+        std::shared_ptr<Mapping> map;
+        int fd = -1;
+        int pages = 0;
+        uint32_t version = 0;
+        unsigned generation = 0;        // bumped on reopen: renders of an older one are dropped
+        std::vector<uint8_t> fresh;
+    };
+
+    struct Job {
+        std::string doc;
+        int page;
+    };
+
+    std::string dir;
+    Config config;
+    std::vector<PackedGray> sizes;      // per level
+    std::vector<size_t> offsets;        // per level, in a block
+    size_t block;
+
+    std::mutex lock;
+    std::unordered_map<std::string, Doc> docs;
+    std::deque<Job> jobs;
+    std::vector<std::pair<std::string, int>> finished;
+    std::condition_variable wake;
+    bool busy = false, quit = false;
+    std::atomic<bool> stopping{ false};
+    std::thread worker;
+    WorkerGate* gate;
+    int doorbell;                       // eventfd, rung when thumbnails are ready
+
+public:
+    // cache files in dir (created if missing)
+    // gate: rendering pauses with the other workers (see PowerManager::workers)
+    ThumbnailCache( const std::string& dir, WorkerGate* gate = nullptr, Config config = Config{})
+        : dir( dir), config( config), gate( gate)
+    {
+        ::mkdir( dir.c_str(), 0755);
+
+        block = sizeof( ThumbEntry);
+        for( int l = 0; l < config.levels; ++l) {
+            int s = config.shift + l;
+            sizes.push_back( PackedGray{ std::max( 1, config.width >> s), std::max( 1, config.height >> s)});
+            offsets.push_back( block);
+            block += (sizes.back().bytes() + 15) & ~15;
+        }
+
+        doorbell = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if( doorbell < 0)
+            throw std::string( "ThumbnailCache: could not create eventfd\n");
+        worker = std::thread( &ThumbnailCache::main, this);
+    }
+
+    ThumbnailCache( const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=( const ThumbnailCache&) = delete;
+
+    ~ThumbnailCache() {
+        stopping = true;
+        if( gate)
+            gate->wake();
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            quit = true;
+        }
+        wake.notify_all();
+        worker.join();
+        for( auto& d: docs)
+            ::close( d.second.fd);
+        ::close( doorbell);
+    }
+
+    // poll this fd (Input::watch), then call done()
+    int fd() const {
+        return doorbell;
+    }
+
+    int levels() const { return sizes.size(); }
+    int width( int level) const { return sizes[ level].width; }
+    int height( int level) const { return sizes[ level].height; }
+
+    // (re)open document after a save: pages not fresh for its version are queued
+    // return page count
+    int open( const std::string& path) {
+        auto reader = std::make_shared<NotebookReader>( path);
+
+        std::lock_guard<std::mutex> guard( lock);
+        auto& doc = docs[ path];
+        if( doc.reader && doc.version == reader->version() && doc.pages == reader->pages())
+            return doc.pages;
+
+        if( doc.fd < 0)
+            doc.fd = open_file( path);
+        doc.reader = reader;
+        doc.pages = reader->pages();
+        doc.version = reader->version();
+        ++doc.generation;
+        doc.fresh.assign( doc.pages, 0);
+        grow( doc);
+
+        for( int p = 0; p < doc.pages; ++p) {
+            doc.fresh[p] = entry( doc, p).version == doc.version && entry( doc, p).hash != 0;
+            if( !doc.fresh[p])
+                jobs.push_back( Job{ path, p});
+        }
+        wake.notify_all();
+        return doc.pages;
+    }
+
+    // document closed or deleted: its pending renders are dropped, the cache file stays
+    void close( const std::string& path) {
+        std::lock_guard<std::mutex> guard( lock);
+        auto it = docs.find( path);
+        if( it == docs.end())
+            return;
+        ::close( it->second.fd);
+        docs.erase( it);
+        jobs.erase( std::remove_if( jobs.begin(), jobs.end(), [&]( auto& j){ return j.doc == path; }), jobs.end());
+    }
+
+    // pages about to be shown (navigator scroll, zoom): rendered first, in order
+    void want( const std::string& path, const std::vector<int>& pages) {
+        std::lock_guard<std::mutex> guard( lock);
+        auto it = docs.find( path);
+        if( it == docs.end())
+            return;
+        for( auto p = pages.rbegin(); p != pages.rend(); ++p) {
+            if( *p < 0 || *p >= it->second.pages || it->second.fresh[ *p])
+                continue;
+            auto j = std::find_if( jobs.begin(), jobs.end(), [&]( auto& j){ return j.page == *p && j.doc == path; });
+            if( j != jobs.end())
+                jobs.erase( j);
+            jobs.push_front( Job{ path, *p});
+        }
+        wake.notify_all();
+    }
+
+    // thumbnail of page at level drawn in s at position at, false if never rendered
+    // (caller draws a placeholder, and redraws on done())
+    // stale: set if the page was not checked yet against the document version (redrawn on done() if changed)
+    bool draw( const std::string& path, int page, int level, const Surface& s, Point at, bool* stale = nullptr) {
+        std::lock_guard<std::mutex> guard( lock);
+        auto it = docs.find( path);
+        if( it == docs.end() || page < 0 || page >= it->second.pages || !entry( it->second, page).hash)
+            return false;
+        level = std::max( 0, std::min( level, levels() - 1));
+        sizes[ level].blit( s, at, pixels( it->second, page) + offsets[ level]);
+        if( stale)
+            *stale = !it->second.fresh[ page];
+        return true;
+    }
+
+    // level 0 is at scale 1 / 2^shift()
+    int shift() const { return config.shift; }
+
+    // pages whose pixels changed since last call (doorbell rung)
+    std::vector<std::pair<std::string, int>> done() {
+        uint64_t count;
+        (void) !::read( doorbell, &count, sizeof( count));
+        std::lock_guard<std::mutex> guard( lock);
+        std::vector<std::pair<std::string, int>> list;
+        list.swap( finished);
+        return list;
+    }
+
+    // no page waiting for a render
+    bool idle() {
+        std::lock_guard<std::mutex> guard( lock);
+        return jobs.empty() && !busy;
+    }
+
+private:
+    // FNV-1a
+    static uint64_t hash( const std::string& data) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for( unsigned char c: data)
+            h = (h ^ c) * 0x100000001b3ull;
+        return h | 1;
+    }
+
+    ThumbEntry& entry( Doc& doc, int page) {
+        return *(ThumbEntry*) pixels( doc, page);
+    }
+
+    uint8_t* pixels( Doc& doc, int page) {
+        return doc.map->data + sizeof( ThumbHeader) + page * block;
+    }
+
+    // cache file of document path, reset if made with another geometry
+    int open_file( const std::string& path) {
+        auto name = dir + "/" + std::to_string( hash( path)) + ".thm";
+        int fd = ::open( name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if( fd < 0)
+            throw "ThumbnailCache: could not open '" + name + "'\n";
+
+        ThumbHeader want, have;
+        want.width = config.width;
+        want.height = config.height;
+        want.shift = config.shift;
+        want.levels = config.levels;
+
+        bool ok = pread( fd, &have, sizeof( have), 0) == sizeof( have);
+        struct stat st;
+        ok = ok && fstat( fd, &st) == 0 && !std::memcmp( &have, &want, offsetof( ThumbHeader, blocks))
+             && (uint64_t) st.st_size >= sizeof( ThumbHeader) + (uint64_t) have.blocks * block;
+        if( !ok && (ftruncate( fd, 0) || pwrite( fd, &want, sizeof( want), 0) != sizeof( want))) {
+            ::close( fd);
+            throw "ThumbnailCache: could not write '" + name + "'\n";
+        }
+        return fd;
+    }
+
+    // room for every page in the file and the mapping (new blocks are zero: never rendered)
+    void grow( Doc& doc) {
+        ThumbHeader h;
+        if( pread( doc.fd, &h, sizeof( h), 0) != sizeof( h))
+            throw std::string( "ThumbnailCache: could not read cache file\n");
+
+        uint32_t blocks = std::max<uint32_t>( h.blocks, doc.pages);
+        size_t size = sizeof( ThumbHeader) + blocks * block;
+        if( blocks != h.blocks) {
+            h.blocks = blocks;
+            if( ftruncate( doc.fd, size) || pwrite( doc.fd, &h, sizeof( h), 0) != sizeof( h))
+                throw std::string( "ThumbnailCache: could not grow cache file\n");
+        }
+        if( doc.map && doc.map->size == size)
+            return;
+
+        auto map = std::make_shared<Mapping>();
+        void* data = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, doc.fd, 0);
+        if( data == MAP_FAILED)
+            throw std::string( "ThumbnailCache: could not map cache file\n");
+        map->data = (uint8_t*) data;
+        map->size = size;
+        doc.map = map;              // the worker may still write in the previous one
+    }
+
+    void main() {
+        // below the UI thread: thumbnails fill in when the CPU is free
+        setpriority( PRIO_PROCESS, syscall( SYS_gettid), 10);
+
+        Bitmap bitmap( sizes[0].width, sizes[0].height, config.paper);
+        std::vector<std::unique_ptr<Bitmap>> smaller;
+        for( int l = 1; l < levels(); ++l)
+            smaller.emplace_back( new Bitmap( sizes[l].width, sizes[l].height, config.paper));
+        std::vector<uint8_t> scratch( block);     // packed levels, copied to the cache once the render is current
+
+        for( ;;) {
+            Job job;
+            std::shared_ptr<NotebookReader> reader;
+            std::shared_ptr<Mapping> map;
+            unsigned generation;
+            uint32_t version;
+            ThumbEntry old;
+            {
+                std::unique_lock<std::mutex> guard( lock);
+                busy = false;
+                wake.wait( guard, [&]{ return quit || !jobs.empty(); });
+                if( quit)
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+
+                auto it = docs.find( job.doc);
+                if( it == docs.end() || it->second.fresh[ job.page])
+                    continue;
+                busy = true;
+                auto& doc = it->second;
+                reader = doc.reader;
+                map = doc.map;
+                generation = doc.generation;
+                version = doc.version;
+                old = entry( doc, job.page);
+            }
+            if( gate)
+                gate->wait( [&]{ return stopping.load(); });
+            if( stopping)
+                return;
+
+            try {
+                // unchanged since last render: pixels are still good, page not even decoded
+                auto data = reader->page_data( job.page);
+                uint64_t h = hash( data);
+                if( h != old.hash) {
+                    auto page = PageCodec::decode( data);
+                    render( page, bitmap, bitmap.bounds(), View{ std::ldexp( 1.f, -config.shift)}, config.paper);
+                    sizes[0].pack( bitmap, scratch.data() + offsets[0]);
+                    const Surface* up = &bitmap;
+                    for( int l = 1; l < levels(); ++l) {
+                        downsample( *smaller[l - 1], *up);
+                        sizes[l].pack( *smaller[l - 1], scratch.data() + offsets[l]);
+                        up = smaller[l - 1].get();
+                    }
+                }
+
+                std::lock_guard<std::mutex> guard( lock);
+                auto it = docs.find( job.doc);
+                if( it == docs.end() || it->second.generation != generation)
+                    continue;               // reopened meanwhile: cache untouched, queued again if needed
+                if( h != old.hash) {
+                    auto out = map->data + sizeof( ThumbHeader) + job.page * block;
+                    std::memcpy( out + offsets[0], scratch.data() + offsets[0], block - offsets[0]);
+                }
+                auto& e = entry( it->second, job.page);
+                e.hash = h;
+                e.version = version;
+                it->second.fresh[ job.page] = 1;
+                if( h == old.hash)
+                    continue;
+                finished.emplace_back( job.doc, job.page);
+            }
+            catch( const std::string& e) {
+                std::cerr << e;             // page stays a placeholder
+                continue;
+            }
+            catch( const char* e) {
+                std::cerr << e;
+                continue;
+            }
+            uint64_t one = 1;
+            (void) !::write( doorbell, &one, sizeof( one));
+        }
+    }
+};
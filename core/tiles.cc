@@ -0,0 +1,268 @@
+// Parallel tile renderer
+// damaged areas are cut along a fixed tile grid, tiles are spread over a pool of workers
+// (the calling thread is one of them) that steal from each other once their own tiles are done,
+// and the call returns once every tile is rendered, ready for the refresh.
+// tiles never overlap, and ink ops are clipped and idempotent: output is the same pixels
+// as a single render() call, whatever the number of workers.
+// threads = 1: deterministic mode, tiles rendered in order on the calling thread (tests)
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "document.cc"
+#include "render.cc"
+
+// persistent workers running batches of tasks, with work stealing
+class TilePool {
+    struct Queue {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    int count;                      // workers, calling thread included
+    int size;                       // tile size (pixels)
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> helpers;
+
+    std::mutex batch;               // one batch at a time (several callers)
+    std::mutex lock;
+    std::condition_variable started, finished;
+    const std::function<void( int, int)>* job = nullptr;
+    unsigned round = 0;
+    int running = 0;                // pool threads still busy on the round
+    bool quit = false;
+    std::string error;
+
+public:
+    // threads: 0 => all cores, 1 => deterministic single thread mode
+    TilePool( int threads = 0, int tile = 256)
+        : count( threads > 0 ? threads : std::max( 1u, std::thread::hardware_concurrency())),
+          size( std::max( 16, tile))
+    {
+        for( int i = 0; i < count; ++i)
+            queues.emplace_back( new Queue);
+        for( int i = 1; i < count; ++i)
+            helpers.emplace_back( &TilePool::main, this, i);
+    }
+
+    TilePool( const TilePool&) = delete;
+    TilePool& operator=( const TilePool&) = delete;
+
+    ~TilePool() {
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            quit = true;
+        }
+        started.notify_all();
+        for( auto& t: helpers)
+            t.join();
+    }
+
+    int workers() const { return count; }
+    int tile() const { return size; }
+
+    // fn( task, worker) for tasks 0..tasks-1, return once all are done
+    // each worker starts on a contiguous range of tasks (neighbour tiles), then steals
+    // first error is rethrown once the batch is over
+    void run( int tasks, const std::function<void( int task, int worker)>& fn) {
+        std::lock_guard<std::mutex> serial( batch);
+        if( count == 1 || tasks <= 1) {
+            for( int i = 0; i < tasks; ++i)
+                fn( i, 0);
+            return;
+        }
+
+        for( int w = 0; w < count; ++w) {
+            std::lock_guard<std::mutex> guard( queues[w]->lock);
+            for( int i = tasks * w / count; i < tasks * (w + 1) / count; ++i)
+                queues[w]->tasks.push_back( i);
+        }
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            job = &fn;
+            running = count - 1;
+            error.clear();
+            ++round;
+        }
+        started.notify_all();
+
+        work( 0);
+
+        std::unique_lock<std::mutex> guard( lock);
+        finished.wait( guard, [&]{ return running == 0; });
+        job = nullptr;
+        if( !error.empty())
+            throw error;
+    }
+
+private:
+    void main( int w) {
+        unsigned seen = 0;
+        for( ;;) {
+            {
+                std::unique_lock<std::mutex> guard( lock);
+                started.wait( guard, [&]{ return quit || round != seen; });
+                if( quit)
+                    return;
+                seen = round;
+            }
+            work( w);
+            {
+                std::lock_guard<std::mutex> guard( lock);
+                if( --running == 0)
+                    finished.notify_all();
+            }
+        }
+    }
+
+    void work( int w) {
+        int task;
+        while( pop( w, task) || steal( w, task)) {
+            try {
+                (*job)( task, w);
+            }
+            catch( const std::string& e) {
+                fail( e);
+            }
+            catch( const char* e) {
+                fail( e);
+            }
+        }
+    }
+
+    // own tasks in order from the front, stolen ones from the back: a thief takes the tiles
+    // farthest from where the owner is working
+    bool pop( int w, int& task) {
+        auto& q = *queues[w];
+        std::lock_guard<std::mutex> guard( q.lock);
+        if( q.tasks.empty())
+            return false;
+        task = q.tasks.front();
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool steal( int w, int& task) {
+        for( int i = 1; i < count; ++i) {
+            auto& q = *queues[ (w + i) % count];
+            std::lock_guard<std::mutex> guard( q.lock);
+            if( !q.tasks.empty()) {
+                task = q.tasks.back();
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // drop the remaining tasks
+    void fail( const std::string& e) {
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            if( error.empty())
+                error = e;
+        }
+        for( auto& q: queues) {
+            std::lock_guard<std::mutex> guard( q->lock);
+            q->tasks.clear();
+        }
+    }
+};
+
+// areas (surface coordinates) cut along the tile grid: parts of the areas in each grid cell
+// a cell is a single task, so two tasks never write the same pixels
+inline std::vector<std::vector<Rect>> tiles( const std::vector<Rect>& areas, const Rect& bounds, int size) {
+    std::vector<std::vector<Rect>> out;
+    std::vector<Rect> clipped;
+    for( auto& a: areas) {
+        auto c = a.intersected( bounds);
+        if( !c.empty())
+            clipped.push_back( c);
+    }
+
+    for( size_t i = 0; i < clipped.size(); ++i) {
+        auto& a = clipped[i];
+        for( int ty = a.topLeft.y / size * size; ty < a.bottomRight.y; ty += size)
+            for( int tx = a.topLeft.x / size * size; tx < a.bottomRight.x; tx += size) {
+                Rect cell{ Point{ tx, ty}, Point{ tx + size, ty + size} };
+
+                // cell already taken by a previous area
+                bool seen = false;
+                for( size_t j = 0; j < i && !seen; ++j)
+                    seen = !clipped[j].intersected( cell).empty();
+                if( seen)
+                    continue;
+
+                out.emplace_back();
+                for( size_t j = i; j < clipped.size(); ++j) {
+                    auto c = clipped[j].intersected( cell);
+                    if( !c.empty())
+                        out.back().push_back( c);
+                }
+            }
+    }
+    return out;
+}
+
+// page areas shown in surface areas, rendered in tiles over the pool
+// return the surface areas rendered (clipped), to be refreshed by the caller
+// cancelled: checked before each tile, tiles left are skipped once true (render thrown away, eg: zoom.cc)
+inline std::vector<Rect> render( const Page& page, const Surface& s, const std::vector<Rect>& areas, TilePool& pool,
+                                 const View& view = View{}, uint16_t paper = 0xffff,
+                                 const std::function<bool()>& cancelled = nullptr) {
+    auto cells = tiles( areas, s.bounds(), pool.tile());
+    if( cells.empty())
+        return {};
+
+    // strokes crossing the damage, with their page bounds (computed once, not per tile)
+    // texts are few: checked per tile
+    Rect all = cells[0][0];
+    for( auto& cell: cells)
+        for( auto& c: cell)
+            all = all.united( c);
+    auto area = view.page( all);
+
+    struct Candidate {
+        Rect bounds;
+        const Stroke* stroke;
+    };
+    std::vector<Candidate> candidates;
+    for( auto& stroke: page.strokes) {
+        auto b = stroke->bounds();
+        if( !b.intersected( area).empty())
+            candidates.push_back( Candidate{ b, stroke.get()});
+    }
+
+    pool.run( cells.size(), [&]( int task, int) {
+        if( cancelled && cancelled())
+            return;
+        for( auto& clip: cells[ task]) {
+            fill( s, clip, paper);
+            auto tile = view.page( clip);
+            for( auto& c: candidates)
+                if( !c.bounds.intersected( tile).empty())
+                    render( *c.stroke, s, clip, view);
+            for( auto& text: page.texts)
+                if( !bounds( text).intersected( tile).empty())
+                    render( text, s, clip, view);
+        }
+    });
+
+    std::vector<Rect> done;
+    for( auto& a: areas) {
+        auto r = a.intersected( s.bounds());
+        if( !r.empty())
+            done.push_back( r);
+    }
+    return done;
+}
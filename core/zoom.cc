@@ -0,0 +1,378 @@
+// Pinch zoom / pan of a page
+// while fingers move, the page is shown scaled from cached downsampled renders of it,
+// with a fast waveform: the cost only depends on the screen size, not on the page content.
+// those renders are made on a background thread too: until they are ready (page opened or edited),
+// previews come from the thumbnail cache (thumbs.cc) when one is given
+// once fingers are lifted, the page is rendered at the final zoom on a background thread,
+// then swapped in with a clean refresh (cancelled if the user zooms again meanwhile):
+// the UI thread never waits for it, a cancelled render stops at the next tile (or band)
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "fb.cc"
+#include "raster.cc"
+#include "document.cc"
+#include "render.cc"
+#include "tiles.cc"
+#include "thumbs.cc"
+#include "input.cc"
+
+// two fingers gesture => page view
+// the page point under the fingers centroid at start stays under the centroid,
+// scale follows the distance between fingers
+class Pinch {
+    bool active = false;
+    int ids[2];
+    float cx0, cy0, d0;
+    View start;
+
+public:
+    float min_scale = 0.5f, max_scale = 4;
+
+    bool pinching() const {
+        return active;
+    }
+
+    // feed a touch frame, return true if view changed
+    bool update( const Event& ev, View& view) {
+        const Finger* f[2];
+        int n = 0;
+        for( auto& finger: ev.fingers)
+            if( finger.id >= 0 && n < 2)
+                f[n++] = &finger;
+
+        if( n < 2 || ev.fingers_down() > 2) {
+            active = false;
+            return false;
+        }
+
+        float cx = (f[0]->pos.x + f[1]->pos.x) / 2.f, cy = (f[0]->pos.y + f[1]->pos.y) / 2.f;
+        float d = std::max( 1.f, std::hypot( (float) (f[0]->pos.x - f[1]->pos.x), (float) (f[0]->pos.y - f[1]->pos.y)));
+
+        // new pair of fingers: gesture restarts from the current view
+        if( !active || ids[0] != f[0]->id || ids[1] != f[1]->id) {
+            active = true;
+            ids[0] = f[0]->id;
+            ids[1] = f[1]->id;
+            cx0 = cx; cy0 = cy; d0 = d;
+            start = view;
+            return false;
+        }
+
+        float px = cx0 / start.scale + start.x, py = cy0 / start.scale + start.y;     // page point held
+        View v;
+        v.scale = std::min( max_scale, std::max( min_scale, start.scale * d / d0));
+        v.x = px - cx / v.scale;
+        v.y = py - cy / v.scale;
+
+        if( v.scale == view.scale && v.x == view.x && v.y == view.y)
+            return false;
+        view = v;
+        return true;
+    }
+};
+
+struct ZoomConfig {
+    int levels     = 3;                             // cached renders at scale 1, 1/2, 1/4
+    int frame_ms   = 60;                            // min delay between two previews
+    waveform_mode preview  = WAVEFORM_MODE_DU;
+    waveform_mode final    = WAVEFORM_MODE_GC16;
+    uint16_t paper = 0xffff;
+    TilePool* pool = nullptr;                       // full renders in tiles over the pool
+
+    // previews until the page is rendered: its thumbnail (optional, may be stale)
+    ThumbnailCache* thumbs = nullptr;
+    std::string doc;                                // document path in the cache
+    int page = 0;
+};
+
+class PageZoom {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = ZoomConfig;
+
+private:
+    FrameBuffer& fb;
+    const Page& page;           // not edited while zoom is in use (see invalidate)
+    Config config;
+
+    std::vector<std::unique_ptr<Bitmap>> levels;    // page at scale 1 / 2^(first + i), none => blank paper
+    int first = 0;
+    View shown, wanted;
+    Pinch pinch;
+    Clock::time_point next_frame;
+    bool dirty = false;         // wanted not shown yet
+
+    // background renders: a persistent worker takes the last request of each kind, page levels first
+    // generations are bumped by each request or cancel, renders of an older one are dropped
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool quit = false;
+
+    // refinement: full resolution render of a view
+    std::atomic<unsigned> generation{ 0};
+    bool requested = false;
+    unsigned request_generation = 0;
+    View request_view;
+    std::unique_ptr<Bitmap> refined;            // ready render, and its request
+    unsigned refined_generation = 0;
+    View refined_view;
+
+    // page levels (see invalidate)
+    std::atomic<unsigned> levels_generation{ 0};
+    bool levels_requested = false;
+    unsigned levels_request = 0;
+    std::vector<std::unique_ptr<Bitmap>> rendered;  // ready levels, and their request
+    unsigned rendered_generation = 0;
+
+    int doorbell;               // eventfd, rung when a render is ready
+
+public:
+    PageZoom( FrameBuffer& fb, const Page& page, Config config = Config{})
+        : fb( fb), page( page), config( config)
+    {
+        doorbell = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if( doorbell < 0)
+            throw std::string( "PageZoom: could not create eventfd\n");
+        invalidate();
+        worker = std::thread( &PageZoom::main, this);
+    }
+
+    PageZoom( const PageZoom&) = delete;
+    PageZoom& operator=( const PageZoom&) = delete;
+
+    // waits for the render in progress to reach its next tile
+    ~PageZoom() {
+        ++generation;
+        ++levels_generation;
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            quit = true;
+        }
+        wake.notify_all();
+        worker.join();
+        ::close( doorbell);
+    }
+
+    // poll this fd (Input::watch), then call refine_done()
+    int fd() const {
+        return doorbell;
+    }
+
+    const View& view() const {
+        return wanted;
+    }
+
+    // page content changed: cached renders are made again on the worker,
+    // previews use the page thumbnail meanwhile (or blank paper)
+    void invalidate() {
+        cancel();
+        levels.clear();
+        first = 0;
+        if( config.thumbs) {
+            auto& thumbs = *config.thumbs;
+            std::unique_ptr<Bitmap> thumbnail( new Bitmap( thumbs.width( 0), thumbs.height( 0), config.paper));
+            if( thumbs.draw( config.doc, config.page, 0, *thumbnail, Point{ 0, 0})) {
+                levels.push_back( std::move( thumbnail));
+                first = thumbs.shift();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            levels_request = ++levels_generation;
+            levels_requested = true;
+            rendered.clear();
+        }
+        wake.notify_one();
+    }
+
+    // touch frame from the event loop, return true if used by the gesture
+    bool touch( const Event& ev) {
+        bool was = pinch.pinching();
+        if( pinch.update( ev, wanted)) {
+            cancel();
+            dirty = true;
+            show();
+        }
+        else if( was && !pinch.pinching())
+            refine();               // fingers lifted: final render
+        return pinch.pinching() || was;
+    }
+
+    // set view directly (eg: zoom buttons)
+    void set( const View& v) {
+        cancel();
+        wanted = v;
+        dirty = true;
+        show();
+        refine();
+    }
+
+    // event loop idle hook: shows throttled previews, return ms before next call, -1 if none
+    int idle() {
+        if( !dirty)
+            return -1;
+        show();
+        return dirty ? ms( next_frame - Clock::now()) : -1;
+    }
+
+    // background render is ready: page levels replace the thumbnail, a refined view is swapped in
+    // with a clean refresh; renders of an older request (cancelled after ringing) are dropped
+    void refine_done() {
+        uint64_t count;
+        if( ::read( doorbell, &count, sizeof( count)) < 0)
+            return;
+
+        std::unique_ptr<Bitmap> ready;
+        View view;
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            if( !rendered.empty() && rendered_generation == levels_generation) {
+                levels = std::move( rendered);
+                rendered.clear();
+                first = 0;
+            }
+            if( !refined || refined_generation != generation)
+                return;
+            ready = std::move( refined);
+            view = refined_view;
+        }
+        if( view.scale != wanted.scale || view.x != wanted.x || view.y != wanted.y)
+            return;
+
+        blit( Surface( fb), Point{ 0, 0}, *ready, ready->bounds());
+        fb.refresh( fb, config.final);
+        shown = wanted;
+    }
+
+private:
+    static int ms( Clock::duration d) {
+        return std::max<int>( 0, std::chrono::duration_cast<std::chrono::milliseconds>( d).count() + 1);
+    }
+
+    // scaled preview from the smallest cached level still at least as detailed as the view
+    void show() {
+        auto now = Clock::now();
+        if( now < next_frame)
+            return;
+
+        Surface screen( fb);
+        if( levels.empty())
+            fill( screen, screen.bounds(), config.paper);
+        else {
+            int level = 0;
+            while( level + 1 < (int) levels.size() && std::ldexp( 1.f, -(first + level + 1)) >= wanted.scale)
+                ++level;
+            auto& src = *levels[ level];
+            float k = std::ldexp( 1.f, -(first + level));     // level pixels per page pixel
+            blit_scaled( screen, screen.bounds(), src, wanted.x * k, wanted.y * k, k / wanted.scale, config.paper);
+        }
+        fb.refresh( fb, config.preview);
+
+        shown = wanted;
+        dirty = false;
+        next_frame = now + std::chrono::milliseconds( config.frame_ms);
+    }
+
+    // full resolution render of the wanted view, on the worker (replaces any request not started yet)
+    void refine() {
+        {
+            std::lock_guard<std::mutex> guard( lock);
+            request_generation = ++generation;
+            request_view = wanted;
+            requested = true;
+            refined.reset();
+        }
+        wake.notify_one();
+    }
+
+    void main() {
+        for( ;;) {
+            bool page_levels;
+            unsigned gen;
+            View view;
+            {
+                std::unique_lock<std::mutex> guard( lock);
+                wake.wait( guard, [&]{ return quit || requested || levels_requested; });
+                if( quit)
+                    return;
+                page_levels = levels_requested;
+                if( page_levels) {
+                    levels_requested = false;
+                    gen = levels_request;
+                }
+                else {
+                    requested = false;
+                    gen = request_generation;
+                    view = request_view;
+                }
+            }
+
+            auto& current = page_levels ? levels_generation : generation;
+            auto cancelled = [&]{ return current != gen; };
+            std::unique_ptr<Bitmap> bitmap( new Bitmap( fb.width(), fb.height(), config.paper));
+            draw( *bitmap, view, cancelled);
+
+            std::vector<std::unique_ptr<Bitmap>> smaller;
+            if( page_levels) {
+                smaller.push_back( std::move( bitmap));
+                for( int i = 1; i < config.levels && !cancelled(); ++i) {
+                    auto& up = *smaller.back();
+                    smaller.emplace_back( new Bitmap( up.width / 2, up.height / 2, config.paper));
+                    downsample( *smaller.back(), up);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> guard( lock);
+                if( cancelled())
+                    continue;
+                if( page_levels) {
+                    rendered = std::move( smaller);
+                    rendered_generation = gen;
+                }
+                else {
+                    refined = std::move( bitmap);
+                    refined_generation = gen;
+                    refined_view = view;
+                }
+            }
+            uint64_t one = 1;
+            (void) !::write( doorbell, &one, sizeof( one));
+        }
+    }
+
+    // page shown by view on the whole bitmap, stopped early once cancelled
+    void draw( Bitmap& bitmap, const View& view, const std::function<bool()>& cancelled) {
+        if( config.pool)
+            render( page, bitmap, { bitmap.bounds()}, *config.pool, view, config.paper, cancelled);
+        else {
+            // bands: stop early when a new gesture starts
+            for( int y = 0; y < bitmap.height && !cancelled(); y += 64)
+                render( page, bitmap, Rect{ Point{ 0, y}, Point{ bitmap.width, std::min( y + 64, bitmap.height)} }, view, config.paper);
+        }
+    }
+
+    // drop the request in progress (the worker stops at its next tile), and any render not shown yet
+    void cancel() {
+        std::lock_guard<std::mutex> guard( lock);
+        ++generation;
+        requested = false;
+        refined.reset();
+    }
+};